@@ -0,0 +1,262 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "timers.hpp"
+#include "../src/QubitLayer.hpp"
+#include "../src/Circuit.hpp"
+#include "../src/kernels.hpp"
+
+struct Options
+{
+    unsigned int minQubits{10};
+    unsigned int maxQubits{0}; // 0 for the largest dense state that fits in half the memory
+    unsigned int step{2};
+    unsigned int warmup{1};
+    unsigned int repeats{5};
+    int numThreads{0}; // 0 for the default number of threads of a QubitLayer
+    std::string jsonFile{"bench.json"};
+};
+
+struct Result
+{
+    std::string benchmark; // gate or circuit
+    std::string name;
+    std::string position; // target of a gate: low, mid or high bit
+    unsigned int numQubits;
+    unsigned long long int numGates;
+    double nsPerGate;
+    double gbPerSecond;
+    double amplitudesPerSecond;
+};
+
+// gates timed at every qubit count, with the number of controls they have
+struct GateBenchmark
+{
+    std::string name;
+    int numControls;
+};
+
+const std::vector<GateBenchmark> gateBenchmarks{{"X", 0}, {"Y", 0}, {"Z", 0}, {"H", 0}, {"Rx", 0}, {"Ry", 0}, {"Rz", 0}, {"CNOT", 1}, {"CZ", 1}, {"Toffoli", 2}};
+
+void applyGate(QubitLayer &q, const std::string &name, int target)
+{
+    unsigned int numQubits = q.getNumQubits();
+    // controls on the next qubits, wrapping around, so they are never the target
+    int control1 = (target + 1) % numQubits;
+    int control2 = (target + 2) % numQubits;
+    if (name == "X")
+        q.applyPauliX(target);
+    else if (name == "Y")
+        q.applyPauliY(target);
+    else if (name == "Z")
+        q.applyPauliZ(target);
+    else if (name == "H")
+        q.applyHadamard(target);
+    else if (name == "Rx")
+        q.applyRx(target, pi / 3);
+    else if (name == "Ry")
+        q.applyRy(target, pi / 3);
+    else if (name == "Rz")
+        q.applyRz(target, pi / 3);
+    else if (name == "CNOT")
+        q.applyCnot(control1, target);
+    else if (name == "CZ")
+        q.applyCz(control1, target);
+    else
+        q.applyToffoli(control1, control2, target);
+}
+
+Circuit groverIteration(unsigned int numQubits)
+{
+    // one iteration searching for state 0, i.e. the oracle and the diffusion operator
+    std::vector<int> controls;
+    for (unsigned int i = 0; i + 1 < numQubits; i++)
+        controls.push_back(i);
+    Circuit c(numQubits);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        if (pass == 1)
+            for (unsigned int i = 0; i < numQubits; i++)
+                c.applyHadamard(i);
+        for (unsigned int i = 0; i < numQubits; i++)
+            c.applyPauliX(i);
+        c.applyMcphase(controls.data(), controls.size(), numQubits - 1);
+        for (unsigned int i = 0; i < numQubits; i++)
+            c.applyPauliX(i);
+        if (pass == 1)
+            for (unsigned int i = 0; i < numQubits; i++)
+                c.applyHadamard(i);
+    }
+    return c;
+}
+
+Circuit qft(unsigned int numQubits)
+{
+    Circuit c(numQubits);
+    for (int target = numQubits - 1; target >= 0; target--)
+    {
+        c.applyHadamard(target);
+        for (int control = target - 1; control >= 0; control--)
+        {
+            precision theta = pi / (1ULL << (target - control));
+            c.applyUnitary({target}, {{1, 0}, {0, 0}, {0, 0}, std::polar<precision>(1, theta)}, {control});
+        }
+    }
+    // reverse the order of the qubits, which only relabels them
+    for (unsigned int i = 0; i < numQubits / 2; i++)
+        c.applySwap(i, numQubits - 1 - i);
+    return c;
+}
+
+// a gate with c controls nominally reads and writes 2^(n-c) amplitudes
+Result makeResult(const std::string &benchmark, const std::string &name, const std::string &position, unsigned int numQubits,
+                  unsigned long long int numGates, double nsPerGate, unsigned long long int amplitudesPerGate)
+{
+    double bytes = 2.0 * amplitudesPerGate * sizeof(qubitLayer);
+    return {benchmark, name, position, numQubits, numGates, nsPerGate, bytes / nsPerGate, amplitudesPerGate / nsPerGate * 1e9};
+}
+
+void printResult(const Result &result)
+{
+    std::cout << std::left << std::setw(8) << result.name << std::setw(6) << result.position << std::right << std::setw(3)
+              << result.numQubits << " qubits " << std::fixed << std::setprecision(1) << std::setw(14) << result.nsPerGate
+              << " ns/gate " << std::setw(8) << result.gbPerSecond << " GB/s " << std::scientific << std::setprecision(3)
+              << result.amplitudesPerSecond << " amplitudes/s" << std::defaultfloat << std::endl;
+}
+
+std::string simdName(SimdLevel level)
+{
+    return level == SimdLevel::avx512 ? "avx512" : level == SimdLevel::avx2 ? "avx2" : "scalar";
+}
+
+void writeJson(const std::string &path, const std::vector<Result> &results, int numThreads)
+{
+    std::ofstream json(path);
+    json << "{\n  \"threads\": " << numThreads << ",\n  \"simd\": \"" << simdName(kernels::getSimdLevel())
+         << "\",\n  \"precision_bytes\": " << sizeof(precision) << ",\n  \"results\": [\n";
+    for (unsigned long long int i = 0; i < results.size(); i++)
+    {
+        const Result &result = results[i];
+        json << "    {\"benchmark\": \"" << result.benchmark << "\", \"name\": \"" << result.name << "\", \"position\": \""
+             << result.position << "\", \"qubits\": " << result.numQubits << ", \"gates\": " << result.numGates
+             << ", \"median_ns_per_gate\": " << result.nsPerGate << ", \"gb_per_s\": " << result.gbPerSecond
+             << ", \"amplitudes_per_s\": " << result.amplitudesPerSecond << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    json << "  ]\n}\n";
+}
+
+Options parseOptions(int argc, char *argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+        if (i + 1 >= argc || option.rfind("--", 0) != 0)
+        {
+            std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+            std::cout << "Invalid option:             " << option << std::endl;
+            std::cout << "Options:                    --min-qubits --max-qubits --step --warmup --repeats --threads --json" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        std::string value = argv[++i];
+        if (option == "--json")
+            options.jsonFile = value;
+        else
+        {
+            unsigned int number = std::stoul(value);
+            if (option == "--min-qubits")
+                options.minQubits = number;
+            else if (option == "--max-qubits")
+                options.maxQubits = number;
+            else if (option == "--step")
+                options.step = std::max(number, 1U);
+            else if (option == "--warmup")
+                options.warmup = number;
+            else if (option == "--repeats")
+                options.repeats = std::max(number, 1U);
+            else if (option == "--threads")
+                options.numThreads = number;
+        }
+    }
+    if (options.maxQubits == 0)
+    {
+        // half the physical memory, so the machine does not swap
+        unsigned long long int memory = static_cast<unsigned long long int>(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGE_SIZE);
+        while (options.maxQubits < maxDenseQubits && (sizeof(qubitLayer) << (options.maxQubits + 1)) <= memory / 2)
+            options.maxQubits++;
+    }
+    return options;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options = parseOptions(argc, argv);
+    std::vector<Result> results;
+    int numThreads{1};
+    for (unsigned int numQubits = options.minQubits; numQubits <= options.maxQubits; numQubits += options.step)
+    {
+        QubitLayer q(numQubits);
+        if (options.numThreads > 0)
+            q.setNumThreads(options.numThreads);
+        numThreads = q.getNumThreads();
+        // a dense state, as the gates would only visit a few amplitudes of |0>
+        for (unsigned int i = 0; i < numQubits; i++)
+            q.applyHadamard(i);
+        q.getQubitLayer();
+        // small states apply several gates per timed run, so that a run takes about as long as a gate on 2^22 states,
+        // and every run applies the diagonal gates it queued
+        unsigned long long int gatesPerRun = std::max(1ULL, (1ULL << 22) >> numQubits);
+        std::cout << "\033[34;34m-------------" << numQubits << " qubits-------------\033[m" << std::endl;
+        for (const GateBenchmark &gate : gateBenchmarks)
+            for (const char *position : {"low", "mid", "high"})
+            {
+                int target = position == std::string("low") ? 0 : position == std::string("mid") ? numQubits / 2 : numQubits - 1;
+                double time = medianTime([&]()
+                                         { for (unsigned long long int g = 0; g < gatesPerRun; g++)
+                                               applyGate(q, gate.name, target);
+                                           q.flushDiagonals(); },
+                                         options.warmup, options.repeats);
+                results.push_back(makeResult("gate", gate.name, position, numQubits, gatesPerRun, time / gatesPerRun,
+                                             q.getNumStates() >> gate.numControls));
+                printResult(results.back());
+            }
+        for (const char *name : {"Grover", "QFT"})
+        {
+            Circuit c = name == std::string("Grover") ? groverIteration(numQubits) : qft(numQubits);
+            double time = medianTime([&]()
+                                     { q.reset();
+                                       c.run(q);
+                                       q.flushDiagonals(); },
+                                     options.warmup, options.repeats);
+            results.push_back(makeResult("circuit", name, "all", numQubits, c.getNumGates(), time / c.getNumGates(), q.getNumStates()));
+            printResult(results.back());
+        }
+        // the same Grover iteration with the native oracle and diffusion, which are 2 operations
+        std::vector<int> allQubits;
+        for (unsigned int i = 0; i < numQubits; i++)
+            allQubits.push_back(i);
+        double time = medianTime([&]()
+                                 { q.applyPhaseOracle(std::vector<unsigned long long int>{0});
+                                   q.applyDiffusion(allQubits);
+                                   q.flushDiagonals(); },
+                                 options.warmup, options.repeats);
+        results.push_back(makeResult("circuit", "Grover", "native", numQubits, 2, time / 2, q.getNumStates()));
+        printResult(results.back());
+        // H on every qubit of a fresh state, which starts sparse and becomes dense on the way
+        time = medianTime([&]()
+                          { QubitLayer fresh(numQubits);
+                            fresh.setNumThreads(numThreads);
+                            for (unsigned int i = 0; i < numQubits; i++)
+                                fresh.applyHadamard(i);
+                            fresh.getPhysicalQubitLayer(); },
+                          options.warmup, options.repeats);
+        results.push_back(makeResult("circuit", "Fill", "fresh", numQubits, numQubits, time / numQubits, q.getNumStates()));
+        printResult(results.back());
+    }
+    writeJson(options.jsonFile, results, numThreads);
+    std::cout << "Results written to " << options.jsonFile << std::endl;
+}
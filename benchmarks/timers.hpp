@@ -1,6 +1,8 @@
 #ifndef TIMERS_H
 #define TIMERS_H
+#include <algorithm>
 #include <chrono>
+#include <vector>
 
 typedef std::chrono::steady_clock Clock;
 typedef std::chrono::nanoseconds ns;
@@ -8,8 +10,23 @@ typedef std::chrono::microseconds mus;
 typedef std::chrono::duration<double> dsec;
 typedef Clock::time_point timePoint;
 
-timePoint start;
-timePoint stop;
-long long duration{0};
+/**
+ * Median of the durations of some runs of a function, in ns, after some untimed warmup runs.
+ */
+template <typename Function>
+double medianTime(Function run, unsigned int warmup, unsigned int repeats)
+{
+    for (unsigned int i = 0; i < warmup; i++)
+        run();
+    std::vector<double> times;
+    for (unsigned int i = 0; i < repeats; i++)
+    {
+        timePoint start = Clock::now();
+        run();
+        times.push_back(std::chrono::duration_cast<ns>(Clock::now() - start).count());
+    }
+    std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+    return times[times.size() / 2];
+}
 
-#endif
\ No newline at end of file
+#endif
@@ -5,7 +5,7 @@ QubitLayer grover(unsigned int numQubits, int unsigned dSolution, int unsigned n
 {
     QubitLayer q(numQubits);
     unsigned long long int numStates = q.getNumStates();
-    if (dSolution > numQubits)
+    if (dSolution >= numStates)
     {
         std::cout << "\033[31;31m[Error]\033[m" << std::endl;
         std::cout << "Number of states: " << numStates << std::endl;
@@ -14,33 +14,22 @@ QubitLayer grover(unsigned int numQubits, int unsigned dSolution, int unsigned n
     }
     if (numReps == 0)
         numReps = static_cast<int>(std::sqrt(numStates) / 4 * pi);
-    std::bitset<maxQubits> bSolution = dSolution;
-    int ctrlQubits[numQubits - 1];
-    for (int i = 0; i < (numQubits - 1); i++)
-        ctrlQubits[i] = i;
-    // initiliase qubits to a superposition of all states
+    std::vector<int> allQubits;
+    // initiliase qubits to a superposition of all states, recorded so that the Hadamards are fused into a few passes
+    Circuit c(numQubits);
     for (int i = 0; i < numQubits; i++)
-        q.applyHadamard(i);
+    {
+        c.applyHadamard(i);
+        allQubits.push_back(i);
+    }
+    c.optimize();
+    c.run(q);
     for (int rep = 0; rep < numReps; rep++)
     {
         // oracle to tag solution
-        for (int i = 0; i < numQubits; i++)
-            if (!bSolution.test(i))
-                q.applyPauliX(i);
-        q.applyMcphase(ctrlQubits, numQubits - 1, numQubits - 1);
-        for (int i = 0; i < numQubits; i++)
-            if (!bSolution.test(i))
-                q.applyPauliX(i);
+        q.applyPhaseOracle({dSolution});
         // grover diffusion operator (inversion about mean and amplitude amplification)
-        for (int i = 0; i < numQubits; i++)
-            q.applyHadamard(i);
-        for (int i = 0; i < numQubits; i++)
-            q.applyPauliX(i);
-        q.applyMcphase(ctrlQubits, numQubits - 1, numQubits - 1);
-        for (int i = 0; i < numQubits; i++)
-            q.applyPauliX(i);
-        for (int i = 0; i < numQubits; i++)
-            q.applyHadamard(i);
+        q.applyDiffusion(allQubits);
     }
     return q;
 }
@@ -1,6 +1,7 @@
 #ifndef QALGORITHMS_H
 #define QALGORITHMS_H
 #include "../src/QubitLayer.hpp"
+#include "../src/Circuit.hpp"
 
 enum pauliError { errorX, errorY, errorZ };
 
@@ -0,0 +1,832 @@
+#include <iostream>
+#include <algorithm>
+#include <numeric>
+#include "Circuit.hpp"
+#include "kernels.hpp"
+#include "gates.hpp"
+#include "profiler.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace
+{
+    // product a*b of two dim x dim row-major matrices
+    std::vector<qubitLayer> multiply(const std::vector<qubitLayer> &a, const std::vector<qubitLayer> &b, unsigned long long int dim)
+    {
+        std::vector<qubitLayer> product(dim * dim, zeroComplex);
+        for (unsigned long long int r = 0; r < dim; r++)
+            for (unsigned long long int k = 0; k < dim; k++)
+                for (unsigned long long int c = 0; c < dim; c++)
+                    product[r * dim + c] += a[r * dim + k] * b[k * dim + c];
+        return product;
+    }
+
+    bool isIdentity(const std::vector<qubitLayer> &m, unsigned long long int dim)
+    {
+        for (unsigned long long int r = 0; r < dim; r++)
+            for (unsigned long long int c = 0; c < dim; c++)
+                if (std::abs(m[r * dim + c] - qubitLayer(r == c ? 1 : 0, 0)) > 1e-12)
+                    return false;
+        return true;
+    }
+
+    // all the qubits a gate acts on, targets first
+    std::vector<int> qubitsOf(const Gate &gate)
+    {
+        std::vector<int> qubits = gate.targets;
+        qubits.insert(qubits.end(), gate.controls.begin(), gate.controls.end());
+        return qubits;
+    }
+
+    bool sameControls(const Gate &a, const Gate &b)
+    {
+        std::vector<int> controlsA = a.controls;
+        std::vector<int> controlsB = b.controls;
+        std::sort(controlsA.begin(), controlsA.end());
+        std::sort(controlsB.begin(), controlsB.end());
+        return controlsA == controlsB;
+    }
+
+    bool isSingleQubit(const Gate &gate)
+    {
+        return gate.targets.size() == 1 && gate.controls.empty();
+    }
+
+    // the matrix of a rotation with a parameter is only known when the circuit is run
+    bool isFixed(const Gate &gate)
+    {
+        return gate.parameter < 0;
+    }
+
+    // SWAP gates are kept out of fused blocks, as running them only relabels qubits
+    bool isFusable(const Gate &gate)
+    {
+        return isFixed(gate) && gate.type != GateType::swap;
+    }
+
+    // gate with the rotation angle of its parameter, if it has one
+    Gate bind(Gate gate, const std::vector<precision> &parameters)
+    {
+        if (isFixed(gate))
+            return gate;
+        gate.theta = parameters[gate.parameter];
+        gate.matrix = gate.type == GateType::rx ? gates::rx(gate.theta) : gate.type == GateType::ry ? gates::ry(gate.theta)
+                                                                                                     : gates::rz(gate.theta);
+        gate.parameter = -1;
+        return gate;
+    }
+
+    // conjugate transpose of a dim x dim row-major matrix, i.e. the inverse of a gate
+    std::vector<qubitLayer> adjoint(const std::vector<qubitLayer> &m, unsigned long long int dim)
+    {
+        std::vector<qubitLayer> result(dim * dim);
+        for (unsigned long long int r = 0; r < dim; r++)
+            for (unsigned long long int c = 0; c < dim; c++)
+                result[c * dim + r] = std::conj(m[r * dim + c]);
+        return result;
+    }
+
+    // phase i^numY of a Pauli string, which maps |i> to i^numY (-1)^popcount(i & zMask) |i ^ xMask>
+    std::complex<double> yPhase(unsigned long long int xMask, unsigned long long int zMask)
+    {
+        const std::complex<double> powers[4] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+        return powers[__builtin_popcountll(xMask & zMask) % 4];
+    }
+
+    // <a|P|b> for the Pauli string P with these masks
+    std::complex<double> pauliProduct(const qubitLayer *a, const qubitLayer *b, unsigned long long int numStates,
+                                      unsigned long long int xMask, unsigned long long int zMask, int numThreads)
+    {
+        double sumRe{0}, sumIm{0};
+#pragma omp parallel for num_threads(numThreads) schedule(static) reduction(+ : sumRe, sumIm) if (numStates >= minParallelStates)
+        for (unsigned long long int i = 0; i < numStates; i++)
+        {
+            std::complex<double> product = std::conj(a[i ^ xMask]) * b[i];
+            double sign = 1 - 2 * (__builtin_popcountll(i & zMask) & 1);
+            sumRe += sign * product.real();
+            sumIm += sign * product.imag();
+        }
+        return yPhase(xMask, zMask) * std::complex<double>(sumRe, sumIm);
+    }
+
+    // out += coefficient P in for the Pauli string P of a term, every state i writing to i ^ xMask
+    void addPauli(qubitLayer *out, const qubitLayer *in, unsigned long long int numStates, const PauliString &term, int numThreads)
+    {
+        std::complex<double> phase = term.coefficient * yPhase(term.xMask, term.zMask);
+#pragma omp parallel for num_threads(numThreads) schedule(static) if (numStates >= minParallelStates)
+        for (unsigned long long int i = 0; i < numStates; i++)
+        {
+            double sign = 1 - 2 * (__builtin_popcountll(i & term.zMask) & 1);
+            out[i ^ term.xMask] += sign * phase * in[i];
+        }
+    }
+
+    // multiplies the gates of a block into one dense matrix on the (sorted) qubits of the block
+    Gate fuseBlock(const std::vector<int> &qubits, const std::vector<Gate> &blockGates)
+    {
+        unsigned long long int dim = 1ULL << qubits.size();
+        // build the matrix column by column, every column being a small state the gates are applied to
+        std::vector<qubitLayer> columns(dim * dim, zeroComplex);
+        for (unsigned long long int c = 0; c < dim; c++)
+            columns[c * dim + c] = {1, 0};
+        for (const Gate &gate : blockGates)
+        {
+            std::vector<int> targets;
+            for (int target : gate.targets)
+                targets.push_back(std::find(qubits.begin(), qubits.end(), target) - qubits.begin());
+            unsigned long long int ctrlMask{0};
+            for (int control : gate.controls)
+                ctrlMask |= 1ULL << (std::find(qubits.begin(), qubits.end(), control) - qubits.begin());
+            for (unsigned long long int c = 0; c < dim; c++)
+                kernels::applyUnitary(&columns[c * dim], dim, targets.data(), targets.size(), gate.matrix.data(), ctrlMask, 1);
+        }
+        Gate fused{GateType::unitary, qubits, {}, std::vector<qubitLayer>(dim * dim), 0};
+        for (unsigned long long int r = 0; r < dim; r++)
+            for (unsigned long long int c = 0; c < dim; c++)
+                fused.matrix[r * dim + c] = columns[c * dim + r];
+        return fused;
+    }
+}
+
+Circuit::Circuit(unsigned int numQubits) : numQubits(numQubits) {}
+
+void Circuit::record(GateType type, const std::vector<int> &targets, const std::vector<qubitLayer> &matrix,
+                     const std::vector<int> &controls, precision theta, int parameter)
+{
+    unsigned long long int dim = 1ULL << targets.size();
+    bool validQubits = !targets.empty();
+    for (int qubit : qubitsOf({type, targets, controls, {}, theta}))
+        validQubits = validQubits && qubit >= 0 && qubit < static_cast<int>(numQubits);
+    if (!validQubits || matrix.size() != dim * dim)
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of qubits:           " << numQubits << std::endl;
+        std::cout << "Number of targets:          " << targets.size() << std::endl;
+        std::cout << "Number of controls:         " << controls.size() << std::endl;
+        std::cout << "Number of matrix entries:   " << matrix.size() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    gates_.push_back({type, targets, controls, matrix, theta, parameter});
+    if (parameter >= 0)
+        numParameters_ = std::max(numParameters_, static_cast<unsigned int>(parameter) + 1);
+}
+
+void Circuit::applyPauliX(int target) { record(GateType::pauliX, {target}, gates::pauliX()); }
+
+void Circuit::applyPauliY(int target) { record(GateType::pauliY, {target}, gates::pauliY()); }
+
+void Circuit::applyPauliZ(int target) { record(GateType::pauliZ, {target}, gates::pauliZ()); }
+
+void Circuit::applyHadamard(int target) { record(GateType::hadamard, {target}, gates::hadamard()); }
+
+void Circuit::applyRx(int target, precision theta) { record(GateType::rx, {target}, gates::rx(theta), {}, theta); }
+
+void Circuit::applyRy(int target, precision theta) { record(GateType::ry, {target}, gates::ry(theta), {}, theta); }
+
+void Circuit::applyRz(int target, precision theta) { record(GateType::rz, {target}, gates::rz(theta), {}, theta); }
+
+void Circuit::applyRx(int target, Parameter theta) { record(GateType::rx, {target}, gates::rx<precision>(0), {}, 0, theta.index); }
+
+void Circuit::applyRy(int target, Parameter theta) { record(GateType::ry, {target}, gates::ry<precision>(0), {}, 0, theta.index); }
+
+void Circuit::applyRz(int target, Parameter theta) { record(GateType::rz, {target}, gates::rz<precision>(0), {}, 0, theta.index); }
+
+void Circuit::applyCnot(int control, int target) { record(GateType::pauliX, {target}, gates::pauliX(), {control}); }
+
+void Circuit::applyToffoli(int control1, int control2, int target)
+{
+    record(GateType::pauliX, {target}, gates::pauliX(), {control1, control2});
+}
+
+void Circuit::applyMcnot(int *controls, int numControls, int target)
+{
+    record(GateType::pauliX, {target}, gates::pauliX(), std::vector<int>(controls, controls + numControls));
+}
+
+void Circuit::applyCz(int control, int target) { record(GateType::pauliZ, {target}, gates::pauliZ(), {control}); }
+
+void Circuit::applyMcphase(int *controls, int numControls, int target)
+{
+    record(GateType::pauliZ, {target}, gates::pauliZ(), std::vector<int>(controls, controls + numControls));
+}
+
+void Circuit::applySwap(int qubit1, int qubit2) { record(GateType::swap, {qubit1, qubit2}, gates::swap()); }
+
+void Circuit::applyUnitary(const std::vector<int> &targets, const std::vector<qubitLayer> &matrix, const std::vector<int> &controls)
+{
+    record(GateType::unitary, targets, matrix, controls);
+}
+
+void Circuit::cancelInverses()
+{
+    std::vector<Gate> kept;
+    std::vector<bool> removed;
+    // stack of the kept gates acting on each qubit, the top one being the latest
+    std::vector<std::vector<unsigned long long int>> lastGates(numQubits);
+    for (const Gate &gate : gates_)
+    {
+        std::vector<int> qubits = qubitsOf(gate);
+        // the previous gate must be the latest one on every qubit of this gate and act on exactly the same qubits
+        bool cancels = !lastGates[qubits[0]].empty();
+        unsigned long long int previous = cancels ? lastGates[qubits[0]].back() : 0;
+        for (int qubit : qubits)
+            cancels = cancels && !lastGates[qubit].empty() && lastGates[qubit].back() == previous;
+        if (cancels)
+        {
+            const Gate &previousGate = kept[previous];
+            cancels = isFixed(gate) && isFixed(previousGate) && previousGate.targets == gate.targets && sameControls(previousGate, gate) &&
+                      isIdentity(multiply(gate.matrix, previousGate.matrix, 1ULL << gate.targets.size()), 1ULL << gate.targets.size());
+        }
+        if (cancels)
+        {
+            removed[previous] = true;
+            for (int qubit : qubits)
+                lastGates[qubit].pop_back();
+            continue;
+        }
+        kept.push_back(gate);
+        removed.push_back(false);
+        for (int qubit : qubits)
+            lastGates[qubit].push_back(kept.size() - 1);
+    }
+    gates_.clear();
+    for (unsigned long long int i = 0; i < kept.size(); i++)
+        if (!removed[i])
+            gates_.push_back(kept[i]);
+}
+
+void Circuit::mergeSingleQubitGates()
+{
+    std::vector<Gate> kept;
+    std::vector<bool> removed;
+    std::vector<std::vector<unsigned long long int>> lastGates(numQubits);
+    for (const Gate &gate : gates_)
+    {
+        std::vector<int> qubits = qubitsOf(gate);
+        int target = gate.targets[0];
+        if (isSingleQubit(gate) && isFixed(gate) && !lastGates[target].empty() && isSingleQubit(kept[lastGates[target].back()]) &&
+            isFixed(kept[lastGates[target].back()]))
+        {
+            Gate &previousGate = kept[lastGates[target].back()];
+            previousGate.matrix = multiply(gate.matrix, previousGate.matrix, 2);
+            previousGate.type = GateType::unitary;
+            // drop the merged gate if the product does nothing
+            if (isIdentity(previousGate.matrix, 2))
+            {
+                removed[lastGates[target].back()] = true;
+                lastGates[target].pop_back();
+            }
+            continue;
+        }
+        kept.push_back(gate);
+        removed.push_back(false);
+        for (int qubit : qubits)
+            lastGates[qubit].push_back(kept.size() - 1);
+    }
+    gates_.clear();
+    for (unsigned long long int i = 0; i < kept.size(); i++)
+        if (!removed[i])
+            gates_.push_back(kept[i]);
+}
+
+void Circuit::fuseGates(unsigned int maxFusedQubits)
+{
+    struct Block
+    {
+        std::vector<int> qubits;
+        std::vector<Gate> gates;
+    };
+    std::vector<Gate> fused;
+    // blocks still accepting gates, they act on disjoint qubits so they commute with each other
+    std::vector<Block> openBlocks;
+    auto closeBlock = [&](Block &block)
+    {
+        std::sort(block.qubits.begin(), block.qubits.end());
+        if (block.gates.size() == 1)
+            fused.push_back(block.gates[0]);
+        else
+            fused.push_back(fuseBlock(block.qubits, block.gates));
+    };
+    for (const Gate &gate : gates_)
+    {
+        std::vector<int> qubits = qubitsOf(gate);
+        // merge the gate with all the open blocks it shares qubits with, if they are small enough together
+        Block merged{qubits, {}};
+        std::vector<Block> remaining;
+        std::vector<Block> overlapping;
+        for (Block &block : openBlocks)
+        {
+            bool overlaps = std::any_of(block.qubits.begin(), block.qubits.end(), [&](int qubit)
+                                        { return std::find(qubits.begin(), qubits.end(), qubit) != qubits.end(); });
+            (overlaps ? overlapping : remaining).push_back(block);
+        }
+        for (const Block &block : overlapping)
+        {
+            merged.qubits.insert(merged.qubits.end(), block.qubits.begin(), block.qubits.end());
+            merged.gates.insert(merged.gates.end(), block.gates.begin(), block.gates.end());
+        }
+        std::sort(merged.qubits.begin(), merged.qubits.end());
+        merged.qubits.erase(std::unique(merged.qubits.begin(), merged.qubits.end()), merged.qubits.end());
+        openBlocks = remaining;
+        if (merged.qubits.size() <= maxFusedQubits && isFusable(gate))
+        {
+            merged.gates.push_back(gate);
+            // also fill the block up with the largest disjoint open block that still fits
+            auto fits = [&](const Block &block)
+            { return merged.qubits.size() + block.qubits.size() <= maxFusedQubits; };
+            auto best = openBlocks.end();
+            for (auto block = openBlocks.begin(); block != openBlocks.end(); block++)
+                if (fits(*block) && (best == openBlocks.end() || block->qubits.size() > best->qubits.size()))
+                    best = block;
+            if (best != openBlocks.end())
+            {
+                merged.qubits.insert(merged.qubits.end(), best->qubits.begin(), best->qubits.end());
+                merged.gates.insert(merged.gates.begin(), best->gates.begin(), best->gates.end());
+                openBlocks.erase(best);
+            }
+            openBlocks.push_back(merged);
+            continue;
+        }
+        // otherwise the overlapping blocks must be applied before this gate
+        for (Block &block : overlapping)
+            closeBlock(block);
+        if (qubits.size() <= maxFusedQubits && isFusable(gate))
+            openBlocks.push_back({qubits, {gate}});
+        else
+            fused.push_back(gate);
+    }
+    for (Block &block : openBlocks)
+        closeBlock(block);
+    gates_ = fused;
+}
+
+void Circuit::optimize(unsigned int maxFusedQubits)
+{
+    cancelInverses();
+    mergeSingleQubitGates();
+    // merging can bring more inverse pairs next to each other
+    cancelInverses();
+    fuseGates(maxFusedQubits);
+}
+
+void Circuit::checkParameters(const std::vector<precision> &parameters)
+{
+    if (parameters.size() < numParameters_)
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of parameters:       " << numParameters_ << std::endl;
+        std::cout << "Number of values:           " << parameters.size() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+template <typename T>
+void Circuit::run(BasicQubitLayer<T> &q, unsigned int chunkQubits)
+{
+    run(q, std::vector<precision>(), chunkQubits);
+}
+
+template void Circuit::run(BasicQubitLayer<float> &q, unsigned int chunkQubits);
+template void Circuit::run(BasicQubitLayer<double> &q, unsigned int chunkQubits);
+
+template <typename T>
+void Circuit::run(BasicQubitLayer<T> &q, const std::vector<precision> &parameters, unsigned int chunkQubits)
+{
+    QSIM_PROFILE_SCOPE("circuit run");
+    if (numQubits > q.getNumQubits())
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of qubits of circuit: " << numQubits << std::endl;
+        std::cout << "Number of qubits of state:   " << q.getNumQubits() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    checkParameters(parameters);
+    if (chunkQubits == 0)
+        chunkQubits = q.isMapped() ? mappedChunkQubits : cacheChunkQubits;
+    chunkQubits = std::min(chunkQubits, q.getNumQubits());
+    unsigned long long int chunkSize = 1ULL << chunkQubits;
+    // SWAP gates only relabel the qubits: the qubits of the gates after them are renamed instead, and the state is
+    // told where the qubits ended up at the end of the run
+    std::vector<int> wires(q.getNumQubits());
+    std::iota(wires.begin(), wires.end(), 0);
+    bool hasSwaps = std::any_of(gates_.begin(), gates_.end(), [](const Gate &gate)
+                                { return gate.type == GateType::swap && gate.controls.empty(); });
+    std::vector<Gate> renamed;
+    if (hasSwaps)
+        for (const Gate &gate : gates_)
+        {
+            if (gate.type == GateType::swap && gate.controls.empty())
+            {
+                std::swap(wires[gate.targets[0]], wires[gate.targets[1]]);
+                continue;
+            }
+            renamed.push_back(gate);
+            for (int &qubit : renamed.back().targets)
+                qubit = wires[qubit];
+            for (int &qubit : renamed.back().controls)
+                qubit = wires[qubit];
+        }
+    const std::vector<Gate> &gates = hasSwaps ? renamed : gates_;
+    auto relabel = [&]()
+    {
+        if (!hasSwaps)
+            return;
+        std::vector<int> permutation(wires.size());
+        for (unsigned long long int qubit = 0; qubit < wires.size(); qubit++)
+            permutation[wires[qubit]] = qubit;
+        q.permuteQubits(permutation);
+    };
+    if (chunkQubits == q.getNumQubits() && !q.isSparse())
+    {
+        // the state is a single chunk, so there are no stages to plan and the gates go straight to the kernels, on the
+        // bits their qubits are stored at, runs of diagonal gates being applied together in one pass
+        const std::vector<int> &layout = q.getLayout();
+        std::complex<T> *amplitudes = q.getPhysicalQubitLayer();
+        std::vector<std::complex<T>> matrix;
+        std::vector<int> targets;
+        std::vector<kernels::DiagonalGate<T>> diagonals;
+        auto flushDiagonals = [&]()
+        {
+            if (!diagonals.empty())
+                kernels::applyDiagonals(amplitudes, q.getNumStates(), diagonals, q.getNumThreads());
+            diagonals.clear();
+        };
+        for (const Gate &gate : gates)
+        {
+            if (isFixed(gate))
+                matrix.assign(gate.matrix.begin(), gate.matrix.end());
+            else
+            {
+                std::vector<qubitLayer> bound = bind(gate, parameters).matrix;
+                matrix.assign(bound.begin(), bound.end());
+            }
+            targets.clear();
+            for (int target : gate.targets)
+                targets.push_back(layout[target]);
+            unsigned long long int ctrlMask{0};
+            for (int control : gate.controls)
+                ctrlMask |= 1ULL << layout[control];
+            unsigned long long int dim = 1ULL << targets.size();
+            if (kernels::classifyMatrix(matrix.data(), dim) == MatrixType::diagonal)
+            {
+                std::vector<std::complex<T>> diagonal(dim);
+                for (unsigned long long int r = 0; r < dim; r++)
+                    diagonal[r] = matrix[r * dim + r];
+                diagonals.push_back({targets, ctrlMask, diagonal});
+                if (diagonals.size() >= maxDiagonalGates)
+                    flushDiagonals();
+                continue;
+            }
+            flushDiagonals();
+            kernels::applyUnitary(amplitudes, q.getNumStates(), targets.data(), targets.size(), matrix.data(), ctrlMask,
+                                  q.getNumThreads());
+        }
+        flushDiagonals();
+        relabel();
+        return;
+    }
+    // the gates are applied to physical qubits (the bits of the state index the qubits are stored at), as the
+    // qubits of a stage may be moved below chunkQubits
+    std::vector<int> physical = q.getLayout(), logical(q.getNumQubits());
+    for (unsigned int qubit = 0; qubit < q.getNumQubits(); qubit++)
+        logical[physical[qubit]] = qubit;
+    // the state takes the qubits of a gate, and the matrices are recorded in double precision
+    auto apply = [&](Gate gate)
+    {
+        for (int &qubit : gate.targets)
+            qubit = logical[qubit];
+        for (int &qubit : gate.controls)
+            qubit = logical[qubit];
+        q.applyUnitary(gate.targets, std::vector<std::complex<T>>(gate.matrix.begin(), gate.matrix.end()), gate.controls);
+    };
+    auto swapQubits = [&](int a, int b)
+    {
+        q.relocateQubit(logical[a], b);
+        std::swap(logical[a], logical[b]);
+        physical[logical[a]] = a;
+        physical[logical[b]] = b;
+    };
+    auto toPhysical = [&](Gate gate)
+    {
+        for (int &qubit : gate.targets)
+            qubit = physical[qubit];
+        for (int &qubit : gate.controls)
+            qubit = physical[qubit];
+        return gate;
+    };
+    auto isLow = [&](const Gate &gate)
+    {
+        std::vector<int> qubits = qubitsOf(gate);
+        return *std::max_element(qubits.begin(), qubits.end()) < static_cast<int>(chunkQubits);
+    };
+    // gates within a chunk, and the gates on higher qubits that they were moved ahead of
+    std::vector<Gate> lowGates;
+    std::vector<Gate> deferred;
+    auto flush = [&]()
+    {
+        QSIM_PROFILE_SCOPE("circuit stage");
+        // a sparse state does not stream its amplitudes, so there is nothing to gain from chunks
+        if (!q.isSparse() && !lowGates.empty())
+        {
+            std::vector<std::vector<std::complex<T>>> matrices;
+            std::vector<unsigned long long int> ctrlMasks;
+            for (const Gate &gate : lowGates)
+            {
+                matrices.emplace_back(gate.matrix.begin(), gate.matrix.end());
+                ctrlMasks.push_back(0);
+                for (int control : gate.controls)
+                    ctrlMasks.back() |= 1ULL << control;
+            }
+            std::complex<T> *amplitudes = q.getPhysicalQubitLayer();
+            unsigned long long int numChunks = q.getNumStates() / chunkSize;
+            // every thread finishes all the gates on its chunks while they are in its cache, unless there are too few
+            // chunks to keep the threads busy, in which case the kernels split each chunk between the threads
+            int numThreads = q.getNumThreads();
+            bool chunkThreads = numThreads > 1 && numChunks >= static_cast<unsigned long long int>(numThreads);
+#pragma omp parallel for num_threads(numThreads) schedule(static) if (chunkThreads)
+            for (unsigned long long int chunk = 0; chunk < numChunks; chunk++)
+            {
+                QSIM_PROFILE_SCOPE("circuit chunk");
+                for (unsigned long long int g = 0; g < lowGates.size(); g++)
+                    kernels::applyUnitary(amplitudes + chunk * chunkSize, chunkSize, lowGates[g].targets.data(),
+                                          lowGates[g].targets.size(), matrices[g].data(), ctrlMasks[g], chunkThreads ? 1 : numThreads);
+            }
+        }
+        else
+            for (const Gate &gate : lowGates)
+                apply(gate);
+        for (const Gate &gate : deferred)
+            apply(gate);
+        lowGates.clear();
+        deferred.clear();
+    };
+    unsigned long long int position{0};
+    while (position < gates.size())
+    {
+        // a stage is the longest run of gates acting on at most chunkQubits qubits
+        std::vector<int> stageQubits;
+        unsigned long long int stageEnd = position;
+        for (; stageEnd < gates.size(); stageEnd++)
+        {
+            std::vector<int> qubits = stageQubits;
+            for (int qubit : qubitsOf(gates[stageEnd]))
+                if (std::find(qubits.begin(), qubits.end(), qubit) == qubits.end())
+                    qubits.push_back(qubit);
+            if (qubits.size() > chunkQubits)
+                break;
+            stageQubits = qubits;
+        }
+        // a gate on more than chunkQubits qubits is a stage of its own, applied to the whole state
+        stageEnd = std::max(stageEnd, position + 1);
+        std::vector<Gate> stage;
+        for (unsigned long long int g = position; g < stageEnd; g++)
+            stage.push_back(toPhysical(bind(gates[g], parameters)));
+        // bringing a high qubit down costs a pass over the state (and maybe another one if the amplitudes are read out
+        // in order), while every gate on a high qubit is a pass of its own
+        std::vector<int> highQubits;
+        for (int qubit : stageQubits)
+            if (physical[qubit] >= static_cast<int>(chunkQubits))
+                highQubits.push_back(qubit);
+        unsigned long long int highGates = std::count_if(stage.begin(), stage.end(), [&](const Gate &gate) { return !isLow(gate); });
+        if (!q.isSparse() && !highQubits.empty() && highQubits.size() < highGates)
+        {
+            flush();
+            for (int qubit : highQubits)
+            {
+                int low{0};
+                while (std::find(stageQubits.begin(), stageQubits.end(), logical[low]) != stageQubits.end())
+                    low++;
+                swapQubits(physical[qubit], low);
+            }
+            for (unsigned long long int g = position; g < stageEnd; g++)
+                stage[g - position] = toPhysical(bind(gates[g], parameters));
+        }
+        position = stageEnd;
+        for (const Gate &gate : stage)
+        {
+            if (!isLow(gate))
+            {
+                deferred.push_back(gate);
+                continue;
+            }
+            // a gate can only be moved ahead of the deferred gates if it shares no qubit with them
+            std::vector<int> qubits = qubitsOf(gate);
+            bool commutes = true;
+            for (const Gate &other : deferred)
+                for (int qubit : qubitsOf(other))
+                    commutes = commutes && std::find(qubits.begin(), qubits.end(), qubit) == qubits.end();
+            if (!commutes)
+                flush();
+            lowGates.push_back(gate);
+        }
+    }
+    flush();
+    // the diagonal gates the state collected are applied within the run, as on the single chunk path
+    q.flushDiagonals();
+    relabel();
+}
+
+template void Circuit::run(BasicQubitLayer<float> &q, const std::vector<precision> &parameters, unsigned int chunkQubits);
+template void Circuit::run(BasicQubitLayer<double> &q, const std::vector<precision> &parameters, unsigned int chunkQubits);
+
+template <typename T>
+void Circuit::run(BasicDistributedQubitLayer<T> &q, const std::vector<precision> &parameters)
+{
+    QSIM_PROFILE_SCOPE("circuit run distributed");
+    if (numQubits > q.getNumQubits())
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of qubits of circuit: " << numQubits << std::endl;
+        std::cout << "Number of qubits of state:   " << q.getNumQubits() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    checkParameters(parameters);
+    for (const Gate &fixed : gates_)
+    {
+        Gate gate = bind(fixed, parameters);
+        q.applyUnitary(gate.targets, std::vector<std::complex<T>>(gate.matrix.begin(), gate.matrix.end()), gate.controls);
+    }
+}
+
+template void Circuit::run(BasicDistributedQubitLayer<float> &q, const std::vector<precision> &parameters);
+template void Circuit::run(BasicDistributedQubitLayer<double> &q, const std::vector<precision> &parameters);
+
+bool Circuit::isClifford()
+{
+    return std::all_of(gates_.begin(), gates_.end(), [](const Gate &gate)
+                       { return (gate.controls.empty() && (gate.type == GateType::pauliX || gate.type == GateType::pauliY ||
+                                                           gate.type == GateType::pauliZ || gate.type == GateType::hadamard)) ||
+                                (gate.controls.size() == 1 && (gate.type == GateType::pauliX || gate.type == GateType::pauliZ)) ||
+                                (gate.controls.empty() && gate.type == GateType::swap); });
+}
+
+void Circuit::run(StabilizerLayer &q)
+{
+    QSIM_PROFILE_SCOPE("circuit run stabilizer");
+    if (numQubits > q.getNumQubits() || !isClifford())
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of qubits of circuit: " << numQubits << std::endl;
+        std::cout << "Number of qubits of state:   " << q.getNumQubits() << std::endl;
+        std::cout << "Clifford circuit:            " << (isClifford() ? "yes" : "no") << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    for (const Gate &gate : gates_)
+    {
+        int target = gate.targets[0];
+        switch (gate.type)
+        {
+        case GateType::pauliX:
+            if (gate.controls.empty())
+                q.applyPauliX(target);
+            else
+                q.applyCnot(gate.controls[0], target);
+            break;
+        case GateType::pauliY:
+            q.applyPauliY(target);
+            break;
+        case GateType::pauliZ:
+            if (gate.controls.empty())
+                q.applyPauliZ(target);
+            else
+                q.applyCz(gate.controls[0], target);
+            break;
+        case GateType::swap:
+            q.applySwap(target, gate.targets[1]);
+            break;
+        default:
+            q.applyHadamard(target);
+        }
+    }
+}
+
+std::map<unsigned long long int, unsigned long long int> Circuit::sample(const std::vector<int> &qubits, unsigned long long int shots,
+                                                                         std::mt19937_64 &rng, const std::vector<precision> &parameters)
+{
+    bool validQubits = !qubits.empty() && qubits.size() <= 64;
+    for (int qubit : qubits)
+        validQubits = validQubits && qubit >= 0 && qubit < static_cast<int>(numQubits);
+    if (!validQubits)
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of qubits:           " << numQubits << std::endl;
+        std::cout << "Number of measured qubits:  " << qubits.size() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (isClifford())
+    {
+        StabilizerLayer q(numQubits);
+        run(q);
+        return q.sample(qubits, shots, rng);
+    }
+    QubitLayer q(numQubits);
+    run(q, parameters);
+    std::map<unsigned long long int, unsigned long long int> counts;
+    for (const auto &drawn : q.sample(shots, rng))
+    {
+        unsigned long long int outcome{0};
+        for (unsigned long long int j = 0; j < qubits.size(); j++)
+            outcome |= ((drawn.first >> qubits[j]) & 1) << j;
+        counts[outcome] += drawn.second;
+    }
+    return counts;
+}
+
+template <typename T>
+void Circuit::runBatch(const std::vector<std::vector<precision>> &parameters,
+                       const std::function<void(unsigned long long int, BasicQubitLayer<T> &)> &result, int numThreads)
+{
+    for (const std::vector<precision> &values : parameters)
+        checkParameters(values);
+#ifdef _OPENMP
+    if (numThreads <= 0)
+        numThreads = omp_get_max_threads();
+#endif
+    numThreads = std::max(1, static_cast<int>(std::min<unsigned long long int>(numThreads, parameters.size())));
+    // the instances are small, so each of them runs on a single thread with a state of its own
+#pragma omp parallel num_threads(numThreads)
+    {
+        BasicQubitLayer<T> q(numQubits);
+        q.setNumThreads(1);
+#pragma omp for schedule(dynamic)
+        for (unsigned long long int instance = 0; instance < parameters.size(); instance++)
+        {
+            q.reset();
+            run(q, parameters[instance]);
+            result(instance, q);
+        }
+    }
+}
+
+template void Circuit::runBatch(const std::vector<std::vector<precision>> &parameters,
+                                const std::function<void(unsigned long long int, BasicQubitLayer<float> &)> &result, int numThreads);
+template void Circuit::runBatch(const std::vector<std::vector<precision>> &parameters,
+                                const std::function<void(unsigned long long int, BasicQubitLayer<double> &)> &result, int numThreads);
+
+std::vector<std::vector<precision>> Circuit::expectationBatch(const std::vector<std::vector<precision>> &parameters,
+                                                              const std::vector<PauliString> &terms, int numThreads)
+{
+    std::vector<std::vector<precision>> values(parameters.size());
+    runBatch<precision>(parameters, [&](unsigned long long int instance, QubitLayer &q)
+                        { values[instance] = q.expectation(terms); }, numThreads);
+    return values;
+}
+
+std::vector<precision> Circuit::gradient(const std::vector<precision> &parameters, const std::vector<PauliString> &terms, precision *value)
+{
+    QSIM_PROFILE_SCOPE("gradient");
+    checkParameters(parameters);
+    for (const PauliString &term : terms)
+        if ((term.xMask | term.zMask) >> numQubits)
+        {
+            std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+            std::cout << "Number of qubits:           " << numQubits << std::endl;
+            std::cout << "Pauli string X mask:        " << term.xMask << std::endl;
+            std::cout << "Pauli string Z mask:        " << term.zMask << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    // forward pass, then lambda = H psi for the observable H
+    QubitLayer state(numQubits);
+    run(state, parameters);
+    qubitLayer *psi = state.getQubitLayer();
+    unsigned long long int numStates = state.getNumStates();
+    int numThreads = state.getNumThreads();
+    std::vector<qubitLayer> lambda(numStates, zeroComplex);
+    for (const PauliString &term : terms)
+        addPauli(lambda.data(), psi, numStates, term, numThreads);
+    if (value != nullptr)
+        *value = pauliProduct(psi, lambda.data(), numStates, 0, 0, numThreads).real();
+    // backward pass: with psi the state after gate g and lambda the observable pulled back to the same point, the
+    // derivative of R(theta) = exp(-i theta P / 2) adds 2 Re <lambda| -i/2 P |psi> = Im <lambda|P|psi>, then both
+    // states are taken back through the inverse of the gate
+    std::vector<precision> gradients(numParameters_, 0);
+    for (unsigned long long int g = gates_.size(); g-- > 0;)
+    {
+        const Gate &gate = gates_[g];
+        if (!isFixed(gate))
+        {
+            unsigned long long int bit = 1ULL << gate.targets[0];
+            unsigned long long int xMask = gate.type == GateType::rz ? 0 : bit;
+            unsigned long long int zMask = gate.type == GateType::rx ? 0 : bit;
+            gradients[gate.parameter] += pauliProduct(lambda.data(), psi, numStates, xMask, zMask, numThreads).imag();
+        }
+        if (g == 0)
+            break;
+        std::vector<qubitLayer> inverse = adjoint(bind(gate, parameters).matrix, 1ULL << gate.targets.size());
+        unsigned long long int ctrlMask{0};
+        for (int control : gate.controls)
+            ctrlMask |= 1ULL << control;
+        kernels::applyUnitary(psi, numStates, gate.targets.data(), gate.targets.size(), inverse.data(), ctrlMask, numThreads);
+        kernels::applyUnitary(lambda.data(), numStates, gate.targets.data(), gate.targets.size(), inverse.data(), ctrlMask, numThreads);
+    }
+    return gradients;
+}
+
+const std::vector<Gate> &Circuit::getGates() { return gates_; }
+
+unsigned long long int Circuit::getNumGates() { return gates_.size(); }
+
+unsigned int Circuit::getNumQubits() { return numQubits; }
+
+unsigned int Circuit::getNumParameters() { return numParameters_; }
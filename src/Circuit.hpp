@@ -0,0 +1,209 @@
+#ifndef CIRCUIT_H
+#define CIRCUIT_H
+#include <functional>
+#include <map>
+#include <random>
+#include <vector>
+#include "definitions.hpp"
+#include "QubitLayer.hpp"
+#include "DistributedQubitLayer.hpp"
+#include "StabilizerLayer.hpp"
+#include "StaticQubitLayer.hpp"
+#include "gates.hpp"
+
+// gate a recorded matrix came from, fused gates become unitary
+enum class GateType
+{
+    pauliX,
+    pauliY,
+    pauliZ,
+    hadamard,
+    rx,
+    ry,
+    rz,
+    swap,
+    unitary
+};
+
+struct Gate
+{
+    GateType type;
+    std::vector<int> targets;
+    std::vector<int> controls;
+    std::vector<qubitLayer> matrix;
+    precision theta;    // rotation angle of rx, ry and rz
+    int parameter = -1; // index of the parameter theta is taken from when the circuit is run, -1 if theta is fixed
+};
+
+// placeholder for the angle of a rotation, given a value when the circuit is run
+struct Parameter
+{
+    unsigned int index;
+};
+
+class Circuit
+{
+public:
+    Circuit(unsigned int numQubits);
+    void applyPauliX(int target);
+    void applyPauliY(int target);
+    void applyPauliZ(int target);
+    void applyHadamard(int target);
+    void applyRx(int target, precision theta);
+    void applyRy(int target, precision theta);
+    void applyRz(int target, precision theta);
+    void applyRx(int target, Parameter theta);
+    void applyRy(int target, Parameter theta);
+    void applyRz(int target, Parameter theta);
+    void applyCnot(int control, int target);
+    void applyToffoli(int control1, int control2, int target);
+    void applyMcnot(int *controls, int numControls, int target);
+    void applyCz(int control, int target);
+    void applyMcphase(int *controls, int numControls, int target);
+    /**
+     * Swaps two qubits. Running the circuit on a QubitLayer relabels the qubits instead of moving amplitudes.
+     */
+    void applySwap(int qubit1, int qubit2);
+    void applyUnitary(const std::vector<int> &targets, const std::vector<qubitLayer> &matrix, const std::vector<int> &controls = {});
+    /**
+     * Removes adjacent pairs of gates that undo each other (e.g. X.X, H.H or CNOT.CNOT on the same qubits).
+     */
+    void cancelInverses();
+    /**
+     * Multiplies consecutive uncontrolled single qubit gates on the same qubit into one 2x2 matrix.
+     */
+    void mergeSingleQubitGates();
+    /**
+     * Fuses gates acting on a small set of qubits into dense blocks, so each block is a single pass over the states.
+     * @param maxFusedQubits maximum number of qubits of a fused block
+     */
+    void fuseGates(unsigned int maxFusedQubits);
+    /**
+     * Runs all the optimisation passes.
+     * @param maxFusedQubits maximum number of qubits of a fused block
+     */
+    void optimize(unsigned int maxFusedQubits = 4);
+    /**
+     * Applies the recorded gates to a QubitLayer of either precision, chunk by chunk. The gates are split into stages
+     * acting on at most chunkQubits qubits. Gates acting only on qubits below chunkQubits are moved ahead of the
+     * commuting gates on higher qubits and all applied to a chunk of 2^chunkQubits states before moving on to the
+     * next one, so the state is read once per run of such gates instead of once per gate. When a stage has more
+     * gates on higher qubits than there are such qubits, they are first moved to low bits of the state
+     * index that the stage does not use. The qubits are left where they are at the end of the run, the state keeping
+     * track of them (see BasicQubitLayer::getLayout), and SWAP gates only relabel them, so neither costs a pass.
+     * @param chunkQubits number of qubits of a chunk, 0 for cacheChunkQubits or mappedChunkQubits if the state is
+     *                    memory-mapped
+     */
+    template <typename T>
+    void run(BasicQubitLayer<T> &q, unsigned int chunkQubits = 0);
+    /**
+     * Same as run for a circuit with parameters.
+     * @param parameters value of every parameter, by index
+     */
+    template <typename T>
+    void run(BasicQubitLayer<T> &q, const std::vector<precision> &parameters, unsigned int chunkQubits = 0);
+    /**
+     * Applies the recorded gates in order to a state distributed over worker processes.
+     */
+    template <typename T>
+    void run(BasicDistributedQubitLayer<T> &q, const std::vector<precision> &parameters = {});
+    /**
+     * Applies the recorded gates in order to a stabilizer state, the circuit must be Clifford (see isClifford).
+     */
+    void run(StabilizerLayer &q);
+    /**
+     * Applies the recorded gates in order to a StaticQubitLayer, whose single qubit kernels are specialised on their
+     * target. There are no stages, as the whole state fits in the cache, and SWAP gates move the amplitudes.
+     */
+    template <unsigned int N, typename T>
+    void run(BasicStaticQubitLayer<N, T> &q, const std::vector<precision> &parameters = {});
+    /**
+     * Returns true if every gate is a Pauli, a Hadamard, a CNOT, a CZ or a SWAP, i.e. the circuit can run on a StabilizerLayer.
+     * Only the recorded gate types are looked at, so it should be called before optimize, which turns gates into matrices.
+     */
+    bool isClifford();
+    /**
+     * Runs the circuit from |0> and draws shots of a measurement of some qubits. A Clifford circuit runs on a
+     * StabilizerLayer in polynomial time and memory, whatever its number of qubits, any other one on a QubitLayer.
+     * @param qubits     qubits to measure, at most 64
+     * @param shots      number of shots
+     * @param rng        random number generator the shots are drawn with
+     * @param parameters value of every parameter, by index
+     * @return number of times each outcome was drawn, bit j of an outcome being the value of qubits[j]
+     */
+    std::map<unsigned long long int, unsigned long long int> sample(const std::vector<int> &qubits, unsigned long long int shots,
+                                                                    std::mt19937_64 &rng, const std::vector<precision> &parameters = {});
+    /**
+     * Runs the circuit once for each set of parameter values, every instance starting from |0>. The instances are
+     * spread over the threads, each thread resetting one state between its instances instead of allocating a new
+     * one, and result is called (concurrently, by the thread that ran it) with each instance and its final state.
+     * @param parameters value of every parameter for each instance
+     * @param result     reads the results of an instance, e.g. expectation values or samples
+     * @param numThreads number of threads, 0 for all of them
+     */
+    template <typename T>
+    void runBatch(const std::vector<std::vector<precision>> &parameters,
+                  const std::function<void(unsigned long long int, BasicQubitLayer<T> &)> &result, int numThreads = 0);
+    /**
+     * Runs the circuit once for each set of parameter values in double precision, see runBatch.
+     * @return expectation values of the terms for each instance
+     */
+    std::vector<std::vector<precision>> expectationBatch(const std::vector<std::vector<precision>> &parameters,
+                                                         const std::vector<PauliString> &terms, int numThreads = 0);
+    /**
+     * Derivatives of the expectation value of an observable with respect to every parameter, by the adjoint method:
+     * the circuit is run forward once, then the state and the observable applied to it are taken back through the
+     * inverse gates, each rotation with a parameter adding its term on the way. This costs about 3 runs of the
+     * circuit whatever the number of parameters, and needs 2 states in double precision.
+     * @param parameters value of every parameter, by index
+     * @param terms      Pauli strings the observable is the sum of
+     * @param value      if not null, set to the expectation value of the observable
+     * @return derivative with respect to every parameter, by index
+     */
+    std::vector<precision> gradient(const std::vector<precision> &parameters, const std::vector<PauliString> &terms,
+                                    precision *value = nullptr);
+    const std::vector<Gate> &getGates();
+    unsigned long long int getNumGates();
+    unsigned int getNumQubits();
+    unsigned int getNumParameters();
+
+private:
+    void record(GateType type, const std::vector<int> &targets, const std::vector<qubitLayer> &matrix,
+                const std::vector<int> &controls = {}, precision theta = 0, int parameter = -1);
+    void checkParameters(const std::vector<precision> &parameters);
+    unsigned int numQubits;
+    unsigned int numParameters_ = 0;
+    std::vector<Gate> gates_;
+};
+
+template <unsigned int N, typename T>
+void Circuit::run(BasicStaticQubitLayer<N, T> &q, const std::vector<precision> &parameters)
+{
+    if (numQubits > N)
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of qubits of circuit: " << numQubits << std::endl;
+        std::cout << "Number of qubits of state:   " << N << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    checkParameters(parameters);
+    // reused by every gate, so a run only allocates for the rotations with a parameter
+    std::vector<std::complex<T>> matrix;
+    for (const Gate &gate : gates_)
+    {
+        if (gate.parameter < 0)
+            matrix.assign(gate.matrix.begin(), gate.matrix.end());
+        else
+        {
+            T theta = parameters[gate.parameter];
+            matrix = gate.type == GateType::rx ? gates::rx<T>(theta) : gate.type == GateType::ry ? gates::ry<T>(theta)
+                                                                                                  : gates::rz<T>(theta);
+        }
+        unsigned long long int ctrlMask{0};
+        for (int control : gate.controls)
+            ctrlMask |= 1ULL << control;
+        q.applyUnitary(gate.targets.data(), gate.targets.size(), matrix.data(), ctrlMask);
+    }
+}
+
+#endif
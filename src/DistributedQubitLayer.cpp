@@ -0,0 +1,454 @@
+#include <complex>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "DistributedQubitLayer.hpp"
+#include "kernels.hpp"
+#include "gates.hpp"
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+    enum class Command : std::int32_t
+    {
+        apply,   // followed by the physical targets, the physical controls and the matrix
+        swap,    // exchanges the amplitudes of global qubit qubit and local qubit other
+        gather,  // the worker replies with its amplitudes
+        quit
+    };
+
+    struct CommandHeader
+    {
+        Command command;
+        std::int32_t numTargets;
+        std::int32_t numControls;
+        std::int32_t qubit;
+        std::int32_t other;
+    };
+
+    // amplitudes exchanged per message during a swap
+    constexpr unsigned long long int swapChunkStates{1ULL << 16};
+
+    // a failed transfer means the other end is gone, which a worker cannot recover from
+    bool sendAll(int fd, const void *data, unsigned long long int numBytes)
+    {
+        const char *bytes = static_cast<const char *>(data);
+        while (numBytes > 0)
+        {
+            ssize_t sent = send(fd, bytes, numBytes, MSG_NOSIGNAL);
+            if (sent <= 0)
+                return false;
+            bytes += sent;
+            numBytes -= sent;
+        }
+        return true;
+    }
+
+    bool recvAll(int fd, void *data, unsigned long long int numBytes)
+    {
+        char *bytes = static_cast<char *>(data);
+        while (numBytes > 0)
+        {
+            ssize_t received = recv(fd, bytes, numBytes, 0);
+            if (received <= 0)
+                return false;
+            bytes += received;
+            numBytes -= received;
+        }
+        return true;
+    }
+
+    void workerError(unsigned int rank)
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Lost connection to worker:  " << rank << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    /**
+     * Command loop of a worker, which holds the amplitudes whose global qubits are its rank. peers[k] is the
+     * socket to the worker whose rank differs in bit k.
+     */
+    template <typename T>
+    void runWorker(unsigned int rank, unsigned int numLocalQubits, int control, const std::vector<int> &peers)
+    {
+        unsigned long long int numStates = 1ULL << numLocalQubits;
+        std::vector<std::complex<T>> amplitudes(numStates, constants<T>::zeroComplex);
+        if (rank == 0)
+            amplitudes[0] = {1, 0};
+        std::vector<std::complex<T>> sendBuffer, recvBuffer;
+        CommandHeader header;
+        while (recvAll(control, &header, sizeof(header)))
+        {
+            if (header.command == Command::quit)
+                return;
+            if (header.command == Command::gather)
+            {
+                if (!sendAll(control, amplitudes.data(), numStates * sizeof(std::complex<T>)))
+                    return;
+            }
+            else if (header.command == Command::swap)
+            {
+                // both workers keep the amplitudes whose local bit equals their global bit and trade the others,
+                // the lower rank sending first so that the two never wait on each other
+                unsigned int bit = header.qubit - numLocalQubits;
+                int peer = peers[bit];
+                bool upper = (rank >> bit) & 1;
+                unsigned long long int flip = upper ? 0 : 1ULL << header.other;
+                unsigned long long int half = numStates / 2;
+                unsigned long long int chunk = std::min(half, swapChunkStates);
+                sendBuffer.resize(chunk);
+                recvBuffer.resize(chunk);
+                for (unsigned long long int first = 0; first < half; first += chunk)
+                {
+                    for (unsigned long long int p = 0; p < chunk; p++)
+                        sendBuffer[p] = amplitudes[kernels::pairIndex(first + p, header.other) | flip];
+                    unsigned long long int numBytes = chunk * sizeof(std::complex<T>);
+                    bool ok = upper ? recvAll(peer, recvBuffer.data(), numBytes) && sendAll(peer, sendBuffer.data(), numBytes)
+                                    : sendAll(peer, sendBuffer.data(), numBytes) && recvAll(peer, recvBuffer.data(), numBytes);
+                    if (!ok)
+                        return;
+                    for (unsigned long long int p = 0; p < chunk; p++)
+                        amplitudes[kernels::pairIndex(first + p, header.other) | flip] = recvBuffer[p];
+                }
+            }
+            else
+            {
+                std::vector<int> targets(header.numTargets), controls(header.numControls);
+                unsigned long long int dim = 1ULL << header.numTargets;
+                std::vector<std::complex<T>> matrix(dim * dim);
+                if (!recvAll(control, targets.data(), targets.size() * sizeof(int)) ||
+                    !recvAll(control, controls.data(), controls.size() * sizeof(int)) ||
+                    !recvAll(control, matrix.data(), matrix.size() * sizeof(std::complex<T>)))
+                    return;
+                // a control on a global qubit is either set for all the amplitudes of the worker or for none
+                unsigned long long int ctrlMask{0};
+                bool active = true;
+                for (int qubit : controls)
+                {
+                    if (qubit < static_cast<int>(numLocalQubits))
+                        ctrlMask |= 1ULL << qubit;
+                    else
+                        active = active && ((rank >> (qubit - numLocalQubits)) & 1);
+                }
+                if (!active)
+                    continue;
+                // only diagonal matrices are sent with global targets, whose bits of the row number are fixed by the rank
+                std::vector<int> localTargets, localBits;
+                unsigned long long int globalRow{0};
+                for (int j = 0; j < header.numTargets; j++)
+                {
+                    if (targets[j] < static_cast<int>(numLocalQubits))
+                    {
+                        localTargets.push_back(targets[j]);
+                        localBits.push_back(j);
+                    }
+                    else if ((rank >> (targets[j] - numLocalQubits)) & 1)
+                        globalRow |= 1ULL << j;
+                }
+                if (localTargets.size() == targets.size())
+                {
+                    kernels::applyUnitary(amplitudes.data(), numStates, targets.data(), header.numTargets, matrix.data(),
+                                          ctrlMask, 1);
+                    continue;
+                }
+                unsigned long long int localDim = 1ULL << localTargets.size();
+                std::vector<std::complex<T>> diagonal(localDim);
+                for (unsigned long long int r = 0; r < localDim; r++)
+                {
+                    unsigned long long int row = globalRow;
+                    for (unsigned long long int j = 0; j < localBits.size(); j++)
+                        row |= ((r >> j) & 1) << localBits[j];
+                    diagonal[r] = matrix[row * dim + row];
+                }
+                if (!localTargets.empty())
+                {
+                    std::vector<std::complex<T>> reduced(localDim * localDim, constants<T>::zeroComplex);
+                    for (unsigned long long int r = 0; r < localDim; r++)
+                        reduced[r * localDim + r] = diagonal[r];
+                    kernels::applyUnitary(amplitudes.data(), numStates, localTargets.data(), localTargets.size(), reduced.data(),
+                                          ctrlMask, 1);
+                    continue;
+                }
+                // every target is global, so the gate is a phase on the controlled amplitudes of the worker
+                for (unsigned long long int i = 0; i < numStates; i++)
+                    if ((i & ctrlMask) == ctrlMask)
+                        amplitudes[i] *= diagonal[0];
+            }
+        }
+    }
+}
+
+template <typename T>
+BasicDistributedQubitLayer<T>::BasicDistributedQubitLayer(unsigned int numQubits, unsigned int numProcesses)
+    : numQubits(numQubits), numProcesses(numProcesses)
+{
+    unsigned int numGlobalQubits{0};
+    while ((1U << numGlobalQubits) < numProcesses)
+        numGlobalQubits++;
+    if (numQubits > maxDenseQubits + numGlobalQubits || numProcesses == 0 || (1U << numGlobalQubits) != numProcesses ||
+        numGlobalQubits > numQubits)
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of qubits:           " << numQubits << std::endl;
+        std::cout << "Number of processes:        " << numProcesses << " (must be a power of 2)" << std::endl;
+        std::cout << "Max local qubits:           " << maxDenseQubits << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    numLocalQubits = numQubits - numGlobalQubits;
+    for (unsigned int qubit = 0; qubit < numQubits; qubit++)
+    {
+        physical_.push_back(qubit);
+        logical_.push_back(qubit);
+    }
+    // one socket pair per pair of workers that can swap, i.e. whose ranks differ in one bit
+    std::vector<std::vector<int>> peers(numProcesses, std::vector<int>(numGlobalQubits, -1));
+    for (unsigned int rank = 0; rank < numProcesses; rank++)
+        for (unsigned int bit = 0; bit < numGlobalQubits; bit++)
+        {
+            unsigned int partner = rank ^ (1U << bit);
+            if (partner < rank)
+                continue;
+            int pair[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+                workerError(rank);
+            peers[rank][bit] = pair[0];
+            peers[partner][bit] = pair[1];
+        }
+    // buffered output would otherwise be printed again by every worker
+    std::cout.flush();
+    for (unsigned int rank = 0; rank < numProcesses; rank++)
+    {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+            workerError(rank);
+        pid_t pid = fork();
+        if (pid < 0)
+            workerError(rank);
+        if (pid == 0)
+        {
+            close(pair[0]);
+            for (int socket : sockets_)
+                close(socket);
+            for (unsigned int other = 0; other < numProcesses; other++)
+                for (int socket : peers[other])
+                    if (other != rank)
+                        close(socket);
+            runWorker<T>(rank, numLocalQubits, pair[1], peers[rank]);
+            _exit(EXIT_SUCCESS);
+        }
+        close(pair[1]);
+        workers_.push_back(pid);
+        sockets_.push_back(pair[0]);
+    }
+    for (const std::vector<int> &sockets : peers)
+        for (int socket : sockets)
+            close(socket);
+}
+
+template <typename T>
+BasicDistributedQubitLayer<T>::~BasicDistributedQubitLayer()
+{
+    CommandHeader header{Command::quit, 0, 0, 0, 0};
+    for (unsigned int rank = 0; rank < numProcesses; rank++)
+    {
+        sendAll(sockets_[rank], &header, sizeof(header));
+        close(sockets_[rank]);
+    }
+    for (pid_t worker : workers_)
+        waitpid(worker, nullptr, 0);
+}
+
+template <typename T>
+void BasicDistributedQubitLayer<T>::sendCommand(unsigned int rank, const void *command, unsigned long long int numBytes)
+{
+    if (!sendAll(sockets_[rank], command, numBytes))
+        workerError(rank);
+}
+
+template <typename T>
+void BasicDistributedQubitLayer<T>::swapQubits(int globalQubit, int localQubit)
+{
+    CommandHeader header{Command::swap, 0, 0, globalQubit, localQubit};
+    for (unsigned int rank = 0; rank < numProcesses; rank++)
+        sendCommand(rank, &header, sizeof(header));
+    std::swap(logical_[globalQubit], logical_[localQubit]);
+    physical_[logical_[globalQubit]] = globalQubit;
+    physical_[logical_[localQubit]] = localQubit;
+    numSwaps_++;
+}
+
+template <typename T>
+void BasicDistributedQubitLayer<T>::applyUnitary(const std::vector<int> &targets, const std::vector<std::complex<T>> &matrix,
+                                                 const std::vector<int> &controls)
+{
+    unsigned long long int dim = 1ULL << targets.size();
+    unsigned long long int targetMask{0};
+    unsigned long long int ctrlMask{0};
+    bool validQubits = !targets.empty() && targets.size() <= numLocalQubits;
+    for (int target : targets)
+    {
+        validQubits = validQubits && target >= 0 && target < static_cast<int>(numQubits) && !(targetMask & (1ULL << target));
+        targetMask |= 1ULL << target;
+    }
+    for (int control : controls)
+    {
+        validQubits = validQubits && control >= 0 && control < static_cast<int>(numQubits) && !((targetMask | ctrlMask) & (1ULL << control));
+        ctrlMask |= 1ULL << control;
+    }
+    if (!validQubits || matrix.size() != dim * dim)
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of qubits:           " << numQubits << std::endl;
+        std::cout << "Number of local qubits:     " << numLocalQubits << std::endl;
+        std::cout << "Number of targets:          " << targets.size() << std::endl;
+        std::cout << "Number of controls:         " << controls.size() << std::endl;
+        std::cout << "Number of matrix entries:   " << matrix.size() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    // bring the global targets of a non-diagonal gate to the highest local qubits that are not targets, preferably
+    // not controls either as a control is as cheap on a global qubit
+    if (kernels::classifyMatrix(matrix.data(), dim) != MatrixType::diagonal)
+        for (int target : targets)
+        {
+            if (physical_[target] < static_cast<int>(numLocalQubits))
+                continue;
+            int swapped{-1};
+            for (int pass = 0; pass < 2 && swapped < 0; pass++)
+                for (int local = numLocalQubits - 1; local >= 0 && swapped < 0; local--)
+                {
+                    auto isUsed = [&](int qubit) { return physical_[qubit] == local; };
+                    if (std::none_of(targets.begin(), targets.end(), isUsed) &&
+                        (pass == 1 || std::none_of(controls.begin(), controls.end(), isUsed)))
+                        swapped = local;
+                }
+            swapQubits(physical_[target], swapped);
+        }
+    std::vector<int> qubits = targets;
+    qubits.insert(qubits.end(), controls.begin(), controls.end());
+    CommandHeader header{Command::apply, static_cast<std::int32_t>(targets.size()), static_cast<std::int32_t>(controls.size()), 0, 0};
+    std::vector<char> command(sizeof(header) + qubits.size() * sizeof(int) + matrix.size() * sizeof(std::complex<T>));
+    std::memcpy(command.data(), &header, sizeof(header));
+    int *physicalQubits = reinterpret_cast<int *>(command.data() + sizeof(header));
+    for (unsigned long long int j = 0; j < qubits.size(); j++)
+        physicalQubits[j] = physical_[qubits[j]];
+    std::memcpy(physicalQubits + qubits.size(), matrix.data(), matrix.size() * sizeof(std::complex<T>));
+    for (unsigned int rank = 0; rank < numProcesses; rank++)
+        sendCommand(rank, command.data(), command.size());
+}
+
+template <typename T>
+void BasicDistributedQubitLayer<T>::applyPauliX(int target)
+{
+    applyUnitary({target}, gates::pauliX<T>());
+}
+
+template <typename T>
+void BasicDistributedQubitLayer<T>::applyPauliY(int target)
+{
+    applyUnitary({target}, gates::pauliY<T>());
+}
+
+template <typename T>
+void BasicDistributedQubitLayer<T>::applyPauliZ(int target)
+{
+    applyUnitary({target}, gates::pauliZ<T>());
+}
+
+template <typename T>
+void BasicDistributedQubitLayer<T>::applyHadamard(int target)
+{
+    applyUnitary({target}, gates::hadamard<T>());
+}
+
+template <typename T>
+void BasicDistributedQubitLayer<T>::applyRx(int target, T theta)
+{
+    applyUnitary({target}, gates::rx<T>(theta));
+}
+
+template <typename T>
+void BasicDistributedQubitLayer<T>::applyRy(int target, T theta)
+{
+    applyUnitary({target}, gates::ry<T>(theta));
+}
+
+template <typename T>
+void BasicDistributedQubitLayer<T>::applyRz(int target, T theta)
+{
+    applyUnitary({target}, gates::rz<T>(theta));
+}
+
+template <typename T>
+void BasicDistributedQubitLayer<T>::applyCnot(int control, int target)
+{
+    applyUnitary({target}, gates::pauliX<T>(), {control});
+}
+
+template <typename T>
+void BasicDistributedQubitLayer<T>::applyToffoli(int control1, int control2, int target)
+{
+    applyUnitary({target}, gates::pauliX<T>(), {control1, control2});
+}
+
+template <typename T>
+void BasicDistributedQubitLayer<T>::applyMcnot(int *controls, int numControls, int target)
+{
+    applyUnitary({target}, gates::pauliX<T>(), std::vector<int>(controls, controls + numControls));
+}
+
+template <typename T>
+void BasicDistributedQubitLayer<T>::applyCz(int control, int target)
+{
+    applyUnitary({target}, gates::pauliZ<T>(), {control});
+}
+
+template <typename T>
+void BasicDistributedQubitLayer<T>::applyMcphase(int *controls, int numControls, int target)
+{
+    applyUnitary({target}, gates::pauliZ<T>(), std::vector<int>(controls, controls + numControls));
+}
+
+template <typename T>
+std::vector<std::complex<T>> BasicDistributedQubitLayer<T>::getAmplitudes()
+{
+    CommandHeader header{Command::gather, 0, 0, 0, 0};
+    unsigned long long int numLocalStates = 1ULL << numLocalQubits;
+    std::vector<std::complex<T>> physicalAmplitudes(numLocalStates * numProcesses);
+    for (unsigned int rank = 0; rank < numProcesses; rank++)
+        sendCommand(rank, &header, sizeof(header));
+    for (unsigned int rank = 0; rank < numProcesses; rank++)
+        if (!recvAll(sockets_[rank], physicalAmplitudes.data() + rank * numLocalStates, numLocalStates * sizeof(std::complex<T>)))
+            workerError(rank);
+    // bit p of a physical index is the value of logical qubit logical_[p]
+    std::vector<std::complex<T>> amplitudes(physicalAmplitudes.size());
+    for (unsigned long long int index = 0; index < physicalAmplitudes.size(); index++)
+    {
+        unsigned long long int logicalIndex{0};
+        for (unsigned int p = 0; p < numQubits; p++)
+            logicalIndex |= ((index >> p) & 1) << logical_[p];
+        amplitudes[logicalIndex] = physicalAmplitudes[index];
+    }
+    return amplitudes;
+}
+
+template <typename T>
+int BasicDistributedQubitLayer<T>::getPhysicalQubit(int qubit) { return physical_[qubit]; }
+
+template <typename T>
+unsigned long long int BasicDistributedQubitLayer<T>::getNumSwaps() { return numSwaps_; }
+
+template <typename T>
+unsigned int BasicDistributedQubitLayer<T>::getNumQubits() { return numQubits; }
+
+template <typename T>
+unsigned int BasicDistributedQubitLayer<T>::getNumLocalQubits() { return numLocalQubits; }
+
+template <typename T>
+unsigned int BasicDistributedQubitLayer<T>::getNumProcesses() { return numProcesses; }
+
+template class BasicDistributedQubitLayer<float>;
+template class BasicDistributedQubitLayer<double>;
@@ -0,0 +1,79 @@
+#ifndef DISTRIBUTEDQUBITLAYER_H
+#define DISTRIBUTEDQUBITLAYER_H
+#include <vector>
+#include <sys/types.h>
+#include "definitions.hpp"
+
+/**
+ * State vector of numQubits qubits split over numProcesses worker processes, numProcesses being a power of 2. The
+ * log2(numProcesses) highest physical qubits are global: they are the rank of the worker holding an amplitude, so
+ * each worker only stores the 2^numLocalQubits amplitudes of the lower, local, qubits.
+ * Gates on local qubits run unchanged on every worker, controls on global qubits only select the workers that apply
+ * the gate and diagonal gates never need communication. Any other gate on a global qubit first swaps that qubit with
+ * a local one: every worker exchanges half of its amplitudes with the worker whose rank differs in the bit of the
+ * global qubit, and the logical to physical qubit map is updated instead of swapping back afterwards.
+ * The workers are forked by the constructor and receive the gates over Unix domain sockets, so they run on one host
+ * where each of them can be given its own memory and socket. Workers are single threaded, since OpenMP cannot be used
+ * in a process forked after the OpenMP threads were started, so the parallelism comes from the number of workers.
+ */
+template <typename T>
+class BasicDistributedQubitLayer
+{
+public:
+    /**
+     * @param numQubits    number of qubits, the state starts as |0>
+     * @param numProcesses number of worker processes, a power of 2 up to 2^numQubits
+     */
+    BasicDistributedQubitLayer(unsigned int numQubits, unsigned int numProcesses);
+    ~BasicDistributedQubitLayer();
+    // the workers belong to a single state
+    BasicDistributedQubitLayer(const BasicDistributedQubitLayer &) = delete;
+    BasicDistributedQubitLayer &operator=(const BasicDistributedQubitLayer &) = delete;
+    void applyPauliX(int target);
+    void applyPauliY(int target);
+    void applyPauliZ(int target);
+    void applyHadamard(int target);
+    void applyRx(int target, T theta);
+    void applyRy(int target, T theta);
+    void applyRz(int target, T theta);
+    void applyCnot(int control, int target);
+    void applyToffoli(int control1, int control2, int target);
+    void applyMcnot(int *controls, int numControls, int target);
+    void applyCz(int control, int target);
+    void applyMcphase(int *controls, int numControls, int target);
+    /**
+     * Same as BasicQubitLayer::applyUnitary, at most numLocalQubits targets.
+     */
+    void applyUnitary(const std::vector<int> &targets, const std::vector<std::complex<T>> &matrix, const std::vector<int> &controls = {});
+    /**
+     * Gathers the amplitudes of all the workers, in the order of the logical qubits.
+     */
+    std::vector<std::complex<T>> getAmplitudes();
+    /**
+     * Returns the physical qubit a logical qubit is currently stored in, global if at least numLocalQubits.
+     */
+    int getPhysicalQubit(int qubit);
+    /**
+     * Returns the number of global qubits swapped with local ones so far, each of them an exchange of half the state.
+     */
+    unsigned long long int getNumSwaps();
+    unsigned int getNumQubits();
+    unsigned int getNumLocalQubits();
+    unsigned int getNumProcesses();
+
+private:
+    void swapQubits(int globalQubit, int localQubit);
+    void sendCommand(unsigned int rank, const void *command, unsigned long long int numBytes);
+    unsigned int numQubits;
+    unsigned int numLocalQubits;
+    unsigned int numProcesses;
+    std::vector<int> physical_; // physical qubit of each logical qubit
+    std::vector<int> logical_;  // logical qubit of each physical qubit
+    std::vector<pid_t> workers_;
+    std::vector<int> sockets_; // socket to each worker
+    unsigned long long int numSwaps_ = 0;
+};
+
+typedef BasicDistributedQubitLayer<precision> DistributedQubitLayer;
+
+#endif
@@ -0,0 +1,210 @@
+#include <iostream>
+#include <algorithm>
+#include "JobRunner.hpp"
+#include "allocator.hpp"
+#include "profiler.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+JobRunner::JobRunner(unsigned long long int memoryBudget, int numThreads, unsigned int wideQubits)
+    : memoryBudget_(memoryBudget), wideQubits_(wideQubits), created_(std::chrono::steady_clock::now())
+{
+    if (numThreads <= 0)
+    {
+#ifdef _OPENMP
+        numThreads = omp_get_max_threads();
+#else
+        numThreads = std::max(1U, std::thread::hardware_concurrency());
+#endif
+    }
+    numThreads_ = numThreads;
+    for (int w = 0; w < numThreads_; w++)
+        workers_.push_back(std::make_unique<Worker>());
+    for (int w = 0; w < numThreads_; w++)
+        workers_[w]->thread = std::thread(&JobRunner::work, this, w);
+}
+
+JobRunner::~JobRunner()
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    ready_.notify_all();
+    for (std::unique_ptr<Worker> &worker : workers_)
+        worker->thread.join();
+}
+
+unsigned long long int JobRunner::submit(const Circuit &circuit, const std::function<void(unsigned long long int, QubitLayer &)> &result,
+                                         const std::vector<precision> &parameters)
+{
+    std::unique_ptr<Job> job(new Job{0, circuit, parameters, result, 0, false, std::chrono::steady_clock::now()});
+    unsigned int numQubits = job->circuit.getNumQubits();
+    // a dense state of 2^n amplitudes, which saturates for the sizes no budget could hold anyway
+    job->bytes = numQubits + 4 < 64 ? (1ULL << numQubits) * sizeof(qubitLayer) : ~0ULL;
+    job->wide = numQubits >= wideQubits_;
+    if (job->bytes > memoryBudget_)
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Memory of the job:          " << job->bytes << std::endl;
+        std::cout << "Memory budget:              " << memoryBudget_ << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (parameters.size() < job->circuit.getNumParameters())
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of parameters:       " << job->circuit.getNumParameters() << std::endl;
+        std::cout << "Number of values:           " << parameters.size() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    unsigned long long int id = submitted_++;
+    job->id = id;
+    // jobs are dealt round robin, the workers balance them by stealing
+    Worker &worker = *workers_[nextWorker_++ % workers_.size()];
+    {
+        std::lock_guard<std::mutex> workerLock(worker.mutex);
+        worker.jobs.push_back(std::move(job));
+    }
+    queued_++;
+    ready_.notify_one();
+    return id;
+}
+
+void JobRunner::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this]
+               { return completed_ == submitted_; });
+}
+
+bool JobRunner::canStart(const Job &job)
+{
+    // a wide job runs alone, a narrow one next to other narrow ones
+    return !wideRunning_ && (!job.wide || running_ == 0) && reserved_ + job.bytes <= memoryBudget_;
+}
+
+std::unique_ptr<JobRunner::Job> JobRunner::take(unsigned int self)
+{
+    // the caller has claimed a queued job, so one of the deques holds it
+    for (;;)
+    {
+        {
+            Worker &own = *workers_[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.jobs.empty())
+            {
+                std::unique_ptr<Job> job = std::move(own.jobs.back());
+                own.jobs.pop_back();
+                return job;
+            }
+        }
+        for (unsigned int w = 1; w < workers_.size(); w++)
+        {
+            Worker &victim = *workers_[(self + w) % workers_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.jobs.empty())
+            {
+                std::unique_ptr<Job> job = std::move(victim.jobs.front());
+                victim.jobs.pop_front();
+                return job;
+            }
+        }
+    }
+}
+
+void JobRunner::work(unsigned int self)
+{
+    for (;;)
+    {
+        std::unique_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            // the parked job goes first, and nothing else starts until it can
+            ready_.wait(lock, [this]
+                        { return parked_ ? canStart(*parked_) : stop_ || queued_ > 0; });
+            if (parked_)
+                job = std::move(parked_);
+            else if (queued_ == 0)
+                return;
+            else
+            {
+                queued_--;
+                lock.unlock();
+                job = take(self);
+                lock.lock();
+                if (parked_ || !canStart(*job))
+                {
+                    // a job that cannot start blocks the queue rather than being overtaken forever
+                    if (!parked_)
+                        parked_ = std::move(job);
+                    else
+                    {
+                        std::lock_guard<std::mutex> workerLock(workers_[self]->mutex);
+                        workers_[self]->jobs.push_back(std::move(job));
+                        queued_++;
+                    }
+                    continue;
+                }
+            }
+            running_++;
+            wideRunning_ = job->wide;
+            reserved_ += job->bytes;
+            peak_ = std::max(peak_, reserved_);
+            // released states pooled for reuse still take memory, so the pool only keeps what the budget leaves free,
+            // besides a buffer this job can take over
+            memory::getDefaultAllocator().trim(memoryBudget_ - reserved_, job->bytes);
+            double latency = std::chrono::duration<double>(std::chrono::steady_clock::now() - job->submitted).count();
+            queueLatency_ += latency;
+            maxQueueLatency_ = std::max(maxQueueLatency_, latency);
+            started_++;
+        }
+        // narrow jobs keep their state on this thread, as the other threads run jobs of their own
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        {
+            QSIM_PROFILE_SCOPE(job->wide ? "job wide" : "job narrow");
+            QubitLayer q(job->circuit.getNumQubits());
+            q.setNumThreads(job->wide ? numThreads_ : 1);
+            job->circuit.run(q, job->parameters);
+            job->result(job->id, q);
+        }
+        double runTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_--;
+            reserved_ -= job->bytes;
+            memory::getDefaultAllocator().trim(memoryBudget_ - reserved_);
+            if (job->wide)
+            {
+                wideRunning_ = false;
+                wideJobs_++;
+            }
+            runTime_ += runTime;
+            completed_++;
+            if (completed_ == submitted_)
+                idle_.notify_all();
+        }
+        ready_.notify_all();
+    }
+}
+
+JobStats JobRunner::getStats()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    JobStats stats;
+    stats.submitted = submitted_;
+    stats.completed = completed_;
+    stats.wideJobs = wideJobs_;
+    stats.reservedBytes = reserved_;
+    stats.peakBytes = peak_;
+    stats.elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - created_).count();
+    stats.throughput = stats.elapsed > 0 ? completed_ / stats.elapsed : 0;
+    stats.meanQueueLatency = started_ > 0 ? queueLatency_ / started_ : 0;
+    stats.maxQueueLatency = maxQueueLatency_;
+    stats.meanRunTime = completed_ > 0 ? runTime_ / completed_ : 0;
+    return stats;
+}
+
+int JobRunner::getNumThreads() { return numThreads_; }
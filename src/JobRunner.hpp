@@ -0,0 +1,115 @@
+#ifndef JOBRUNNER_H
+#define JOBRUNNER_H
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "definitions.hpp"
+#include "Circuit.hpp"
+
+// counters of a JobRunner, times are in seconds
+struct JobStats
+{
+    unsigned long long int submitted;
+    unsigned long long int completed;
+    unsigned long long int wideJobs;      // completed jobs that were given all the threads
+    unsigned long long int reservedBytes; // memory reserved by the running jobs
+    unsigned long long int peakBytes;     // largest memory reserved at once
+    double elapsed;                       // since the runner was created
+    double throughput;                    // completed jobs per second
+    double meanQueueLatency;              // from submission to start, over the started jobs
+    double maxQueueLatency;
+    double meanRunTime;                   // from start to the end of the result callback, over the completed jobs
+};
+
+/**
+ * Runs a stream of circuits, each from |0> on a QubitLayer of its own, on a pool of worker threads. Jobs on fewer than
+ * wideQubits qubits are run side by side, one per thread with a single threaded state, while a job on more qubits waits
+ * for the running jobs to finish and then gets all the threads for its gate loops. A job reserves the memory of its
+ * dense state (getNumStates() amplitudes) while it runs, and only starts when the reserved memory stays within the
+ * budget, the default PoolAllocator being trimmed so that the released states it pools fit in what is left. Every worker takes jobs from the back of its own deque and steals from the front of the others once it is
+ * empty, and a job that cannot start yet waits ahead of all the queued ones, so large jobs are not starved by small ones.
+ */
+class JobRunner
+{
+public:
+    /**
+     * @param memoryBudget memory the states of the running jobs may take, in bytes
+     * @param numThreads   number of worker threads, 0 for all of them
+     * @param wideQubits   jobs on at least this many qubits get all the threads
+     */
+    JobRunner(unsigned long long int memoryBudget, int numThreads = 0, unsigned int wideQubits = wideJobQubits);
+    /**
+     * Waits for the submitted jobs and stops the workers.
+     */
+    ~JobRunner();
+    JobRunner(const JobRunner &) = delete;
+    JobRunner &operator=(const JobRunner &) = delete;
+    /**
+     * Queues a run of a circuit, which is copied. result is called by the worker that ran it, concurrently with the
+     * other jobs, with the job number and the final state.
+     * @param circuit    circuit to run
+     * @param result     reads the results of the job, e.g. expectation values or samples
+     * @param parameters value of every parameter, by index
+     * @return job number, counting from 0 in submission order
+     */
+    unsigned long long int submit(const Circuit &circuit, const std::function<void(unsigned long long int, QubitLayer &)> &result,
+                                  const std::vector<precision> &parameters = {});
+    /**
+     * Blocks until every submitted job has completed.
+     */
+    void wait();
+    JobStats getStats();
+    int getNumThreads();
+
+private:
+    struct Job
+    {
+        unsigned long long int id;
+        Circuit circuit;
+        std::vector<precision> parameters;
+        std::function<void(unsigned long long int, QubitLayer &)> result;
+        unsigned long long int bytes;
+        bool wide;
+        std::chrono::steady_clock::time_point submitted;
+    };
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<std::unique_ptr<Job>> jobs;
+        std::thread thread;
+    };
+    void work(unsigned int self);
+    std::unique_ptr<Job> take(unsigned int self);
+    bool canStart(const Job &job);
+    unsigned long long int memoryBudget_;
+    int numThreads_ = 1;
+    unsigned int wideQubits_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    // the scheduling state below is guarded by mutex_, the deques by the mutex of their worker
+    std::mutex mutex_;
+    std::condition_variable ready_; // a job may start or the runner is stopping
+    std::condition_variable idle_;  // every submitted job has completed
+    std::unique_ptr<Job> parked_;   // job taken from a deque that could not start yet
+    unsigned long long int queued_ = 0; // jobs in the deques that no worker has claimed
+    unsigned long long int nextWorker_ = 0;
+    unsigned long long int running_ = 0;
+    bool wideRunning_ = false;
+    bool stop_ = false;
+    unsigned long long int submitted_ = 0;
+    unsigned long long int started_ = 0;
+    unsigned long long int completed_ = 0;
+    unsigned long long int wideJobs_ = 0;
+    unsigned long long int reserved_ = 0;
+    unsigned long long int peak_ = 0;
+    double queueLatency_ = 0;
+    double maxQueueLatency_ = 0;
+    double runTime_ = 0;
+    std::chrono::steady_clock::time_point created_;
+};
+
+#endif
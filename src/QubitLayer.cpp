@@ -2,311 +2,1261 @@
 #include <iostream>
 #include <cmath>
 #include <algorithm>
+#include <numeric>
 #include "QubitLayer.hpp"
+#include "kernels.hpp"
+#include "gates.hpp"
+#include "profiler.hpp"
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-QubitLayer::QubitLayer(unsigned int numQubits, qubitLayer *qL)
-{
-    // calculate the number of states
-    numStates = 1;
-    for (unsigned int i = 0; i < numQubits; i++)
-        numStates *= 2;
-    // allocate memory for arrays
-    qEven_ = new qubitLayer[numStates];
-    qOdd_ = new qubitLayer[numStates];
-    // if input is provided then use that to fill the input qubit state
-    if (!(qL == nullptr))
-        for (unsigned int row = 0; row < numStates; row++)
-            qEven_[row] = qL[row];
-    else
-        qEven_[0] = {1, 0};
+namespace
+{
+    // a state index as a string of numQubits bits, the highest qubit first
+    std::string binaryString(unsigned long long int state, unsigned int numQubits)
+    {
+        return std::bitset<maxQubits>(state).to_string().substr(maxQubits - numQubits);
+    }
+
+    // value of the measured qubits in a state, bit j being the value of qubits[j]
+    unsigned long long int outcomeOf(unsigned long long int state, const std::vector<int> &qubits)
+    {
+        unsigned long long int outcome{0};
+        for (unsigned long long int j = 0; j < qubits.size(); j++)
+            outcome |= ((state >> qubits[j]) & 1) << j;
+        return outcome;
+    }
+
+    // a state whose amplitudes are all zero (e.g. built from all-zero amplitudes) has no outcome to draw
+    void checkProbability(double total)
+    {
+        if (total > 0)
+            return;
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Total probability of state: " << total << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // header at the start of a checkpoint file, the data starts at checkpointDataOffset
+    struct CheckpointHeader
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t numQubits;
+        std::uint32_t precisionBytes; // bytes of the scalar type of the amplitudes, 4 (float) or 8 (double)
+        std::uint32_t ordering;       // checkpointQubitOrdering: bit j of a state index is the value of qubit j
+        std::uint32_t compressed;     // 1 if the data is a list of non-zero blocks, 0 if it is every amplitude
+        std::uint32_t reserved;
+        std::uint64_t blockStates; // states per block of a compressed checkpoint
+        std::uint64_t dataBytes;
+        std::uint64_t checksum; // checksumOf the data
+    };
+
+    constexpr char checkpointMagic[8] = {'Q', 'S', 'I', 'M', 'C', 'K', 'P', 'T'};
+    constexpr std::uint32_t checkpointVersion{1};
+    constexpr std::uint32_t checkpointQubitOrdering{0};
+    // multiple of the page size of every common platform, so the data can be mapped in place
+    constexpr unsigned long long int checkpointDataOffset{1ULL << 16};
+    constexpr std::uint64_t checksumSeed{14695981039346656037ULL};
+
+    // FNV-1a over 64-bit words, continuing from checksum so the data can be hashed in pieces of whole words
+    std::uint64_t checksumOf(const void *data, unsigned long long int numBytes, std::uint64_t checksum)
+    {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        for (unsigned long long int offset = 0; offset < numBytes; offset += sizeof(std::uint64_t))
+        {
+            std::uint64_t word;
+            std::memcpy(&word, bytes + offset, sizeof(word));
+            checksum = (checksum ^ word) * 1099511628211ULL;
+        }
+        return checksum;
+    }
+
+    void checkpointError(const std::string &path, const std::string &reason)
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Checkpoint file:            " << path << std::endl;
+        std::cout << "Reason:                     " << reason << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    void writeAll(int fd, const void *data, unsigned long long int numBytes, const std::string &path)
+    {
+        const char *bytes = static_cast<const char *>(data);
+        while (numBytes > 0)
+        {
+            ssize_t written = write(fd, bytes, numBytes);
+            if (written <= 0)
+                checkpointError(path, "write failed");
+            bytes += written;
+            numBytes -= written;
+        }
+    }
 }
 
-QubitLayer::~QubitLayer()
+PauliString pauliString(const std::string &paulis, precision coefficient)
 {
-    delete[] qEven_;
-    delete[] qOdd_;
+    PauliString term{0, 0, coefficient};
+    for (unsigned long long int j = 0; j < paulis.size(); j++)
+    {
+        char pauli = paulis[j];
+        if (pauli != 'I' && pauli != 'X' && pauli != 'Y' && pauli != 'Z')
+        {
+            std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+            std::cout << "Pauli string:               " << paulis << std::endl;
+            std::cout << "Invalid Pauli operator:     " << pauli << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        if (pauli == 'X' || pauli == 'Y')
+            term.xMask |= 1ULL << j;
+        if (pauli == 'Z' || pauli == 'Y')
+            term.zMask |= 1ULL << j;
+    }
+    return term;
 }
 
-void QubitLayer::updateLayer()
+template <typename T>
+BasicQubitLayer<T>::BasicQubitLayer(unsigned int numQubits, std::complex<T> *qL, const std::string &storageFile)
+    : numQubits(numQubits), storageFile_(storageFile)
 {
-    parity ? std::fill(qEven_, qEven_ + numStates, zeroComplex) : std::fill(qOdd_, qOdd_ + numStates, zeroComplex);
-    toggleParity();
+    if (numQubits > maxQubits)
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of qubits:           " << numQubits << std::endl;
+        std::cout << "Max number of qubits:       " << maxQubits << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    numStates = 1ULL << numQubits;
+    layout_.resize(numQubits);
+    std::iota(layout_.begin(), layout_.end(), 0);
+#ifdef _OPENMP
+    numThreads_ = omp_get_max_threads();
+#endif
+    // if input is provided then use that to fill the input qubit state, otherwise start from a sparse |0>
+    if (qL != nullptr)
+    {
+        allocateDense(qL);
+        if (countNonZero() < numStates * sparseOccupancy)
+            toSparse();
+        return;
+    }
+    sparse_[0] = {1, 0};
+    updateRepresentation(false);
 }
 
-bool QubitLayer::checkZeroState(int qubit)
+template <typename T>
+BasicQubitLayer<T>::~BasicQubitLayer()
 {
-    return parity ? qEven_[qubit].imag() || qEven_[qubit].real() : qOdd_[qubit].imag() || qOdd_[qubit].real();
+    releaseDense();
 }
 
-void QubitLayer::applyPauliX(int target)
+template <typename T>
+BasicQubitLayer<T>::BasicQubitLayer(BasicQubitLayer &&other) noexcept
+    : numQubits(other.numQubits), numStates(other.numStates), qubits_(other.qubits_), allocator_(other.allocator_),
+      storageFile_(std::move(other.storageFile_)), checkpoint_(other.checkpoint_), checkpointBytes_(other.checkpointBytes_),
+      sparse_(std::move(other.sparse_)), mixingGates_(other.mixingGates_), diagonals_(std::move(other.diagonals_)),
+      layout_(std::move(other.layout_)), numThreads_(other.numThreads_)
 {
-    for (unsigned long long int i = 0; i < numStates; i++)
-        if (checkZeroState(i))
-        {
-            std::bitset<maxQubits> state = i;
-            state.flip(target);
-            parity ? qOdd_[state.to_ulong()] = qEven_[i] : qEven_[state.to_ulong()] = qOdd_[i];
-        }
-    updateLayer();
+    // the other state must not release the memory or remove the storage file it no longer owns
+    other.qubits_ = nullptr;
+    other.checkpoint_ = nullptr;
+    other.storageFile_.clear();
 }
 
-void QubitLayer::applyPauliY(int target)
+template <typename T>
+BasicQubitLayer<T> &BasicQubitLayer<T>::operator=(BasicQubitLayer &&other) noexcept
 {
-    for (unsigned long long int i = 0; i < numStates; i++)
-        if (checkZeroState(i))
-        {
-            std::bitset<maxQubits> state = i;
-            // flip qubit
-            state.flip(target);
-            // add phase of -i if bit was 1 (i.e. set) and flip it
-            if (!state.test(target))
-                parity ? qOdd_[state.to_ulong()] = -complexImg * qEven_[i] : qEven_[state.to_ulong()] = -complexImg * qOdd_[i];
-            // add phase of i if bit was 0 (i.e. set) and flip it
-            else
-                parity ? qOdd_[state.to_ulong()] = complexImg * qEven_[i] : qEven_[state.to_ulong()] = complexImg * qOdd_[i];
-        }
-    updateLayer();
+    if (this == &other)
+        return *this;
+    releaseDense();
+    numQubits = other.numQubits;
+    numStates = other.numStates;
+    qubits_ = other.qubits_;
+    allocator_ = other.allocator_;
+    storageFile_ = std::move(other.storageFile_);
+    checkpoint_ = other.checkpoint_;
+    checkpointBytes_ = other.checkpointBytes_;
+    sparse_ = std::move(other.sparse_);
+    mixingGates_ = other.mixingGates_;
+    diagonals_ = std::move(other.diagonals_);
+    layout_ = std::move(other.layout_);
+    numThreads_ = other.numThreads_;
+    other.qubits_ = nullptr;
+    other.checkpoint_ = nullptr;
+    other.storageFile_.clear();
+    return *this;
 }
 
-void QubitLayer::applyPauliZ(int target)
+template <typename T>
+void BasicQubitLayer<T>::allocateDense(const std::complex<T> *qL)
 {
-    for (unsigned long long int i = 0; i < numStates; i++)
-        if (checkZeroState(i))
+    unsigned long long int numBytes = numStates * sizeof(std::complex<T>);
+    if (!storageFile_.empty())
+    {
+        // a file extended with ftruncate reads as zeros, so the |0> amplitudes do not need to be written
+        int fd = open(storageFile_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        void *mapped = MAP_FAILED;
+        if (fd >= 0 && ftruncate(fd, numBytes) == 0)
+            mapped = mmap(nullptr, numBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (fd >= 0)
+            close(fd);
+        if (mapped == MAP_FAILED)
         {
-            std::bitset<maxQubits> state = i;
-            // add phase if bit is 1 (i.e. it is set)
-            if (state.test(target))
-                parity ? qOdd_[i] = -qEven_[i] : qEven_[i] = -qOdd_[i];
-            else
-                parity ? qOdd_[i] = qEven_[i] : qEven_[i] = qOdd_[i];
+            std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+            std::cout << "Could not map storage file: " << storageFile_ << std::endl;
+            std::cout << "Size of storage file:       " << numBytes << " bytes" << std::endl;
+            exit(EXIT_FAILURE);
         }
-    updateLayer();
+        // the gates stream through the file
+        madvise(mapped, numBytes, MADV_SEQUENTIAL);
+        qubits_ = static_cast<std::complex<T> *>(mapped);
+        if (qL == nullptr)
+            return;
+    }
+    else
+    {
+        // uninitialised aligned memory, so that fresh pages are first touched by the threads that work on them
+        allocator_ = &memory::getAllocator();
+        qubits_ = static_cast<std::complex<T> *>(allocator_->allocate(numBytes));
+    }
+#pragma omp parallel for num_threads(numThreads_) schedule(static) if (numStates >= minParallelStates)
+    for (unsigned long long int row = 0; row < numStates; row++)
+        qubits_[row] = qL == nullptr ? constants<T>::zeroComplex : qL[row];
 }
 
-void QubitLayer::applyHadamard(int target)
+template <typename T>
+void BasicQubitLayer<T>::releaseDense()
 {
-    // map |1> to -hadamardCoef*|1> and |0> to hadamardCoef*|0>
+    if (qubits_ == nullptr)
+        return;
+    if (checkpoint_ != nullptr)
+    {
+        munmap(checkpoint_, checkpointBytes_);
+        checkpoint_ = nullptr;
+    }
+    else if (storageFile_.empty())
+        allocator_->deallocate(qubits_, numStates * sizeof(std::complex<T>));
+    else
+    {
+        munmap(qubits_, numStates * sizeof(std::complex<T>));
+        unlink(storageFile_.c_str());
+    }
+    qubits_ = nullptr;
+}
+
+template <typename T>
+unsigned int BasicQubitLayer<T>::maxDenseSize()
+{
+    return storageFile_.empty() ? maxDenseQubits : maxMappedQubits;
+}
+
+template <typename T>
+void BasicQubitLayer<T>::toDense()
+{
+    QSIM_PROFILE_SCOPE("toDense");
+    allocateDense(nullptr);
+    for (const auto &amplitude : sparse_)
+        qubits_[amplitude.first] = amplitude.second;
+    // release the memory of the hash table
+    basicSparseLayer<T>().swap(sparse_);
+    mixingGates_ = 0;
+}
+
+template <typename T>
+void BasicQubitLayer<T>::toSparse()
+{
+    QSIM_PROFILE_SCOPE("toSparse");
     for (unsigned long long int i = 0; i < numStates; i++)
-        if (checkZeroState(i))
-        {
-            std::bitset<maxQubits> state = i;
-            if (state.test(target))
-                parity ? qOdd_[i] -= hadamardCoef * qEven_[i] : qEven_[i] -= hadamardCoef * qOdd_[i];
-            else
-                parity ? qOdd_[i] += hadamardCoef * qEven_[i] : qEven_[i] += hadamardCoef * qOdd_[i];
-            state.flip(target);
-            parity ? qOdd_[state.to_ulong()] += hadamardCoef * qEven_[i] : qEven_[state.to_ulong()] += hadamardCoef * qOdd_[i];
-        }
-    updateLayer();
+        if (std::abs(qubits_[i]) > constants<T>::sparseZero)
+            sparse_[i] = qubits_[i];
+    releaseDense();
 }
 
-void QubitLayer::applyRx(int target, precision theta)
+template <typename T>
+unsigned long long int BasicQubitLayer<T>::countNonZero()
 {
-    // compute the sine and cosine of the rotation angle
-    precision cosTheta = cos(theta / 2);
-    precision sinTheta = sin(theta / 2);
-    // map |0> to cosTheta*|0> and |1> to cosTheta*|1>
+    QSIM_PROFILE_SCOPE("countNonZero");
+    unsigned long long int count{0};
+#pragma omp parallel for num_threads(numThreads_) schedule(static) reduction(+ : count) if (numStates >= minParallelStates)
     for (unsigned long long int i = 0; i < numStates; i++)
-        if (checkZeroState(i))
+        if (std::abs(qubits_[i]) > constants<T>::sparseZero)
+            count++;
+    return count;
+}
+
+template <typename T>
+void BasicQubitLayer<T>::updateRepresentation(bool mixing)
+{
+    if (qubits_ == nullptr)
+    {
+        if (numQubits <= maxDenseSize() && sparse_.size() > numStates * denseOccupancy)
+            toDense();
+        return;
+    }
+    // only gates mixing amplitudes (i.e. neither diagonal nor permutations) change the number of non-zero
+    // amplitudes, and counting them is a pass over the states, so a dense state is only checked now and then
+    if (!mixing || ++mixingGates_ < sparseCheckInterval)
+        return;
+    mixingGates_ = 0;
+    if (countNonZero() < numStates * sparseOccupancy)
+        toSparse();
+}
+
+template <typename T>
+bool BasicQubitLayer<T>::isSparse() { return qubits_ == nullptr; }
+
+template <typename T>
+bool BasicQubitLayer<T>::isMapped() { return !storageFile_.empty(); }
+
+template <typename T>
+void BasicQubitLayer<T>::setNumThreads(int numThreads)
+{
+    numThreads_ = std::max(numThreads, 1);
+}
+
+template <typename T>
+int BasicQubitLayer<T>::getNumThreads() { return numThreads_; }
+
+template <typename T>
+void BasicQubitLayer<T>::applyUnitary(const std::vector<int> &targets, const std::vector<std::complex<T>> &matrix, const std::vector<int> &controls)
+{
+    QSIM_PROFILE_SCOPE("unitary");
+    unsigned long long int dim = 1ULL << targets.size();
+    unsigned long long int targetMask{0};
+    unsigned long long int ctrlMask{0};
+    bool validQubits = !targets.empty();
+    for (int target : targets)
+    {
+        validQubits = validQubits && target >= 0 && target < static_cast<int>(numQubits) && !(targetMask & (1ULL << target));
+        targetMask |= 1ULL << target;
+    }
+    for (int control : controls)
+    {
+        validQubits = validQubits && control >= 0 && control < static_cast<int>(numQubits) && !((targetMask | ctrlMask) & (1ULL << control));
+        ctrlMask |= 1ULL << control;
+    }
+    if (!validQubits || matrix.size() != dim * dim)
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of qubits:           " << numQubits << std::endl;
+        std::cout << "Number of targets:          " << targets.size() << std::endl;
+        std::cout << "Number of controls:         " << controls.size() << std::endl;
+        std::cout << "Number of matrix entries:   " << matrix.size() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    // the gate acts on the bits the qubits are stored at
+    std::vector<int> bits = toPhysical(targets);
+    ctrlMask = physicalIndex(ctrlMask);
+    MatrixType type = kernels::classifyMatrix(matrix.data(), dim);
+    if (type == MatrixType::diagonal)
+    {
+        std::vector<std::complex<T>> diagonal(dim);
+        for (unsigned long long int r = 0; r < dim; r++)
+            diagonal[r] = matrix[r * dim + r];
+        diagonals_.push_back({bits, ctrlMask, diagonal});
+        if (diagonals_.size() >= maxDiagonalGates)
+            flushDiagonals();
+        return;
+    }
+    flushDiagonals();
+    // a mixing gate can fill every group holding an amplitude, so a sparse state that would end up dense is made
+    // dense first rather than after its map has grown past the size of the dense state
+    if (qubits_ == nullptr && type >= MatrixType::real && numQubits <= maxDenseSize() &&
+        static_cast<precision>(sparse_.size()) * dim > numStates * denseOccupancy)
+        toDense();
+    if (qubits_ == nullptr)
+        kernels::applyUnitarySparse(sparse_, bits.data(), bits.size(), matrix.data(), ctrlMask);
+    else
+        kernels::applyUnitary(qubits_, numStates, bits.data(), bits.size(), matrix.data(), ctrlMask, numThreads_);
+    updateRepresentation(type >= MatrixType::real);
+}
+
+template <typename T>
+void BasicQubitLayer<T>::flushDiagonals()
+{
+    if (diagonals_.empty())
+        return;
+    if (qubits_ == nullptr)
+        kernels::applyDiagonalsSparse(sparse_, diagonals_);
+    else
+        kernels::applyDiagonals(qubits_, numStates, diagonals_, numThreads_);
+    diagonals_.clear();
+}
+
+template <typename T>
+void BasicQubitLayer<T>::applyPauliX(int target)
+{
+    QSIM_PROFILE_SCOPE("PauliX");
+    applyUnitary({target}, gates::pauliX<T>());
+}
+
+template <typename T>
+void BasicQubitLayer<T>::applyPauliY(int target)
+{
+    QSIM_PROFILE_SCOPE("PauliY");
+    applyUnitary({target}, gates::pauliY<T>());
+}
+
+template <typename T>
+void BasicQubitLayer<T>::applyPauliZ(int target)
+{
+    QSIM_PROFILE_SCOPE("PauliZ");
+    applyUnitary({target}, gates::pauliZ<T>());
+}
+
+template <typename T>
+void BasicQubitLayer<T>::applyHadamard(int target)
+{
+    QSIM_PROFILE_SCOPE("Hadamard");
+    applyUnitary({target}, gates::hadamard<T>());
+}
+
+template <typename T>
+void BasicQubitLayer<T>::applyRx(int target, T theta)
+{
+    QSIM_PROFILE_SCOPE("Rx");
+    applyUnitary({target}, gates::rx<T>(theta));
+}
+
+template <typename T>
+void BasicQubitLayer<T>::applyRy(int target, T theta)
+{
+    QSIM_PROFILE_SCOPE("Ry");
+    applyUnitary({target}, gates::ry<T>(theta));
+}
+
+template <typename T>
+void BasicQubitLayer<T>::applyRz(int target, T theta)
+{
+    QSIM_PROFILE_SCOPE("Rz");
+    applyUnitary({target}, gates::rz<T>(theta));
+}
+
+template <typename T>
+void BasicQubitLayer<T>::applyCnot(int control, int target)
+{
+    QSIM_PROFILE_SCOPE("CNOT");
+    applyUnitary({target}, gates::pauliX<T>(), {control});
+}
+
+template <typename T>
+void BasicQubitLayer<T>::applyToffoli(int control1, int control2, int target)
+{
+    QSIM_PROFILE_SCOPE("Toffoli");
+    applyUnitary({target}, gates::pauliX<T>(), {control1, control2});
+}
+
+template <typename T>
+void BasicQubitLayer<T>::applyMcnot(int *controls, int numControls, int target)
+{
+    QSIM_PROFILE_SCOPE("MCNOT");
+    // flip target qubit if control bit(s) is 1 (i.e. set)
+    applyUnitary({target}, gates::pauliX<T>(), std::vector<int>(controls, controls + numControls));
+}
+
+template <typename T>
+void BasicQubitLayer<T>::applyCz(int control, int target)
+{
+    QSIM_PROFILE_SCOPE("CZ");
+    applyUnitary({target}, gates::pauliZ<T>(), {control});
+}
+
+template <typename T>
+void BasicQubitLayer<T>::applyMcphase(int *controls, int numControls, int target)
+{
+    QSIM_PROFILE_SCOPE("MCPhase");
+    // add phase to target qubit if control bit(s) and target bit is 1 (i.e. set)
+    applyUnitary({target}, gates::pauliZ<T>(), std::vector<int>(controls, controls + numControls));
+}
+
+template <typename T>
+void BasicQubitLayer<T>::applySwap(int qubit1, int qubit2)
+{
+    if (qubit1 < 0 || qubit1 >= static_cast<int>(numQubits) || qubit2 < 0 || qubit2 >= static_cast<int>(numQubits) || qubit1 == qubit2)
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of qubits:           " << numQubits << std::endl;
+        std::cout << "Swapped qubits:             " << qubit1 << ", " << qubit2 << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::swap(layout_[qubit1], layout_[qubit2]);
+}
+
+template <typename T>
+void BasicQubitLayer<T>::permuteQubits(const std::vector<int> &permutation)
+{
+    std::vector<bool> seen(numQubits, false);
+    bool validPermutation = permutation.size() == numQubits;
+    for (int qubit : permutation)
+    {
+        validPermutation = validPermutation && qubit >= 0 && qubit < static_cast<int>(numQubits) && !seen[qubit];
+        if (validPermutation)
+            seen[qubit] = true;
+    }
+    if (!validPermutation)
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of qubits:           " << numQubits << std::endl;
+        std::cout << "Size of permutation:        " << permutation.size() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::vector<int> layout(numQubits);
+    for (unsigned int j = 0; j < numQubits; j++)
+        layout[permutation[j]] = layout_[j];
+    layout_ = layout;
+}
+
+template <typename T>
+void BasicQubitLayer<T>::relocateQubit(int qubit, int position)
+{
+    if (qubit < 0 || qubit >= static_cast<int>(numQubits) || position < 0 || position >= static_cast<int>(numQubits))
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of qubits:           " << numQubits << std::endl;
+        std::cout << "Qubit:                      " << qubit << std::endl;
+        std::cout << "Position:                   " << position << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (layout_[qubit] != position)
+        swapBits(layout_[qubit], position);
+}
+
+template <typename T>
+void BasicQubitLayer<T>::swapBits(int bit1, int bit2)
+{
+    QSIM_PROFILE_SCOPE("swap bits");
+    // the queued diagonal gates act on the bits as they are now
+    flushDiagonals();
+    if (qubits_ == nullptr)
+    {
+        basicSparseLayer<T> swapped;
+        swapped.reserve(sparse_.size());
+        for (const auto &amplitude : sparse_)
         {
-            parity ? qOdd_[i] += cosTheta * qEven_[i] : qEven_[i] += cosTheta * qOdd_[i];
-            std::bitset<maxQubits> state = i;
-            state.flip(target);
-            parity ? qOdd_[state.to_ulong()] += -complexImg * sinTheta * qEven_[i] : qEven_[state.to_ulong()] += -complexImg * sinTheta * qOdd_[i];
+            unsigned long long int differ = ((amplitude.first >> bit1) ^ (amplitude.first >> bit2)) & 1;
+            swapped[amplitude.first ^ (differ << bit1) ^ (differ << bit2)] = amplitude.second;
         }
-    updateLayer();
+        sparse_.swap(swapped);
+    }
+    else
+    {
+        const int bits[2] = {bit1, bit2};
+        kernels::applyUnitary(qubits_, numStates, bits, 2, gates::swap<T>().data(), 0, numThreads_);
+    }
+    for (int &position : layout_)
+        position = position == bit1 ? bit2 : position == bit2 ? bit1 : position;
 }
 
-void QubitLayer::applyRy(int target, precision theta)
+template <typename T>
+void BasicQubitLayer<T>::restoreLayout()
 {
-    // compute the sine and cosine of the rotation angle
-    precision cosTheta = cos(theta / 2);
-    precision sinTheta = sin(theta / 2);
-    // map |1> to cosTheta*|1> and |0> to cosTheta*|0>
-    for (unsigned long long int i = 0; i < numStates; i++)
-        if (checkZeroState(i))
+    // the qubits below position are in place, so the one stored at position is above it
+    for (int position = 0; position < static_cast<int>(numQubits); position++)
+        if (layout_[position] != position)
+            swapBits(layout_[position], position);
+}
+
+template <typename T>
+std::vector<int> BasicQubitLayer<T>::toPhysical(const std::vector<int> &qubits)
+{
+    std::vector<int> bits(qubits.size());
+    for (unsigned long long int j = 0; j < qubits.size(); j++)
+        bits[j] = layout_[qubits[j]];
+    return bits;
+}
+
+template <typename T>
+unsigned long long int BasicQubitLayer<T>::physicalIndex(unsigned long long int index)
+{
+    unsigned long long int physical{0};
+    for (unsigned int j = 0; j < numQubits; j++)
+        physical |= ((index >> j) & 1) << layout_[j];
+    return physical;
+}
+
+template <typename T>
+unsigned long long int BasicQubitLayer<T>::logicalIndex(unsigned long long int index)
+{
+    unsigned long long int logical{0};
+    for (unsigned int j = 0; j < numQubits; j++)
+        logical |= ((index >> layout_[j]) & 1) << j;
+    return logical;
+}
+
+template <typename T>
+bool BasicQubitLayer<T>::isRelabelled()
+{
+    for (unsigned int j = 0; j < numQubits; j++)
+        if (layout_[j] != static_cast<int>(j))
+            return true;
+    return false;
+}
+
+template <typename T>
+void BasicQubitLayer<T>::applyPhaseOracle(const std::vector<unsigned long long int> &marked)
+{
+    QSIM_PROFILE_SCOPE("PhaseOracle");
+    // a state marked twice is only flipped once
+    std::vector<unsigned long long int> states(marked);
+    std::sort(states.begin(), states.end());
+    states.erase(std::unique(states.begin(), states.end()), states.end());
+    if (!states.empty() && states.back() >= numStates)
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of states:           " << numStates << std::endl;
+        std::cout << "Marked state:               " << states.back() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    bool relabelled = isRelabelled();
+    for (unsigned long long int state : states)
+    {
+        unsigned long long int i = relabelled ? physicalIndex(state) : state;
+        if (qubits_ != nullptr)
+            qubits_[i] = -qubits_[i];
+        else
         {
-            parity ? qOdd_[i] += cosTheta * qEven_[i] : qEven_[i] += cosTheta * qOdd_[i];
-            std::bitset<maxQubits> state = i;
-            state.flip(target);
-            // action if bit is 1 (i.e. set)
-            if (state.test(target))
-                parity ? qOdd_[state.to_ulong()] += sinTheta * qEven_[i] : qEven_[state.to_ulong()] += sinTheta * qOdd_[i];
-            // action if bit is 0 (i.e. not set)
-            else
-                parity ? qOdd_[state.to_ulong()] -= sinTheta * qEven_[i] : qEven_[state.to_ulong()] -= sinTheta * qOdd_[i];
+            auto amplitude = sparse_.find(i);
+            if (amplitude != sparse_.end())
+                amplitude->second = -amplitude->second;
         }
-    updateLayer();
+    }
 }
 
-void QubitLayer::applyRz(int target, precision theta)
+template <typename T>
+void BasicQubitLayer<T>::applyPhaseOracle(const std::function<bool(unsigned long long int)> &predicate)
 {
-    // compute the sine and cosine of the rotation angle
-    precision cosTheta = cos(theta / 2);
-    precision sinTheta = sin(theta / 2);
+    QSIM_PROFILE_SCOPE("PhaseOracle");
+    // the predicate is given the state with its qubits in order
+    bool relabelled = isRelabelled();
+    if (qubits_ == nullptr)
+    {
+        for (auto &amplitude : sparse_)
+            if (predicate(relabelled ? logicalIndex(amplitude.first) : amplitude.first))
+                amplitude.second = -amplitude.second;
+        return;
+    }
+#pragma omp parallel for num_threads(numThreads_) schedule(static) if (numStates >= minParallelStates)
     for (unsigned long long int i = 0; i < numStates; i++)
-        if (checkZeroState(i))
-        {
-            std::bitset<maxQubits> state = i;
-            // action if bit is 1 (i.e. set)
-            if (state.test(target))
-                parity ? qOdd_[i] += cosTheta * qEven_[i] + complexImg * sinTheta * qEven_[i] : qEven_[i] += cosTheta * qOdd_[i] + complexImg * sinTheta * qOdd_[i];
-            // action if bit is 0 (i.e. not set)
-            else
-                parity ? qOdd_[i] += cosTheta * qEven_[i] - complexImg * sinTheta * qEven_[i] : qEven_[i] += cosTheta * qOdd_[i] - complexImg * sinTheta * qOdd_[i];
-        }
-    updateLayer();
+        if (predicate(relabelled ? logicalIndex(i) : i))
+            qubits_[i] = -qubits_[i];
 }
 
-bool QubitLayer::checkControls(int *controls, int numControls, std::bitset<maxQubits> state)
+template <typename T>
+void BasicQubitLayer<T>::applyDiffusion(const std::vector<int> &qubits)
 {
-    int finalControl{0};
-    for (int i = 0; i < numControls; i++)
-        finalControl += state.test(controls[i]);
-    return (numControls == finalControl);
+    QSIM_PROFILE_SCOPE("Diffusion");
+    unsigned long long int qubitMask{0};
+    bool validQubits = !qubits.empty();
+    for (int qubit : qubits)
+    {
+        validQubits = validQubits && qubit >= 0 && qubit < static_cast<int>(numQubits) && !(qubitMask & (1ULL << qubit));
+        qubitMask |= 1ULL << qubit;
+    }
+    if (!validQubits)
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of qubits:           " << numQubits << std::endl;
+        std::cout << "Number of diffused qubits:  " << qubits.size() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    flushDiagonals();
+    std::vector<int> bits = toPhysical(qubits);
+    // every group holding an amplitude fills up, so a sparse state that would end up dense is made dense first
+    if (qubits_ == nullptr && numQubits <= maxDenseSize() && static_cast<precision>(sparse_.size()) * (1ULL << qubits.size()) > numStates * denseOccupancy)
+        toDense();
+    if (qubits_ == nullptr)
+    {
+        kernels::applyDiffusionSparse(sparse_, bits.data(), bits.size());
+        updateRepresentation(false);
+    }
+    else
+    {
+        kernels::applyDiffusion(qubits_, numStates, bits.data(), bits.size(), numThreads_);
+        updateRepresentation(true);
+    }
 }
 
-void QubitLayer::applyCnot(int control, int target)
+template <typename T>
+void BasicQubitLayer<T>::reset()
 {
-    for (unsigned long long int i = 0; i < numStates; i++)
+    QSIM_PROFILE_SCOPE("reset");
+    mixingGates_ = 0;
+    diagonals_.clear();
+    std::iota(layout_.begin(), layout_.end(), 0);
+    if (qubits_ == nullptr)
+    {
+        sparse_.clear();
+        sparse_[0] = {1, 0};
+        return;
+    }
+#pragma omp parallel for num_threads(numThreads_) schedule(static) if (numStates >= minParallelStates)
+    for (unsigned long long int row = 0; row < numStates; row++)
+        qubits_[row] = constants<T>::zeroComplex;
+    qubits_[0] = {1, 0};
+}
+
+template <typename T>
+qProb BasicQubitLayer<T>::getMaxAmplitude()
+{
+    flushDiagonals();
+    restoreLayout();
+    qProb result{0, 0};
+    unsigned long long int maxState{0};
+    if (qubits_ == nullptr)
     {
-        if (checkZeroState(i))
+        for (const auto &amplitude : sparse_)
         {
-            std::bitset<maxQubits> state = i;
-            // flip target qubit if control bit is 1 (i.e. set)
-            if (state.test(control))
+            precision currentProb = std::norm(amplitude.second);
+            if (currentProb > result.prob || (currentProb == result.prob && amplitude.first < maxState))
             {
-                state.flip(target);
-                parity ? qOdd_[state.to_ulong()] = qEven_[i] : qEven_[state.to_ulong()] = qOdd_[i];
+                maxState = amplitude.first;
+                result.prob = currentProb;
             }
-            else
-                parity ? qOdd_[i] = qEven_[i] : qEven_[i] = qOdd_[i];
         }
+        result.state = maxState;
+        return result;
     }
-    updateLayer();
-}
-
-void QubitLayer::applyToffoli(int control1, int control2, int target)
-{
-    for (unsigned long long int i = 0; i < numStates; i++)
-        if (checkZeroState(i))
+#pragma omp parallel num_threads(numThreads_) if (numStates >= minParallelStates)
+    {
+        // find the most likely state in this thread's share of the states
+        unsigned long long int localState{0};
+        precision localProb{0};
+#pragma omp for schedule(static) nowait
+        for (unsigned long long int i = 0; i < numStates; i++)
         {
-            std::bitset<maxQubits> state = i;
-            // flip target qubit if control bits are 1 (i.e. set)
-            if (state.test(control1) && state.test(control2))
+            precision currentProb = std::norm(qubits_[i]);
+            if (currentProb > localProb)
             {
-                state.flip(target);
-                parity ? qOdd_[state.to_ulong()] = qEven_[i] : qEven_[state.to_ulong()] = qOdd_[i];
+                localState = i;
+                localProb = currentProb;
             }
-            else
-                parity ? qOdd_[i] = qEven_[i] : qEven_[i] = qOdd_[i];
         }
-    updateLayer();
+        // keep the lowest state among equally likely ones so the result does not depend on the thread count
+#pragma omp critical
+        if (localProb > result.prob || (localProb == result.prob && localProb > 0 && localState < maxState))
+        {
+            maxState = localState;
+            result.prob = localProb;
+        }
+    }
+    result.state = maxState;
+    return result;
 }
 
-void QubitLayer::applyMcnot(int *controls, int numControls, int target)
+template <typename T>
+std::map<unsigned long long int, unsigned long long int> BasicQubitLayer<T>::sample(unsigned long long int shots, std::mt19937_64 &rng)
 {
-    for (unsigned long long int i = 0; i < numStates; i++)
-        if (checkZeroState(i))
+    QSIM_PROFILE_SCOPE("sample");
+    flushDiagonals();
+    restoreLayout();
+    // cumulative probabilities of the states, or of the stored states (in ascending order) while sparse
+    std::vector<unsigned long long int> states;
+    std::vector<double> cumulative;
+    if (qubits_ == nullptr)
+    {
+        for (const auto &amplitude : sparse_)
+            states.push_back(amplitude.first);
+        std::sort(states.begin(), states.end());
+        double sum{0};
+        for (unsigned long long int state : states)
         {
-            std::bitset<maxQubits> state = i;
-            // flip target qubit if control bit(s) is 1 (i.e. set)
-            if (checkControls(controls, numControls, state))
+            sum += std::norm(sparse_[state]);
+            cumulative.push_back(sum);
+        }
+    }
+    else
+    {
+        // every thread sums its block of states, then adds the total of the blocks before it
+        cumulative.resize(numStates);
+        unsigned long long int numBlocks = numThreads_;
+        unsigned long long int blockSize = (numStates + numBlocks - 1) / numBlocks;
+        std::vector<double> offsets(numBlocks + 1, 0);
+#pragma omp parallel for num_threads(numThreads_) schedule(static, 1) if (numStates >= minParallelStates)
+        for (unsigned long long int b = 0; b < numBlocks; b++)
+        {
+            double sum{0};
+            for (unsigned long long int i = b * blockSize; i < std::min((b + 1) * blockSize, numStates); i++)
             {
-                state.flip(target);
-                parity ? qOdd_[state.to_ulong()] = qEven_[i] : qEven_[state.to_ulong()] = qOdd_[i];
+                sum += std::norm(qubits_[i]);
+                cumulative[i] = sum;
             }
-            else
-                parity ? qOdd_[i] = qEven_[i] : qEven_[i] = qOdd_[i];
+            offsets[b + 1] = sum;
         }
-    updateLayer();
+        for (unsigned long long int b = 0; b < numBlocks; b++)
+            offsets[b + 1] += offsets[b];
+#pragma omp parallel for num_threads(numThreads_) schedule(static, 1) if (numStates >= minParallelStates)
+        for (unsigned long long int b = 1; b < numBlocks; b++)
+            for (unsigned long long int i = b * blockSize; i < std::min((b + 1) * blockSize, numStates); i++)
+                cumulative[i] += offsets[b];
+    }
+    std::map<unsigned long long int, unsigned long long int> counts;
+    checkProbability(cumulative.empty() ? 0 : cumulative.back());
+    std::uniform_real_distribution<double> uniform(0, cumulative.back());
+    for (unsigned long long int shot = 0; shot < shots; shot++)
+    {
+        // the first state whose cumulative probability exceeds the random number, so states with no probability
+        // are never drawn
+        unsigned long long int drawn = std::upper_bound(cumulative.begin(), cumulative.end(), uniform(rng)) - cumulative.begin();
+        drawn = std::min<unsigned long long int>(drawn, cumulative.size() - 1);
+        counts[qubits_ == nullptr ? states[drawn] : drawn]++;
+    }
+    return counts;
 }
 
-void QubitLayer::applyCz(int control, int target)
+template <typename T>
+unsigned long long int BasicQubitLayer<T>::measure(const std::vector<int> &measured, std::mt19937_64 &rng)
 {
-    for (unsigned long long int i = 0; i < numStates; i++)
-        if (checkZeroState(i))
+    QSIM_PROFILE_SCOPE("measure");
+    flushDiagonals();
+    unsigned long long int measuredMask{0};
+    bool validQubits = !measured.empty();
+    for (int qubit : measured)
+    {
+        validQubits = validQubits && qubit >= 0 && qubit < static_cast<int>(numQubits) && !(measuredMask & (1ULL << qubit));
+        measuredMask |= 1ULL << qubit;
+    }
+    if (!validQubits)
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of qubits:           " << numQubits << std::endl;
+        std::cout << "Number of measured qubits:  " << measured.size() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    // outcomes are read from the bits the qubits are stored at
+    std::vector<int> qubits = toPhysical(measured);
+    unsigned long long int outcome{0};
+    double outcomeProb{0};
+    if (qubits_ == nullptr || qubits.size() <= maxMarginalQubits)
+    {
+        // probability of every outcome, then draw one of them
+        std::vector<unsigned long long int> outcomes;
+        std::vector<double> probs;
+        if (qubits_ == nullptr)
         {
-            std::bitset<maxQubits> state = i;
-            // add phase to target qubit if control bit and target bits are 1 (i.e. set)
-            if (state.test(control) && state.test(target))
-                parity ? qOdd_[i] = -qEven_[i] : qEven_[i] = -qOdd_[i];
+            std::map<unsigned long long int, double> outcomeProbs;
+            for (const auto &amplitude : sparse_)
+                outcomeProbs[outcomeOf(amplitude.first, qubits)] += std::norm(amplitude.second);
+            for (const auto &entry : outcomeProbs)
+            {
+                outcomes.push_back(entry.first);
+                probs.push_back(entry.second);
+            }
+        }
+        else
+        {
+            unsigned long long int numOutcomes = 1ULL << qubits.size();
+            probs.assign(numOutcomes, 0);
+            for (unsigned long long int o = 0; o < numOutcomes; o++)
+                outcomes.push_back(o);
+#pragma omp parallel num_threads(numThreads_) if (numStates >= minParallelStates)
+            {
+                std::vector<double> localProbs(numOutcomes, 0);
+#pragma omp for schedule(static) nowait
+                for (unsigned long long int i = 0; i < numStates; i++)
+                    localProbs[outcomeOf(i, qubits)] += std::norm(qubits_[i]);
+#pragma omp critical
+                for (unsigned long long int o = 0; o < numOutcomes; o++)
+                    probs[o] += localProbs[o];
+            }
+        }
+        double total{0};
+        for (double prob : probs)
+            total += prob;
+        checkProbability(total);
+        double r = std::uniform_real_distribution<double>(0, total)(rng);
+        for (unsigned long long int o = 0; o < outcomes.size(); o++)
+        {
+            if (probs[o] == 0)
+                continue;
+            outcome = outcomes[o];
+            outcomeProb = probs[o];
+            r -= probs[o];
+            if (r < 0)
+                break;
+        }
+    }
+    else
+    {
+        // too many outcomes to tabulate: draw a state, from the block of states it falls in, and take its outcome
+        unsigned long long int numBlocks = numThreads_;
+        unsigned long long int blockSize = (numStates + numBlocks - 1) / numBlocks;
+        std::vector<double> blockProbs(numBlocks, 0);
+#pragma omp parallel for num_threads(numThreads_) schedule(static, 1) if (numStates >= minParallelStates)
+        for (unsigned long long int b = 0; b < numBlocks; b++)
+            for (unsigned long long int i = b * blockSize; i < std::min((b + 1) * blockSize, numStates); i++)
+                blockProbs[b] += std::norm(qubits_[i]);
+        double total{0};
+        for (double prob : blockProbs)
+            total += prob;
+        checkProbability(total);
+        double r = std::uniform_real_distribution<double>(0, total)(rng);
+        unsigned long long int state{0};
+        for (unsigned long long int b = 0; b < numBlocks && r >= 0; b++)
+        {
+            if (r >= blockProbs[b])
+            {
+                r -= blockProbs[b];
+                continue;
+            }
+            for (unsigned long long int i = b * blockSize; i < std::min((b + 1) * blockSize, numStates) && r >= 0; i++)
+            {
+                if (std::norm(qubits_[i]) == 0)
+                    continue;
+                state = i;
+                r -= std::norm(qubits_[i]);
+            }
+            break;
+        }
+        outcome = outcomeOf(state, qubits);
+#pragma omp parallel for num_threads(numThreads_) schedule(static) reduction(+ : outcomeProb) if (numStates >= minParallelStates)
+        for (unsigned long long int i = 0; i < numStates; i++)
+            if (outcomeOf(i, qubits) == outcome)
+                outcomeProb += std::norm(qubits_[i]);
+    }
+    // keep the states matching the outcome and renormalise them in one pass
+    T scale = static_cast<T>(1 / std::sqrt(outcomeProb));
+    if (qubits_ == nullptr)
+    {
+        for (auto amplitude = sparse_.begin(); amplitude != sparse_.end();)
+        {
+            if (outcomeOf(amplitude->first, qubits) == outcome)
+            {
+                amplitude->second *= scale;
+                amplitude++;
+            }
             else
-                parity ? qOdd_[i] = qEven_[i] : qEven_[i] = qOdd_[i];
+                amplitude = sparse_.erase(amplitude);
         }
-    updateLayer();
+        return outcome;
+    }
+#pragma omp parallel for num_threads(numThreads_) schedule(static) if (numStates >= minParallelStates)
+    for (unsigned long long int i = 0; i < numStates; i++)
+        qubits_[i] = outcomeOf(i, qubits) == outcome ? qubits_[i] * scale : constants<T>::zeroComplex;
+    return outcome;
 }
 
-void QubitLayer::applyMcphase(int *controls, int numControls, int target)
+template <typename T>
+std::vector<precision> BasicQubitLayer<T>::expectation(const std::vector<PauliString> &terms)
 {
-    for (unsigned long long int i = 0; i < numStates; i++)
-        if (checkZeroState(i))
+    QSIM_PROFILE_SCOPE("expectation");
+    flushDiagonals();
+    // P|i> = i^numY (-1)^popcount(i & zMask) |i ^ xMask>, so <psi|P|psi> is i^numY times the sum over i of
+    // conj(psi[i ^ xMask]) psi[i] (-1)^popcount(i & zMask)
+    std::map<unsigned long long int, std::vector<unsigned long long int>> groups;
+    for (unsigned long long int t = 0; t < terms.size(); t++)
+    {
+        if ((terms[t].xMask | terms[t].zMask) >> numQubits)
         {
-            std::bitset<maxQubits> state = i;
-            // add phase to target qubit if control bit(s) and target bit is 1 (i.e. set)
-            if (checkControls(controls, numControls, state) && state.test(target))
-                parity ? qOdd_[i] = -qEven_[i] : qEven_[i] = -qOdd_[i];
-            else
-                parity ? qOdd_[i] = qEven_[i] : qEven_[i] = qOdd_[i];
+            std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+            std::cout << "Number of qubits:           " << numQubits << std::endl;
+            std::cout << "Pauli string X mask:        " << terms[t].xMask << std::endl;
+            std::cout << "Pauli string Z mask:        " << terms[t].zMask << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        groups[physicalIndex(terms[t].xMask)].push_back(t);
+    }
+    std::vector<precision> values(terms.size(), 0);
+    for (const auto &group : groups)
+    {
+        unsigned long long int xMask = group.first;
+        unsigned long long int numTerms = group.second.size();
+        std::vector<unsigned long long int> zMasks;
+        for (unsigned long long int t : group.second)
+            zMasks.push_back(physicalIndex(terms[t].zMask));
+        // real and imaginary parts are summed separately so the loop over the terms vectorises
+        std::vector<double> sumRe(numTerms, 0);
+        std::vector<double> sumIm(numTerms, 0);
+        if (qubits_ == nullptr)
+        {
+            for (const auto &amplitude : sparse_)
+            {
+                auto partner = sparse_.find(amplitude.first ^ xMask);
+                if (partner == sparse_.end())
+                    continue;
+                std::complex<double> product = std::conj(std::complex<double>(partner->second)) * std::complex<double>(amplitude.second);
+                for (unsigned long long int t = 0; t < numTerms; t++)
+                {
+                    double sign = 1 - 2 * (__builtin_popcountll(amplitude.first & zMasks[t]) & 1);
+                    sumRe[t] += sign * product.real();
+                    sumIm[t] += sign * product.imag();
+                }
+            }
+        }
+        else
+        {
+#pragma omp parallel num_threads(numThreads_) if (numStates >= minParallelStates)
+            {
+                std::vector<double> localRe(numTerms, 0);
+                std::vector<double> localIm(numTerms, 0);
+#pragma omp for schedule(static) nowait
+                for (unsigned long long int i = 0; i < numStates; i++)
+                {
+                    std::complex<double> product = std::conj(std::complex<double>(qubits_[i ^ xMask])) * std::complex<double>(qubits_[i]);
+                    for (unsigned long long int t = 0; t < numTerms; t++)
+                    {
+                        double sign = 1 - 2 * (__builtin_popcountll(i & zMasks[t]) & 1);
+                        localRe[t] += sign * product.real();
+                        localIm[t] += sign * product.imag();
+                    }
+                }
+#pragma omp critical
+                for (unsigned long long int t = 0; t < numTerms; t++)
+                {
+                    sumRe[t] += localRe[t];
+                    sumIm[t] += localIm[t];
+                }
+            }
+        }
+        // real part of i^numY times the sum, which is all there is for a Hermitian term
+        for (unsigned long long int t = 0; t < numTerms; t++)
+        {
+            const PauliString &term = terms[group.second[t]];
+            double parts[4]{sumRe[t], -sumIm[t], -sumRe[t], sumIm[t]};
+            values[group.second[t]] = term.coefficient * parts[__builtin_popcountll(term.xMask & term.zMask) & 3];
         }
-    updateLayer();
+    }
+    return values;
 }
 
-qProb QubitLayer::getMaxAmplitude()
+template <typename T>
+void BasicQubitLayer<T>::save(const std::string &path, bool compress)
 {
-    std::bitset<maxQubits> state;
-    qProb result;
-    precision currentProb{0};
-    precision previousProb{0};
-    for (unsigned long long int i = 0; i < numStates; i++)
+    QSIM_PROFILE_SCOPE("save");
+    flushDiagonals();
+    restoreLayout();
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        checkpointError(path, "cannot be created");
+    CheckpointHeader header{};
+    std::memcpy(header.magic, checkpointMagic, sizeof(header.magic));
+    header.version = checkpointVersion;
+    header.numQubits = numQubits;
+    header.precisionBytes = sizeof(T);
+    header.ordering = checkpointQubitOrdering;
+    header.compressed = compress;
+    header.blockStates = std::min(checkpointBlockStates, numStates);
+    if (lseek(fd, checkpointDataOffset, SEEK_SET) < 0)
+        checkpointError(path, "seek failed");
+    header.checksum = checksumSeed;
+    auto append = [&](const void *data, unsigned long long int numBytes)
+    {
+        writeAll(fd, data, numBytes, path);
+        header.checksum = checksumOf(data, numBytes, header.checksum);
+        header.dataBytes += numBytes;
+    };
+    unsigned long long int blockBytes = header.blockStates * sizeof(std::complex<T>);
+    if (qubits_ != nullptr)
+    {
+        if (!compress)
+            append(qubits_, numStates * sizeof(std::complex<T>));
+        else
+            for (std::uint64_t block = 0; block < numStates / header.blockStates; block++)
+            {
+                const std::complex<T> *amplitudes = qubits_ + block * header.blockStates;
+                if (std::none_of(amplitudes, amplitudes + header.blockStates,
+                                 [](const std::complex<T> &a) { return a != constants<T>::zeroComplex; }))
+                    continue;
+                append(&block, sizeof(block));
+                append(amplitudes, blockBytes);
+            }
+    }
+    else
     {
-        state = i;
-        currentProb = parity ? abs(qEven_[i]) * abs(qEven_[i]) : abs(qOdd_[i]) * abs(qOdd_[i]);
-        if (currentProb > previousProb)
+        // the blocks of a sparse state are filled from its amplitudes in index order
+        std::vector<std::pair<unsigned long long int, std::complex<T>>> entries(sparse_.begin(), sparse_.end());
+        std::sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+        std::vector<std::complex<T>> amplitudes(header.blockStates);
+        auto entry = entries.begin();
+        for (std::uint64_t block = 0; block < numStates / header.blockStates; block++)
         {
-            result.state = state;
-            result.prob = currentProb;
-            previousProb = currentProb;
+            if (compress && (entry == entries.end() || entry->first / header.blockStates != block))
+            {
+                if (entry == entries.end())
+                    break;
+                block = entry->first / header.blockStates;
+            }
+            std::fill(amplitudes.begin(), amplitudes.end(), constants<T>::zeroComplex);
+            for (; entry != entries.end() && entry->first / header.blockStates == block; entry++)
+                amplitudes[entry->first % header.blockStates] = entry->second;
+            if (compress)
+                append(&block, sizeof(block));
+            append(amplitudes.data(), blockBytes);
         }
     }
-    return result;
+    if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header) || close(fd) != 0)
+        checkpointError(path, "write failed");
 }
 
-void QubitLayer::toggleParity()
+template <typename T>
+void BasicQubitLayer<T>::load(const std::string &path)
 {
-    parity = !parity;
+    QSIM_PROFILE_SCOPE("load");
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat status;
+    CheckpointHeader header{};
+    if (fd < 0 || fstat(fd, &status) != 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header))
+        checkpointError(path, "cannot be read");
+    unsigned long long int fileBytes = status.st_size;
+    if (std::memcmp(header.magic, checkpointMagic, sizeof(header.magic)) != 0)
+        checkpointError(path, "not a checkpoint");
+    if (header.version > checkpointVersion)
+        checkpointError(path, "unsupported version " + std::to_string(header.version));
+    if (header.numQubits > maxQubits || (header.precisionBytes != sizeof(float) && header.precisionBytes != sizeof(double)) ||
+        header.ordering != checkpointQubitOrdering || header.blockStates == 0 || header.blockStates > (1ULL << header.numQubits))
+        checkpointError(path, "invalid header");
+    unsigned long long int ampBytes = 2 * header.precisionBytes;
+    unsigned long long int fileStates = 1ULL << header.numQubits;
+    unsigned long long int blockBytes = sizeof(std::uint64_t) + header.blockStates * ampBytes;
+    if (header.dataBytes != fileBytes - checkpointDataOffset || fileBytes < checkpointDataOffset ||
+        (header.compressed ? header.dataBytes % blockBytes != 0 : header.dataBytes != fileStates * ampBytes))
+        checkpointError(path, "truncated");
+    // the whole file is mapped copy-on-write, reading it through the mapping loads it in the page cache only once
+    void *mapped = mmap(nullptr, fileBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        checkpointError(path, "cannot be mapped");
+    const char *data = static_cast<const char *>(mapped) + checkpointDataOffset;
+    if (checksumOf(data, header.dataBytes, checksumSeed) != header.checksum)
+    {
+        munmap(mapped, fileBytes);
+        checkpointError(path, "checksum mismatch");
+    }
+
+    releaseDense();
+    basicSparseLayer<T>().swap(sparse_);
+    diagonals_.clear();
+    numQubits = header.numQubits;
+    numStates = fileStates;
+    mixingGates_ = 0;
+    layout_.resize(numQubits);
+    std::iota(layout_.begin(), layout_.end(), 0);
+    if (!header.compressed && header.precisionBytes == sizeof(T))
+    {
+        qubits_ = reinterpret_cast<std::complex<T> *>(const_cast<char *>(data));
+        checkpoint_ = mapped;
+        checkpointBytes_ = fileBytes;
+        return;
+    }
+    auto amplitudeAt = [&](const char *amplitudes, unsigned long long int i)
+    {
+        if (header.precisionBytes == sizeof(float))
+            return std::complex<T>(reinterpret_cast<const std::complex<float> *>(amplitudes)[i]);
+        return std::complex<T>(reinterpret_cast<const std::complex<double> *>(amplitudes)[i]);
+    };
+    if (!header.compressed)
+    {
+        allocateDense(nullptr);
+#pragma omp parallel for num_threads(numThreads_) schedule(static) if (numStates >= minParallelStates)
+        for (unsigned long long int row = 0; row < numStates; row++)
+            qubits_[row] = amplitudeAt(data, row);
+    }
+    else
+    {
+        // blocks are decompressed straight into a dense state if it would be dense anyway, otherwise into a sparse one
+        unsigned long long int numBlocks = header.dataBytes / blockBytes;
+        bool dense = numQubits <= maxDenseSize() && numBlocks * header.blockStates > numStates * denseOccupancy;
+        if (dense)
+            allocateDense(nullptr);
+        for (unsigned long long int b = 0; b < numBlocks; b++)
+        {
+            const char *block = data + b * blockBytes;
+            std::uint64_t blockNumber;
+            std::memcpy(&blockNumber, block, sizeof(blockNumber));
+            if (blockNumber >= numStates / header.blockStates)
+            {
+                releaseDense();
+                munmap(mapped, fileBytes);
+                checkpointError(path, "invalid block number");
+            }
+            unsigned long long int first = blockNumber * header.blockStates;
+            for (unsigned long long int i = 0; i < header.blockStates; i++)
+            {
+                std::complex<T> amplitude = amplitudeAt(block + sizeof(std::uint64_t), i);
+                if (dense)
+                    qubits_[first + i] = amplitude;
+                else if (std::abs(amplitude) >= constants<T>::sparseZero)
+                    sparse_[first + i] = amplitude;
+            }
+        }
+        if (!dense)
+            updateRepresentation(false);
+    }
+    munmap(mapped, fileBytes);
 }
 
-void QubitLayer::printMeasurement()
+template <typename T>
+void BasicQubitLayer<T>::printMeasurement()
 {
     qProb q = getMaxAmplitude();
-    std::cout << "Measurement outcome:        |" << q.state << ">" << std::endl;
+    std::cout << "Measurement outcome:        |" << binaryString(q.state.to_ullong(), numQubits) << ">" << std::endl;
     std::cout << "Probability of outcome:     " << q.prob << std::endl;
 }
 
-void QubitLayer::printQubits()
+template <typename T>
+void BasicQubitLayer<T>::printQubits()
 {
+    flushDiagonals();
+    restoreLayout();
     std::cout << "Amplitude, "
               << "State \n";
+    if (qubits_ == nullptr)
+    {
+        std::vector<unsigned long long int> states;
+        for (const auto &amplitude : sparse_)
+            states.push_back(amplitude.first);
+        std::sort(states.begin(), states.end());
+        for (unsigned long long int i : states)
+            std::cout << sparse_[i] << " |" << binaryString(i, numQubits) << ">\n";
+        return;
+    }
     for (unsigned long long int i = 0; i < numStates; i++)
     {
-        std::bitset<maxQubits> binaryRep = i;
-        std::string state = binaryRep.to_string();
-        std::cout << qEven_[i] << " " << qOdd_[i] << " ";
-        std::cout << "|" << state << ">\n";
+        std::cout << qubits_[i] << " ";
+        std::cout << "|" << binaryString(i, numQubits) << ">\n";
     }
 }
 
-qubitLayer *QubitLayer::getQubitLayerEven()
+template <typename T>
+std::complex<T> *BasicQubitLayer<T>::getQubitLayer()
 {
-    return qEven_;
+    getPhysicalQubitLayer();
+    restoreLayout();
+    return qubits_;
 }
 
-qubitLayer *QubitLayer::getQubitLayerOdd()
+template <typename T>
+std::complex<T> *BasicQubitLayer<T>::getPhysicalQubitLayer()
 {
-    return qOdd_;
+    flushDiagonals();
+    if (qubits_ == nullptr)
+    {
+        if (numQubits > maxDenseSize())
+        {
+            std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+            std::cout << "Number of qubits:           " << numQubits << std::endl;
+            std::cout << "Max number of dense qubits: " << maxDenseSize() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        toDense();
+    }
+    return qubits_;
 }
 
-unsigned long long int QubitLayer::getNumStates() { return numStates; }
+template <typename T>
+const std::vector<int> &BasicQubitLayer<T>::getLayout() { return layout_; }
+
+template <typename T>
+unsigned long long int BasicQubitLayer<T>::getNumStates() { return numStates; }
+
+template <typename T>
+unsigned int BasicQubitLayer<T>::getNumQubits() { return numQubits; }
 
-unsigned int QubitLayer::getNumQubits() { return numQubits; }
\ No newline at end of file
+template class BasicQubitLayer<float>;
+template class BasicQubitLayer<double>;
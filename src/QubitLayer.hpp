@@ -1,7 +1,14 @@
 #ifndef QUBITLAYER_H
 #define QUBITLAYER_H
 #include <bitset>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
 #include "definitions.hpp"
+#include "kernels.hpp"
+#include "allocator.hpp"
 
 struct qProb
 {
@@ -9,41 +16,214 @@ struct qProb
     precision prob;
 };
 
-class QubitLayer
+// tensor product of Pauli operators times a real coefficient, qubit j being acted on by X if only bit j of xMask
+// is set, by Z if only bit j of zMask is set and by Y if both are set
+struct PauliString
+{
+    unsigned long long int xMask;
+    unsigned long long int zMask;
+    precision coefficient;
+};
+
+/**
+ * Makes a PauliString from a string of I, X, Y and Z characters, character j acting on qubit j.
+ */
+PauliString pauliString(const std::string &paulis, precision coefficient = 1);
+
+/**
+ * State vector of numQubits qubits with amplitudes of scalar type T, which is float or double. Single precision
+ * halves the memory and bandwidth used by the gates.
+ */
+template <typename T>
+class BasicQubitLayer
 {
 public:
-    QubitLayer(unsigned int numQubits, qubitLayer *qL = nullptr);
-    ~QubitLayer();
+    /**
+     * @param numQubits   number of qubits, at most maxQubits
+     * @param qL          initial amplitudes, the state starts as |0> if none are given
+     * @param storageFile if not empty, the dense state is kept in a memory-mapped file at this path (e.g. on
+     *                    local NVMe) instead of in memory, which allows up to maxMappedQubits qubits. The file
+     *                    is removed when the state is released
+     */
+    BasicQubitLayer(unsigned int numQubits, std::complex<T> *qL = nullptr, const std::string &storageFile = "");
+    ~BasicQubitLayer();
+    /**
+     * States own their amplitudes (or the file they are mapped from), so they can be moved but not copied. A copy
+     * is made explicitly by passing the amplitudes of a state to the constructor. A moved-from state can only be
+     * destroyed or assigned to.
+     */
+    BasicQubitLayer(BasicQubitLayer &&other) noexcept;
+    BasicQubitLayer &operator=(BasicQubitLayer &&other) noexcept;
+    BasicQubitLayer(const BasicQubitLayer &) = delete;
+    BasicQubitLayer &operator=(const BasicQubitLayer &) = delete;
     void applyPauliX(int target);
     void applyPauliY(int target);
     void applyPauliZ(int target);
     void applyHadamard(int target);
-    void applyRx(int target, precision theta);
-    void applyRy(int target, precision theta);
-    void applyRz(int target, precision theta);
+    void applyRx(int target, T theta);
+    void applyRy(int target, T theta);
+    void applyRz(int target, T theta);
     void applyCnot(int control, int target);
     void applyToffoli(int control1, int control2, int target);
     void applyMcnot(int *controls, int numControls, int target);
     void applyCz(int control, int target);
     void applyMcphase(int *controls, int numControls, int target);
+    /**
+     * Swaps two qubits without moving any amplitude: the qubits are only relabelled, so the following gates on one
+     * of them act on the bit of the state index the other one was stored at. The amplitudes are put back in order
+     * when they are read out (getQubitLayer, printQubits, sample, getMaxAmplitude and save).
+     */
+    void applySwap(int qubit1, int qubit2);
+    /**
+     * Moves qubit j to qubit permutation[j] for every j, by relabelling them like applySwap.
+     */
+    void permuteQubits(const std::vector<int> &permutation);
+    /**
+     * Applies a 2^k x 2^k unitary to k target qubits, optionally controlled by other qubits.
+     * The matrix is classified (diagonal, permutation, real or dense) and applied with the cheapest kernel. Diagonal
+     * gates (e.g. Z, Rz, CZ and multi-controlled phases) commute, so they are only collected, up to maxDiagonalGates
+     * of them, and applied together in a single pass when the next other gate or readout needs the amplitudes.
+     * @param targets  target qubits, targets[j] is bit j of the row and column numbers of the matrix
+     * @param matrix   row-major matrix with 4^k entries
+     * @param controls qubits that must all be 1 (i.e. set) for the matrix to be applied
+     */
+    void applyUnitary(const std::vector<int> &targets, const std::vector<std::complex<T>> &matrix, const std::vector<int> &controls = {});
+    /**
+     * Applies the collected diagonal gates now, e.g. so that a timed run or a circuit includes their pass.
+     */
+    void flushDiagonals();
+    /**
+     * Flips the sign of the amplitudes of the marked states, which costs one write per marked state.
+     * @param marked indices of the marked states
+     */
+    void applyPhaseOracle(const std::vector<unsigned long long int> &marked);
+    /**
+     * Flips the sign of the amplitudes of the states the predicate accepts, in a single pass over the states.
+     * @param predicate called with every state index, concurrently from several threads
+     */
+    void applyPhaseOracle(const std::function<bool(unsigned long long int)> &predicate);
+    /**
+     * Applies the Grover diffusion operator 2|s><s| - I to some qubits, |s> being their uniform superposition, as an
+     * inversion about the mean: a reduction then an update pass, instead of 2k Hadamard and X layers and a
+     * multi-controlled phase for k qubits.
+     * @param qubits qubits to diffuse, usually all of them
+     */
+    void applyDiffusion(const std::vector<int> &qubits);
+    /**
+     * Returns to |0>, keeping the dense array if there is one so that a state can be reused without allocating.
+     */
+    void reset();
     qProb getMaxAmplitude();
     void printMeasurement();
+    /**
+     * Draws shots from the probability distribution of the states without changing the state. A table of
+     * cumulative probabilities is built once (with a parallel prefix sum), then each shot is a binary search.
+     * @param shots number of shots
+     * @param rng   random number generator the shots are drawn with
+     * @return number of times each state was drawn, by state index
+     */
+    std::map<unsigned long long int, unsigned long long int> sample(unsigned long long int shots, std::mt19937_64 &rng);
+    /**
+     * Measures some qubits, collapsing the state onto the outcome and renormalising it.
+     * @param qubits qubits to measure
+     * @param rng    random number generator the outcome is drawn with
+     * @return outcome, bit j being the value measured for qubits[j]
+     */
+    unsigned long long int measure(const std::vector<int> &qubits, std::mt19937_64 &rng);
+    /**
+     * Computes the expectation value <psi|P|psi> of every Pauli string P without changing the state. Terms with
+     * the same X and Y qubits pair up the same amplitudes, so each group of such terms costs a single read-only
+     * pass over the state, the Z and Y qubits only giving a parity sign per term.
+     * @return expectation value of every term, including its coefficient
+     */
+    std::vector<precision> expectation(const std::vector<PauliString> &terms);
+    /**
+     * Writes the state to a binary checkpoint: a versioned header (number of qubits, precision, qubit ordering and
+     * a checksum of the data) followed by the amplitudes at a page-aligned offset.
+     * @param path     checkpoint file, overwritten if it exists
+     * @param compress if true, only the blocks of checkpointBlockStates amplitudes that hold a non-zero amplitude
+     *                 are written, each after its block number, which keeps checkpoints of sparse states small
+     */
+    void save(const std::string &path, bool compress = false);
+    /**
+     * Replaces the state with the one saved in a checkpoint, whatever its number of qubits. An uncompressed
+     * checkpoint of the same precision is mapped copy-on-write and used as the dense state without being copied:
+     * gates only copy the pages they write to and the file is never modified, so several runs can restart from the
+     * same checkpoint. Compressed checkpoints and checkpoints of the other precision are read into a new state.
+     * @param path checkpoint file written by save
+     */
+    void load(const std::string &path);
+    /**
+     * Prints every amplitude with its state, or only the non-zero ones while the state is sparse.
+     */
     void printQubits();
-    qubitLayer *getQubitLayerEven();
-    qubitLayer *getQubitLayerOdd();
+    /**
+     * Returns the dense array of amplitudes, converting a sparse state first and moving relabelled qubits back to
+     * their bit of the state index (a pass over the state per misplaced qubit). The pointer is only valid until
+     * the next gate, which may switch the state back to sparse.
+     */
+    std::complex<T> *getQubitLayer();
+    /**
+     * Same as getQubitLayer but leaves the qubits where they are, qubit j being bit getLayout()[j] of a state index.
+     */
+    std::complex<T> *getPhysicalQubitLayer();
+    /**
+     * Returns the bit of the state index each qubit is stored at.
+     */
+    const std::vector<int> &getLayout();
+    /**
+     * Moves the amplitudes so that a qubit is stored at some bit of the state index, the qubit stored there taking
+     * its old bit, e.g. to bring the qubits of the next gates into a cache-sized chunk. This is a pass over the state,
+     * which is unchanged.
+     * @param qubit    qubit to move
+     * @param position bit of the state index it is stored at afterwards
+     */
+    void relocateQubit(int qubit, int position);
+    /**
+     * Returns true while only the non-zero amplitudes are stored. New states start sparse and become dense once
+     * more than denseOccupancy of their amplitudes are non-zero (never above maxDenseQubits qubits, or
+     * maxMappedQubits for a memory-mapped state), and dense states become sparse again once fewer than
+     * sparseOccupancy of their amplitudes are non-zero.
+     */
+    bool isSparse();
+    /**
+     * Returns true if the state is kept in a memory-mapped file whenever it is dense.
+     */
+    bool isMapped();
     unsigned long long int getNumStates();
     unsigned int getNumQubits();
+    void setNumThreads(int numThreads);
+    int getNumThreads();
 
 private:
-    bool checkControls(int *controls, int numControls, std::bitset<maxQubits> state);
-    bool checkZeroState(int qubit);
-    void updateLayer();
-    void toggleParity();
+    void allocateDense(const std::complex<T> *qL);
+    void releaseDense();
+    unsigned int maxDenseSize();
+    void toDense();
+    void toSparse();
+    unsigned long long int countNonZero();
+    void updateRepresentation(bool mixing);
+    void swapBits(int bit1, int bit2);
+    void restoreLayout();
+    std::vector<int> toPhysical(const std::vector<int> &qubits);
+    unsigned long long int physicalIndex(unsigned long long int index);
+    unsigned long long int logicalIndex(unsigned long long int index);
+    bool isRelabelled();
     unsigned int numQubits;
     unsigned long long int numStates;
-    qubitLayer *qEven_;
-    qubitLayer *qOdd_;
-    bool parity = true;
+    std::complex<T> *qubits_ = nullptr; // dense amplitudes, nullptr while the state is sparse
+    memory::Allocator *allocator_ = nullptr; // allocator the dense amplitudes in memory came from
+    std::string storageFile_;
+    void *checkpoint_ = nullptr; // checkpoint file mapped copy-on-write, qubits_ points into it after a load
+    unsigned long long int checkpointBytes_ = 0;
+    basicSparseLayer<T> sparse_;
+    unsigned int mixingGates_ = 0; // mixing gates applied since the last occupancy check
+    std::vector<kernels::DiagonalGate<T>> diagonals_; // diagonal gates not applied yet, on bits of the state index
+    std::vector<int> layout_; // bit of the state index each qubit is stored at
+    int numThreads_ = 1;
 };
 
+typedef BasicQubitLayer<precision> QubitLayer;
+typedef BasicQubitLayer<float> QubitLayerF;
+
 #endif
\ No newline at end of file
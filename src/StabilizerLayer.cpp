@@ -0,0 +1,271 @@
+#include <iostream>
+#include "StabilizerLayer.hpp"
+#include "profiler.hpp"
+
+StabilizerLayer::StabilizerLayer(unsigned int numQubits) : numQubits(numQubits), numWords((numQubits + 63) / 64)
+{
+    x_.resize((2ULL * numQubits + 1) * numWords);
+    z_.resize((2ULL * numQubits + 1) * numWords);
+    r_.resize(2ULL * numQubits + 1);
+    reset();
+}
+
+void StabilizerLayer::reset()
+{
+    // |0> is stabilized by Z on every qubit, and destabilized by X
+    std::fill(x_.begin(), x_.end(), 0);
+    std::fill(z_.begin(), z_.end(), 0);
+    std::fill(r_.begin(), r_.end(), 0);
+    for (unsigned int qubit = 0; qubit < numQubits; qubit++)
+    {
+        x_[qubit * numWords + qubit / 64] |= 1ULL << (qubit % 64);
+        z_[(numQubits + qubit) * numWords + qubit / 64] |= 1ULL << (qubit % 64);
+    }
+}
+
+void StabilizerLayer::checkQubit(int qubit)
+{
+    if (qubit < 0 || qubit >= static_cast<int>(numQubits))
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of qubits:           " << numQubits << std::endl;
+        std::cout << "Qubit:                      " << qubit << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+// a Pauli gate flips the sign of the generators it anticommutes with
+
+void StabilizerLayer::applyPauliX(int target)
+{
+    QSIM_PROFILE_SCOPE("tableau PauliX");
+    checkQubit(target);
+    for (unsigned long long int row = 0; row < 2ULL * numQubits; row++)
+        r_[row] ^= z(row, target);
+}
+
+void StabilizerLayer::applyPauliY(int target)
+{
+    QSIM_PROFILE_SCOPE("tableau PauliY");
+    checkQubit(target);
+    for (unsigned long long int row = 0; row < 2ULL * numQubits; row++)
+        r_[row] ^= x(row, target) ^ z(row, target);
+}
+
+void StabilizerLayer::applyPauliZ(int target)
+{
+    QSIM_PROFILE_SCOPE("tableau PauliZ");
+    checkQubit(target);
+    for (unsigned long long int row = 0; row < 2ULL * numQubits; row++)
+        r_[row] ^= x(row, target);
+}
+
+void StabilizerLayer::applyHadamard(int target)
+{
+    QSIM_PROFILE_SCOPE("tableau Hadamard");
+    checkQubit(target);
+    // swaps X and Z, Y becoming -Y
+    std::uint64_t mask = 1ULL << (target % 64);
+    for (unsigned long long int row = 0; row < 2ULL * numQubits; row++)
+    {
+        std::uint64_t &xWord = x_[row * numWords + target / 64];
+        std::uint64_t &zWord = z_[row * numWords + target / 64];
+        r_[row] ^= ((xWord & zWord) >> (target % 64)) & 1;
+        std::uint64_t flip = (xWord ^ zWord) & mask;
+        xWord ^= flip;
+        zWord ^= flip;
+    }
+}
+
+void StabilizerLayer::applyCnot(int control, int target)
+{
+    QSIM_PROFILE_SCOPE("tableau CNOT");
+    checkQubit(control);
+    checkQubit(target);
+    // X on the control spreads to the target and Z on the target spreads to the control
+    for (unsigned long long int row = 0; row < 2ULL * numQubits; row++)
+    {
+        bool xc = x(row, control), zc = z(row, control), xt = x(row, target), zt = z(row, target);
+        r_[row] ^= xc && zt && (xt == zc);
+        x_[row * numWords + target / 64] ^= static_cast<std::uint64_t>(xc) << (target % 64);
+        z_[row * numWords + control / 64] ^= static_cast<std::uint64_t>(zt) << (control % 64);
+    }
+}
+
+void StabilizerLayer::applyCz(int control, int target)
+{
+    QSIM_PROFILE_SCOPE("tableau CZ");
+    checkQubit(control);
+    checkQubit(target);
+    // X on either qubit picks up Z on the other one
+    for (unsigned long long int row = 0; row < 2ULL * numQubits; row++)
+    {
+        bool xc = x(row, control), zc = z(row, control), xt = x(row, target), zt = z(row, target);
+        r_[row] ^= xc && xt && (zc != zt);
+        z_[row * numWords + control / 64] ^= static_cast<std::uint64_t>(xt) << (control % 64);
+        z_[row * numWords + target / 64] ^= static_cast<std::uint64_t>(xc) << (target % 64);
+    }
+}
+
+void StabilizerLayer::applySwap(int qubit1, int qubit2)
+{
+    QSIM_PROFILE_SCOPE("tableau SWAP");
+    checkQubit(qubit1);
+    checkQubit(qubit2);
+    // the columns of the two qubits trade places, the signs are unchanged
+    for (unsigned long long int row = 0; row < 2ULL * numQubits; row++)
+    {
+        bool x1 = x(row, qubit1), z1 = z(row, qubit1), x2 = x(row, qubit2), z2 = z(row, qubit2);
+        x_[row * numWords + qubit1 / 64] ^= static_cast<std::uint64_t>(x1 != x2) << (qubit1 % 64);
+        x_[row * numWords + qubit2 / 64] ^= static_cast<std::uint64_t>(x1 != x2) << (qubit2 % 64);
+        z_[row * numWords + qubit1 / 64] ^= static_cast<std::uint64_t>(z1 != z2) << (qubit1 % 64);
+        z_[row * numWords + qubit2 / 64] ^= static_cast<std::uint64_t>(z1 != z2) << (qubit2 % 64);
+    }
+}
+
+void StabilizerLayer::rowCopy(unsigned long long int target, unsigned long long int source)
+{
+    std::copy(x_.begin() + source * numWords, x_.begin() + (source + 1) * numWords, x_.begin() + target * numWords);
+    std::copy(z_.begin() + source * numWords, z_.begin() + (source + 1) * numWords, z_.begin() + target * numWords);
+    r_[target] = r_[source];
+    if (!signMasks_.empty())
+        signMasks_[target] = signMasks_[source];
+}
+
+void StabilizerLayer::rowMultiply(unsigned long long int target, unsigned long long int source)
+{
+    // the product of the Pauli strings picks up a factor i or -i on every qubit where they anticommute, which is
+    // counted word by word: source X times target Z gives iY, source X times target Y gives iZ and so on
+    long long int phase = 2 * (r_[target] + r_[source]);
+    for (unsigned long long int w = 0; w < numWords; w++)
+    {
+        std::uint64_t x1 = x_[source * numWords + w], z1 = z_[source * numWords + w];
+        std::uint64_t x2 = x_[target * numWords + w], z2 = z_[target * numWords + w];
+        std::uint64_t plus = (x1 & z1 & z2 & ~x2) | (x1 & ~z1 & x2 & z2) | (~x1 & z1 & x2 & ~z2);
+        std::uint64_t minus = (x1 & z1 & x2 & ~z2) | (x1 & ~z1 & z2 & ~x2) | (~x1 & z1 & x2 & z2);
+        phase += __builtin_popcountll(plus) - __builtin_popcountll(minus);
+        x_[target * numWords + w] = x1 ^ x2;
+        z_[target * numWords + w] = z1 ^ z2;
+    }
+    // the product of two commuting generators is real, so the phase is 0 or 2 (mod 4)
+    r_[target] = ((phase % 4) + 4) % 4 == 2;
+    // an unknown sign adds 2 to the phase when it is set, so the unknowns of the product are XORed
+    if (!signMasks_.empty())
+        signMasks_[target] ^= signMasks_[source];
+}
+
+// while sampling, mask holds the bit of the next unknown random outcome, which a random outcome is left as instead of
+// being drawn, and returns the unknowns the outcome is XORed with
+bool StabilizerLayer::measureQubit(int qubit, std::mt19937_64 &rng, std::uint64_t *mask)
+{
+    // the outcome is random if a stabilizer anticommutes with Z on the qubit, i.e. has X or Y on it
+    unsigned long long int pivot = numQubits;
+    while (pivot < 2ULL * numQubits && !x(pivot, qubit))
+        pivot++;
+    if (pivot < 2ULL * numQubits)
+    {
+        for (unsigned long long int row = 0; row < 2ULL * numQubits; row++)
+            if (row != pivot && x(row, qubit))
+                rowMultiply(row, pivot);
+        // the pivot becomes a destabilizer and +-Z on the qubit replaces it as a stabilizer
+        rowCopy(pivot - numQubits, pivot);
+        std::fill(x_.begin() + pivot * numWords, x_.begin() + (pivot + 1) * numWords, 0);
+        std::fill(z_.begin() + pivot * numWords, z_.begin() + (pivot + 1) * numWords, 0);
+        z_[pivot * numWords + qubit / 64] = 1ULL << (qubit % 64);
+        if (mask != nullptr)
+        {
+            r_[pivot] = 0;
+            signMasks_[pivot] = *mask;
+            return false;
+        }
+        r_[pivot] = rng() & 1;
+        return r_[pivot];
+    }
+    // otherwise +-Z on the qubit is the product of the stabilizers whose destabilizer has X or Y on it
+    unsigned long long int scratch = 2ULL * numQubits;
+    std::fill(x_.begin() + scratch * numWords, x_.end(), 0);
+    std::fill(z_.begin() + scratch * numWords, z_.end(), 0);
+    r_[scratch] = 0;
+    if (mask != nullptr)
+        signMasks_[scratch] = 0;
+    for (unsigned long long int row = 0; row < numQubits; row++)
+        if (x(row, qubit))
+            rowMultiply(scratch, row + numQubits);
+    if (mask != nullptr)
+        *mask = signMasks_[scratch];
+    return r_[scratch];
+}
+
+bool StabilizerLayer::isDeterministic(int qubit)
+{
+    checkQubit(qubit);
+    for (unsigned long long int row = numQubits; row < 2ULL * numQubits; row++)
+        if (x(row, qubit))
+            return false;
+    return true;
+}
+
+unsigned long long int StabilizerLayer::measure(const std::vector<int> &qubits, std::mt19937_64 &rng)
+{
+    QSIM_PROFILE_SCOPE("tableau measure");
+    if (qubits.size() > 64)
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of measured qubits:  " << qubits.size() << std::endl;
+        std::cout << "Max measured per call:      " << 64 << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    unsigned long long int outcome{0};
+    for (unsigned long long int j = 0; j < qubits.size(); j++)
+    {
+        checkQubit(qubits[j]);
+        outcome |= static_cast<unsigned long long int>(measureQubit(qubits[j], rng)) << j;
+    }
+    return outcome;
+}
+
+std::map<unsigned long long int, unsigned long long int> StabilizerLayer::sample(const std::vector<int> &qubits, unsigned long long int shots,
+                                                                                 std::mt19937_64 &rng)
+{
+    QSIM_PROFILE_SCOPE("tableau sample");
+    if (qubits.size() > 64)
+    {
+        std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+        std::cout << "Number of measured qubits:  " << qubits.size() << std::endl;
+        std::cout << "Max measured per call:      " << 64 << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    // measure a copy once, outcome j being constant bit j XORed with the unknown random outcomes of masks[j]
+    StabilizerLayer copy(*this);
+    copy.signMasks_.assign(r_.size(), 0);
+    std::vector<std::uint64_t> masks(qubits.size());
+    unsigned long long int constant{0};
+    int numRandom{0};
+    for (unsigned long long int j = 0; j < qubits.size(); j++)
+    {
+        checkQubit(qubits[j]);
+        std::uint64_t next = 1ULL << numRandom;
+        masks[j] = next;
+        constant |= static_cast<unsigned long long int>(copy.measureQubit(qubits[j], rng, &masks[j])) << j;
+        // no sign depends on the next unknown before it is drawn, so the outcome is random exactly when it is its own unknown
+        if (masks[j] == next)
+            numRandom++;
+    }
+    // the outcomes flipped by each unknown, so that a shot XORs those of the unknowns it draws as 1
+    std::vector<unsigned long long int> flips(numRandom, 0);
+    for (unsigned long long int j = 0; j < qubits.size(); j++)
+        for (int k = 0; k < numRandom; k++)
+            flips[k] |= static_cast<unsigned long long int>((masks[j] >> k) & 1) << j;
+    std::map<unsigned long long int, unsigned long long int> counts;
+    for (unsigned long long int shot = 0; shot < shots; shot++)
+    {
+        std::uint64_t bits = numRandom == 0 ? 0 : rng();
+        unsigned long long int outcome = constant;
+        for (int k = 0; k < numRandom; k++)
+            outcome ^= flips[k] & (0 - ((bits >> k) & 1));
+        counts[outcome]++;
+    }
+    return counts;
+}
+
+unsigned int StabilizerLayer::getNumQubits() { return numQubits; }
@@ -0,0 +1,76 @@
+#ifndef STABILIZERLAYER_H
+#define STABILIZERLAYER_H
+#include <cstdint>
+#include <map>
+#include <random>
+#include <vector>
+#include "definitions.hpp"
+
+/**
+ * Stabilizer state of numQubits qubits, which can only be acted on by Clifford gates (Pauli, Hadamard, CNOT, CZ and SWAP).
+ * The state is stored as the tableau of Aaronson and Gottesman: n destabilizer and n stabilizer generators, each a
+ * Pauli string with a sign, packed 64 qubits per word. A gate updates one or two columns of the tableau, i.e. O(n)
+ * bit operations, and a measurement multiplies rows together, i.e. O(n^2 / 64) word operations, so circuits on
+ * thousands of qubits need neither 2^n memory nor 2^n time.
+ */
+class StabilizerLayer
+{
+public:
+    /**
+     * @param numQubits number of qubits, the state starts as |0>
+     */
+    StabilizerLayer(unsigned int numQubits);
+    void applyPauliX(int target);
+    void applyPauliY(int target);
+    void applyPauliZ(int target);
+    void applyHadamard(int target);
+    void applyCnot(int control, int target);
+    void applyCz(int control, int target);
+    void applySwap(int qubit1, int qubit2);
+    /**
+     * Returns to |0>.
+     */
+    void reset();
+    /**
+     * Measures some qubits one after the other, collapsing the state onto the outcome.
+     * @param qubits qubits to measure, at most 64
+     * @param rng    random number generator the random outcomes are drawn with
+     * @return outcome, bit j being the value measured for qubits[j]
+     */
+    unsigned long long int measure(const std::vector<int> &qubits, std::mt19937_64 &rng);
+    /**
+     * Draws shots of a measurement of some qubits without changing the state. A copy of the tableau is measured once,
+     * leaving the random outcomes as unknowns, so every outcome is a constant XORed with some of them and a shot only
+     * draws the k random outcomes, i.e. O(k) per shot after one O(k n^2 / 64) measurement.
+     * @param qubits qubits to measure, at most 64
+     * @param shots  number of shots
+     * @param rng    random number generator the shots are drawn with
+     * @return number of times each outcome was drawn, bit j of an outcome being the value of qubits[j]
+     */
+    std::map<unsigned long long int, unsigned long long int> sample(const std::vector<int> &qubits, unsigned long long int shots,
+                                                                    std::mt19937_64 &rng);
+    /**
+     * Returns true if measuring the qubit has a certain outcome, i.e. the qubit is in |0> or |1>.
+     */
+    bool isDeterministic(int qubit);
+    unsigned int getNumQubits();
+
+private:
+    // bit j of row i of the X (or Z) part of the tableau
+    bool x(unsigned long long int row, int qubit) const { return (x_[row * numWords + qubit / 64] >> (qubit % 64)) & 1; }
+    bool z(unsigned long long int row, int qubit) const { return (z_[row * numWords + qubit / 64] >> (qubit % 64)) & 1; }
+    void checkQubit(int qubit);
+    void rowMultiply(unsigned long long int target, unsigned long long int source);
+    void rowCopy(unsigned long long int target, unsigned long long int source);
+    bool measureQubit(int qubit, std::mt19937_64 &rng, std::uint64_t *mask = nullptr);
+    unsigned int numQubits;
+    unsigned long long int numWords; // words per row
+    // rows 0 to n-1 are the destabilizers, rows n to 2n-1 the stabilizers and row 2n is scratch space for measurements
+    std::vector<std::uint64_t> x_;
+    std::vector<std::uint64_t> z_;
+    std::vector<std::uint8_t> r_; // sign of each row, 1 for -1
+    // while sampling, the unknown random outcomes each sign is XORed with (bit k for the k-th one), empty otherwise
+    std::vector<std::uint64_t> signMasks_;
+};
+
+#endif
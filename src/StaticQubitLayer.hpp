@@ -0,0 +1,250 @@
+#ifndef STATICQUBITLAYER_H
+#define STATICQUBITLAYER_H
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "definitions.hpp"
+#include "gates.hpp"
+#include "QubitLayer.hpp"
+
+/**
+ * State vector of a number of qubits N known at compile time, at most maxStaticQubits, with amplitudes of scalar type T
+ * kept inline in a std::array, for running many small circuits where the cost of a gate is its loop overhead rather
+ * than memory bandwidth. There is no sparse form, qubit layout, diagonal queue or threading, and nothing is allocated
+ * for single qubit gates. Their kernels are instantiated for every target, so the loops over the pairs have a constant
+ * stride and length the compiler unrolls, and a gate is dispatched to the instantiation of its target.
+ */
+template <unsigned int N, typename T = precision>
+class BasicStaticQubitLayer
+{
+    static_assert(N >= 1 && N <= maxStaticQubits, "a StaticQubitLayer has between 1 and maxStaticQubits qubits");
+
+public:
+    static constexpr unsigned long long int numStates = 1ULL << N;
+
+    /**
+     * @param qL initial amplitudes, the state starts as |0> if none are given
+     */
+    BasicStaticQubitLayer(const std::complex<T> *qL = nullptr)
+    {
+        if (qL == nullptr)
+            reset();
+        else
+            std::copy(qL, qL + numStates, qubits_.begin());
+    }
+
+    void applyPauliX(int target) { applyGate(target, gates::pauliX<T, Matrix>()); }
+    void applyPauliY(int target) { applyGate(target, gates::pauliY<T, Matrix>()); }
+    void applyPauliZ(int target) { applyGate(target, gates::pauliZ<T, Matrix>()); }
+    void applyHadamard(int target) { applyGate(target, gates::hadamard<T, Matrix>()); }
+    void applyRx(int target, T theta) { applyGate(target, gates::rx<T, Matrix>(theta)); }
+    void applyRy(int target, T theta) { applyGate(target, gates::ry<T, Matrix>(theta)); }
+    void applyRz(int target, T theta) { applyGate(target, gates::rz<T, Matrix>(theta)); }
+    void applyCnot(int control, int target) { applyGate(target, gates::pauliX<T, Matrix>(), &control, 1); }
+    void applyToffoli(int control1, int control2, int target)
+    {
+        int controls[2]{control1, control2};
+        applyGate(target, gates::pauliX<T, Matrix>(), controls, 2);
+    }
+    void applyMcnot(int *controls, int numControls, int target) { applyGate(target, gates::pauliX<T, Matrix>(), controls, numControls); }
+    void applyCz(int control, int target) { applyGate(target, gates::pauliZ<T, Matrix>(), &control, 1); }
+    void applyMcphase(int *controls, int numControls, int target) { applyGate(target, gates::pauliZ<T, Matrix>(), controls, numControls); }
+    void applySwap(int qubit1, int qubit2) { applyUnitary({qubit1, qubit2}, gates::swap<T>()); }
+
+    /**
+     * Applies a 2^k x 2^k row-major matrix to k target qubits, targets[j] being bit j of the row and column numbers,
+     * on the states where all the controls are set, as BasicQubitLayer::applyUnitary.
+     */
+    void applyUnitary(const std::vector<int> &targets, const std::vector<std::complex<T>> &matrix, const std::vector<int> &controls = {})
+    {
+        unsigned long long int dim = 1ULL << targets.size();
+        unsigned long long int targetMask{0};
+        unsigned long long int ctrlMask{0};
+        bool validQubits = !targets.empty();
+        for (int target : targets)
+        {
+            validQubits = validQubits && target >= 0 && target < static_cast<int>(N) && !(targetMask & (1ULL << target));
+            targetMask |= 1ULL << target;
+        }
+        for (int control : controls)
+        {
+            validQubits = validQubits && control >= 0 && control < static_cast<int>(N) && !((targetMask | ctrlMask) & (1ULL << control));
+            ctrlMask |= 1ULL << control;
+        }
+        if (!validQubits || matrix.size() != dim * dim)
+        {
+            std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+            std::cout << "Number of qubits:           " << N << std::endl;
+            std::cout << "Number of targets:          " << targets.size() << std::endl;
+            std::cout << "Number of controls:         " << controls.size() << std::endl;
+            std::cout << "Number of matrix entries:   " << matrix.size() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        applyUnitary(targets.data(), targets.size(), matrix.data(), ctrlMask);
+    }
+
+    /**
+     * Same as applyUnitary without the checks, for valid and distinct targets and controls not among the targets.
+     */
+    void applyUnitary(const int *targets, int numTargets, const std::complex<T> *matrix, unsigned long long int ctrlMask)
+    {
+        if (numTargets == 1)
+            return applySingle(targets[0], matrix, ctrlMask);
+        // the 2^k amplitudes of a group share all the non-target bits, the lowest of them having none of the target bits set
+        unsigned long long int dim = 1ULL << numTargets;
+        unsigned long long int targetMask{0};
+        std::vector<unsigned long long int> offsets(dim, 0);
+        for (int j = 0; j < numTargets; j++)
+        {
+            targetMask |= 1ULL << targets[j];
+            for (unsigned long long int r = 0; r < dim; r++)
+                if (r & (1ULL << j))
+                    offsets[r] |= 1ULL << targets[j];
+        }
+        std::vector<std::complex<T>> group(dim);
+        for (unsigned long long int i = 0; i < numStates; i++)
+        {
+            if ((i & targetMask) != 0 || (i & ctrlMask) != ctrlMask)
+                continue;
+            for (unsigned long long int c = 0; c < dim; c++)
+                group[c] = qubits_[i | offsets[c]];
+            for (unsigned long long int r = 0; r < dim; r++)
+            {
+                std::complex<T> sum{0, 0};
+                for (unsigned long long int c = 0; c < dim; c++)
+                    sum += matrix[r * dim + c] * group[c];
+                qubits_[i | offsets[r]] = sum;
+            }
+        }
+    }
+
+    void reset()
+    {
+        qubits_.fill(std::complex<T>{0, 0});
+        qubits_[0] = {1, 0};
+    }
+
+    /**
+     * Expectation values of Pauli strings, as BasicQubitLayer::expectation.
+     */
+    std::vector<precision> expectation(const std::vector<PauliString> &terms)
+    {
+        std::vector<precision> values;
+        for (const PauliString &term : terms)
+        {
+            if ((term.xMask | term.zMask) >> N)
+            {
+                std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+                std::cout << "Number of qubits:           " << N << std::endl;
+                std::cout << "Pauli string X mask:        " << term.xMask << std::endl;
+                std::cout << "Pauli string Z mask:        " << term.zMask << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            // real part of i^numY times the sum over i of conj(psi[i ^ xMask]) psi[i] (-1)^popcount(i & zMask)
+            double sumRe{0};
+            double sumIm{0};
+            for (unsigned long long int i = 0; i < numStates; i++)
+            {
+                std::complex<double> product = std::conj(std::complex<double>(qubits_[i ^ term.xMask])) * std::complex<double>(qubits_[i]);
+                double sign = 1 - 2 * (__builtin_popcountll(i & term.zMask) & 1);
+                sumRe += sign * product.real();
+                sumIm += sign * product.imag();
+            }
+            double parts[4]{sumRe, -sumIm, -sumRe, sumIm};
+            values.push_back(term.coefficient * parts[__builtin_popcountll(term.xMask & term.zMask) & 3]);
+        }
+        return values;
+    }
+
+    std::complex<T> *getQubitLayer() { return qubits_.data(); }
+    static constexpr unsigned long long int getNumStates() { return numStates; }
+    static constexpr unsigned int getNumQubits() { return N; }
+
+private:
+    // single qubit matrices are taken from gates in an array, so that they allocate nothing
+    using Matrix = std::array<std::complex<T>, 4>;
+
+    // calls op on the two amplitudes of every pair of the target whose index has all the bits of ctrlMask set,
+    // the pairs of a block of 2^(Target+1) states being 2^Target apart
+    template <int Target, typename PairOp>
+    void forEachPair(unsigned long long int ctrlMask, PairOp op)
+    {
+        constexpr unsigned long long int stride = 1ULL << Target;
+        for (unsigned long long int block = 0; block < numStates; block += 2 * stride)
+            for (unsigned long long int j = 0; j < stride; j++)
+                if (((block | j) & ctrlMask) == ctrlMask)
+                    op(qubits_[block | j], qubits_[block | j | stride]);
+    }
+
+    // calls kernel with the target as a std::integral_constant, which selects the instantiation of that target
+    template <typename Kernel, std::size_t... Targets>
+    static void withTarget(int target, Kernel kernel, std::index_sequence<Targets...>)
+    {
+        ((target == static_cast<int>(Targets) ? (kernel(std::integral_constant<int, Targets>{}), true) : false) || ...);
+    }
+
+    // single qubit gates skip applyUnitary, so that they build no vectors
+    void applyGate(int target, const Matrix &matrix, const int *controls = nullptr, int numControls = 0)
+    {
+        bool validQubits = target >= 0 && target < static_cast<int>(N);
+        unsigned long long int ctrlMask{0};
+        for (int c = 0; c < numControls; c++)
+        {
+            validQubits = validQubits && controls[c] >= 0 && controls[c] < static_cast<int>(N) && controls[c] != target &&
+                          !(ctrlMask & (1ULL << controls[c]));
+            ctrlMask |= 1ULL << controls[c];
+        }
+        if (!validQubits)
+        {
+            std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+            std::cout << "Number of qubits:           " << N << std::endl;
+            std::cout << "Target qubit:               " << target << std::endl;
+            std::cout << "Number of controls:         " << numControls << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        applySingle(target, matrix.data(), ctrlMask);
+    }
+
+    // applies a 2x2 matrix with the cheapest pair kernel for its structure
+    void applySingle(int target, const std::complex<T> *m, unsigned long long int ctrlMask)
+    {
+        const std::complex<T> zero{0, 0};
+        const std::complex<T> m0 = m[0], m1 = m[1], m2 = m[2], m3 = m[3];
+        withTarget(
+            target, [&](auto fixedTarget)
+            {
+                constexpr int Target = decltype(fixedTarget)::value;
+                if (m1 == zero && m2 == zero)
+                    forEachPair<Target>(ctrlMask, [=](std::complex<T> &a0, std::complex<T> &a1) {
+                        a0 *= m0;
+                        a1 *= m3;
+                    });
+                else if (m0 == zero && m3 == zero)
+                    forEachPair<Target>(ctrlMask, [=](std::complex<T> &a0, std::complex<T> &a1) {
+                        std::complex<T> q0 = a0;
+                        a0 = m1 * a1;
+                        a1 = m2 * q0;
+                    });
+                else
+                    forEachPair<Target>(ctrlMask, [=](std::complex<T> &a0, std::complex<T> &a1) {
+                        std::complex<T> q0 = a0;
+                        a0 = m0 * q0 + m1 * a1;
+                        a1 = m2 * q0 + m3 * a1;
+                    });
+            },
+            std::make_index_sequence<N>{});
+    }
+
+    alignas(stateAlignment) std::array<std::complex<T>, numStates> qubits_;
+};
+
+template <unsigned int N>
+using StaticQubitLayer = BasicStaticQubitLayer<N, precision>;
+template <unsigned int N>
+using StaticQubitLayerF = BasicStaticQubitLayer<N, float>;
+
+#endif
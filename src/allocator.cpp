@@ -0,0 +1,125 @@
+#include <iostream>
+#include <atomic>
+#include <iterator>
+#include <new>
+#include <sys/mman.h>
+#include "allocator.hpp"
+
+namespace
+{
+    std::atomic<memory::Allocator *> current{nullptr};
+
+    // mapped buffers are whole huge pages, so MAP_HUGETLB mappings can be unmapped with the same size
+    unsigned long long int mappedSize(unsigned long long int numBytes)
+    {
+        return (numBytes + hugePageBytes - 1) / hugePageBytes * hugePageBytes;
+    }
+}
+
+namespace memory
+{
+    PoolAllocator::PoolAllocator(bool hugeTlb, unsigned long long int maxPooled) : hugeTlb_(hugeTlb), maxPooled_(maxPooled) {}
+
+    PoolAllocator::~PoolAllocator() { trim(); }
+
+    void *PoolAllocator::acquire(unsigned long long int numBytes)
+    {
+        if (numBytes < hugePageBytes)
+            return ::operator new(numBytes, std::align_val_t{stateAlignment});
+        unsigned long long int size = mappedSize(numBytes);
+        void *buffer = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if (hugeTlb_)
+            buffer = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        if (buffer == MAP_FAILED)
+        {
+            buffer = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (buffer == MAP_FAILED)
+            {
+                std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+                std::cout << "Could not allocate state:   " << numBytes << " bytes" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+#ifdef MADV_HUGEPAGE
+            madvise(buffer, size, MADV_HUGEPAGE);
+#endif
+        }
+        return buffer;
+    }
+
+    void PoolAllocator::release(void *buffer, unsigned long long int numBytes)
+    {
+        if (numBytes < hugePageBytes)
+            ::operator delete(buffer, std::align_val_t{stateAlignment});
+        else
+            munmap(buffer, mappedSize(numBytes));
+    }
+
+    void *PoolAllocator::allocate(unsigned long long int numBytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto pooled = free_.find(numBytes);
+            if (pooled != free_.end())
+            {
+                void *buffer = pooled->second;
+                pooled_ -= numBytes;
+                free_.erase(pooled);
+                return buffer;
+            }
+        }
+        return acquire(numBytes);
+    }
+
+    void PoolAllocator::deallocate(void *buffer, unsigned long long int numBytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (pooled_ + numBytes <= maxPooled_)
+            {
+                free_.emplace(numBytes, buffer);
+                pooled_ += numBytes;
+                return;
+            }
+        }
+        release(buffer, numBytes);
+    }
+
+    void PoolAllocator::trim(unsigned long long int maxBytes, unsigned long long int keepSize)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        unsigned long long int kept = keepSize > 0 && free_.count(keepSize) > 0 ? keepSize : 0;
+        while (pooled_ - kept > maxBytes)
+        {
+            // the kept buffer is never the only one left here, as the others would then add up to 0 bytes
+            auto pooled = std::prev(free_.end());
+            if (kept > 0 && pooled->first == kept && free_.count(kept) == 1)
+                pooled = std::prev(pooled);
+            release(pooled->second, pooled->first);
+            pooled_ -= pooled->first;
+            free_.erase(pooled);
+        }
+    }
+
+    unsigned long long int PoolAllocator::getPooledBytes()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return pooled_;
+    }
+
+    PoolAllocator &getDefaultAllocator()
+    {
+        // never destroyed, so states that outlive static destruction can still return their memory
+        static PoolAllocator *pool = new PoolAllocator();
+        return *pool;
+    }
+
+    Allocator &getAllocator()
+    {
+        Allocator *allocator = current.load();
+        return allocator != nullptr ? *allocator : getDefaultAllocator();
+    }
+
+    void setAllocator(Allocator *allocator) { current.store(allocator); }
+}
@@ -0,0 +1,76 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+#include <map>
+#include <mutex>
+#include "definitions.hpp"
+
+// memory of the dense state vectors
+namespace memory
+{
+    /**
+     * Source of the memory of dense states. allocate must return memory aligned to stateAlignment bytes, which may be
+     * uninitialised, and deallocate is called with the size it was allocated with. Both may be called concurrently.
+     */
+    class Allocator
+    {
+    public:
+        virtual ~Allocator() = default;
+        virtual void *allocate(unsigned long long int numBytes) = 0;
+        virtual void deallocate(void *buffer, unsigned long long int numBytes) = 0;
+    };
+
+    /**
+     * Default allocator. Buffers of at least hugePageBytes are mapped anonymously and advised to be backed by
+     * transparent huge pages (or taken from the reserved huge pages with MAP_HUGETLB if asked to, falling back to
+     * normal pages when none are left), which cuts the TLB misses of the gates on large states. Smaller buffers come
+     * from aligned operator new. Released buffers are kept, up to maxPooled bytes, and handed out again for a
+     * request of the same size, so states created and destroyed in a loop neither map nor page-fault their memory again.
+     */
+    class PoolAllocator : public Allocator
+    {
+    public:
+        /**
+         * @param hugeTlb   if true, large buffers are first taken from the reserved huge pages (MAP_HUGETLB)
+         * @param maxPooled bytes of released buffers kept for reuse
+         */
+        PoolAllocator(bool hugeTlb = false, unsigned long long int maxPooled = maxPooledBytes);
+        ~PoolAllocator();
+        PoolAllocator(const PoolAllocator &) = delete;
+        PoolAllocator &operator=(const PoolAllocator &) = delete;
+        void *allocate(unsigned long long int numBytes) override;
+        void deallocate(void *buffer, unsigned long long int numBytes) override;
+        /**
+         * Returns pooled buffers to the system, the largest first, until at most maxBytes of them are left.
+         * @param maxBytes bytes of pooled buffers to keep
+         * @param keepSize size of a buffer about to be reused, one of which is kept and not counted
+         */
+        void trim(unsigned long long int maxBytes = 0, unsigned long long int keepSize = 0);
+        unsigned long long int getPooledBytes();
+
+    private:
+        void *acquire(unsigned long long int numBytes);
+        void release(void *buffer, unsigned long long int numBytes);
+        bool hugeTlb_;
+        unsigned long long int maxPooled_;
+        unsigned long long int pooled_ = 0;
+        std::multimap<unsigned long long int, void *> free_; // released buffers by size
+        std::mutex mutex_;
+    };
+
+    /**
+     * Returns the allocator new dense states take their memory from.
+     */
+    Allocator &getAllocator();
+    /**
+     * Selects the allocator new dense states take their memory from, nullptr for the default PoolAllocator. The
+     * allocator must outlive the states allocated with it, as each state returns its memory to the allocator it
+     * came from.
+     */
+    void setAllocator(Allocator *allocator);
+    /**
+     * Returns the default PoolAllocator, e.g. to trim it.
+     */
+    PoolAllocator &getDefaultAllocator();
+}
+
+#endif
@@ -1,13 +1,50 @@
 #ifndef DEFINITIONS_H
 #define DEFINITIONS_H
 #include <complex>
+#include <unordered_map>
 
+// constants for amplitudes of scalar type T (float or double)
+template <typename T>
+struct constants
+{
+    static constexpr T pi{static_cast<T>(3.14159265358979323846)};
+    static constexpr std::complex<T> hadamardCoef{static_cast<T>(0.707106781186548), 0};
+    static constexpr std::complex<T> complexImg{0, 1};
+    static constexpr std::complex<T> zeroComplex{0, 0};
+    // sparse states drop amplitudes smaller than this
+    static constexpr T sparseZero{sizeof(T) < sizeof(double) ? static_cast<T>(1e-6) : static_cast<T>(1e-15)};
+};
+
+// default scalar type, a QubitLayer stores amplitudes in double precision and a QubitLayerF in single precision
 typedef double precision;
-constexpr precision pi{3.14159265358979323846};
-constexpr std::complex<precision> hadamardCoef{0.707106781186548, 0};
-constexpr std::complex<precision> complexImg{0, 1};
-constexpr std::complex<precision> zeroComplex{0, 0};
-constexpr unsigned int maxQubits{32}; // max states allowed by QuantumSim is 2^32
+constexpr precision pi{constants<precision>::pi};
+constexpr std::complex<precision> hadamardCoef{constants<precision>::hadamardCoef};
+constexpr std::complex<precision> complexImg{constants<precision>::complexImg};
+constexpr std::complex<precision> zeroComplex{constants<precision>::zeroComplex};
+constexpr unsigned int maxQubits{63}; // max states allowed by QuantumSim is 2^63
+constexpr unsigned int maxDenseQubits{32}; // max states stored as a dense array in memory is 2^32, larger ones stay sparse
+constexpr unsigned int maxMappedQubits{40}; // max states stored as a dense array in a memory-mapped file is 2^40
+constexpr unsigned int mappedChunkQubits{24}; // circuits run on memory-mapped states in chunks of 2^24 states
+constexpr unsigned int cacheChunkQubits{14}; // and on states in memory in chunks of 2^14 states, which fit in the L2 cache
+constexpr unsigned int maxMarginalQubits{16}; // measurements of more qubits draw a state instead of tabulating outcomes
+constexpr unsigned long long int minParallelStates{1ULL << 14}; // smaller states are not worth spreading over threads
+constexpr precision denseOccupancy{1.0 / 32}; // sparse states with a larger fraction of non-zero amplitudes become dense, early as the map is slow to fill
+constexpr precision sparseOccupancy{1.0 / 64}; // dense states with a smaller fraction of non-zero amplitudes become sparse
+constexpr unsigned int sparseCheckInterval{16}; // mixing gates applied to a dense state between two occupancy checks
+constexpr int fixedTargetBits{8}; // gates on the 8 lowest bits have kernels specialised on their target
+constexpr int fixedSimdTargets{2}; // which replace the vector kernels on the 2 lowest bits for real, diagonal and anti-diagonal gates
+constexpr unsigned int maxStaticQubits{12}; // a StaticQubitLayer has at most 12 qubits, its amplitudes being kept inline
+constexpr unsigned int wideJobQubits{20}; // a JobRunner gives jobs on this many qubits all its threads, smaller ones get one each
+constexpr unsigned int maxDiagonalGates{64}; // diagonal gates collected before they are applied together in one pass
+constexpr unsigned long long int stateAlignment{64}; // dense states start on a cache line, the width of an AVX-512 register
+constexpr unsigned long long int hugePageBytes{1ULL << 21}; // dense states of at least 2 MB are mapped and backed by huge pages
+constexpr unsigned long long int maxPooledBytes{1ULL << 30}; // memory of released dense states kept for reuse
+constexpr unsigned long long int checkpointBlockStates{1ULL << 12}; // compressed checkpoints skip all-zero blocks of 2^12 states
+constexpr unsigned long long int maxProfileEvents{1ULL << 20}; // the profiler timeline keeps the first 2^20 scopes
 typedef std::complex<precision> qubitLayer;
+// non-zero amplitudes by state index
+template <typename T>
+using basicSparseLayer = std::unordered_map<unsigned long long int, std::complex<T>>;
+typedef basicSparseLayer<precision> sparseLayer;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,60 @@
+#ifndef GATES_H
+#define GATES_H
+#include <cmath>
+#include <vector>
+#include "definitions.hpp"
+
+// row-major matrices of the supported single qubit gates, with entries of scalar type T, in a std::vector unless an
+// other container taking the four entries as an initializer list is given, e.g. a std::array<std::complex<T>, 4>
+namespace gates
+{
+    template <typename T = precision, typename Matrix = std::vector<std::complex<T>>>
+    Matrix pauliX() { return {0, 1, 1, 0}; }
+
+    // map |0> to i|1> and |1> to -i|0>
+    template <typename T = precision, typename Matrix = std::vector<std::complex<T>>>
+    Matrix pauliY() { return {0, -constants<T>::complexImg, constants<T>::complexImg, 0}; }
+
+    // add phase if bit is 1 (i.e. it is set)
+    template <typename T = precision, typename Matrix = std::vector<std::complex<T>>>
+    Matrix pauliZ() { return {1, 0, 0, -1}; }
+
+    // map |0> to hadamardCoef*(|0>+|1>) and |1> to hadamardCoef*(|0>-|1>)
+    template <typename T = precision, typename Matrix = std::vector<std::complex<T>>>
+    Matrix hadamard()
+    {
+        constexpr std::complex<T> h = constants<T>::hadamardCoef;
+        return {h, h, h, -h};
+    }
+
+    // map |0> to cosTheta*|0> - i*sinTheta*|1> and |1> to cosTheta*|1> - i*sinTheta*|0>
+    template <typename T = precision, typename Matrix = std::vector<std::complex<T>>>
+    Matrix rx(T theta)
+    {
+        T cosTheta = std::cos(theta / 2);
+        T sinTheta = std::sin(theta / 2);
+        return {cosTheta, -constants<T>::complexImg * sinTheta, -constants<T>::complexImg * sinTheta, cosTheta};
+    }
+
+    // map |0> to cosTheta*|0> + sinTheta*|1> and |1> to cosTheta*|1> - sinTheta*|0>
+    template <typename T = precision, typename Matrix = std::vector<std::complex<T>>>
+    Matrix ry(T theta)
+    {
+        T cosTheta = std::cos(theta / 2);
+        T sinTheta = std::sin(theta / 2);
+        return {cosTheta, -sinTheta, sinTheta, cosTheta};
+    }
+
+    // apply the phases of |0> and |1>
+    template <typename T = precision, typename Matrix = std::vector<std::complex<T>>>
+    Matrix rz(T theta)
+    {
+        return {std::polar<T>(1, -theta / 2), 0, 0, std::polar<T>(1, theta / 2)};
+    }
+
+    // exchange the values of two qubits, i.e. map |01> to |10> and |10> to |01>
+    template <typename T = precision>
+    std::vector<std::complex<T>> swap() { return {1, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0, 0, 0, 0, 1}; }
+}
+
+#endif
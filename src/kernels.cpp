@@ -0,0 +1,1317 @@
+#include <complex>
+#include <algorithm>
+#include <vector>
+#include <type_traits>
+#include <iostream>
+#include "kernels.hpp"
+#include "profiler.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// the vectorised kernels are compiled for their instruction set with function attributes
+// and only called after CPUID has confirmed support, so no -m flags are needed
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define QSIM_X86_SIMD
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+#define AVX512_TARGET __attribute__((target("avx512f")))
+#endif
+
+namespace
+{
+    SimdLevel detectSimdLevel()
+    {
+#ifdef QSIM_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+            return SimdLevel::avx512;
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+            return SimdLevel::avx2;
+#endif
+        return SimdLevel::scalar;
+    }
+
+    const SimdLevel supportedSimdLevel = detectSimdLevel();
+    SimdLevel simdLevel = supportedSimdLevel;
+
+    // maps an item number (a pair or group of amplitudes) to the index of its first state by inserting zeros at
+    // the target and control bits and then setting the control bits, so that only the states where all the
+    // controls are set are visited
+    struct StateIndex
+    {
+        int sortedBits[64];
+        int numBits{0};
+        unsigned long long int ctrlMask;
+        StateIndex(const int *targets, int numTargets, unsigned long long int ctrlMask) : ctrlMask(ctrlMask)
+        {
+            for (int j = 0; j < numTargets; j++)
+                sortedBits[numBits++] = targets[j];
+            for (int bit = 0; bit < 64; bit++)
+                if (ctrlMask & (1ULL << bit))
+                    sortedBits[numBits++] = bit;
+            std::sort(sortedBits, sortedBits + numBits);
+        }
+        unsigned long long int operator()(unsigned long long int item) const
+        {
+            return kernels::insertZeroBits(item, sortedBits, numBits) | ctrlMask;
+        }
+        unsigned long long int numItems(unsigned long long int numStates) const { return numStates >> numBits; }
+        // amplitudes of consecutive items are contiguous below this bit
+        int lowestBit() const { return sortedBits[0]; }
+    };
+
+#ifdef QSIM_PROFILE
+    // profiler names of the pair kernels, by matrix type and instruction set, and of the group kernels by matrix type
+    const char *const pairKernelNames[4][3]{{"diagonal scalar", "diagonal avx2", "diagonal avx512"},
+                                            {"anti-diagonal scalar", "anti-diagonal avx2", "anti-diagonal avx512"},
+                                            {"real matrix scalar", "real matrix avx2", "real matrix avx512"},
+                                            {"matrix scalar", "matrix avx2", "matrix avx512"}};
+    const char *const groupKernelNames[4]{"diagonal groups", "permutation groups", "real matrix groups", "matrix groups"};
+#endif
+
+    // splits the items (amplitude pairs or groups) into one contiguous block per thread, keeping every block
+    // a multiple of step items; numTouched is the number of amplitudes the items cover
+    template <typename RangeKernel>
+    void forEachRange(unsigned long long int numTouched, unsigned long long int numItems, unsigned long long int step,
+                      int numThreads, RangeKernel kernel)
+    {
+        unsigned long long int numSteps = numItems / step;
+        // small gates skip the parallel region, whose setup would cost more than the gate
+        if (numTouched < minParallelStates || numThreads <= 1)
+        {
+            if (numSteps > 0)
+                kernel(0, numSteps * step);
+            return;
+        }
+#pragma omp parallel num_threads(numThreads) if (numTouched >= minParallelStates)
+        {
+            unsigned long long int thread{0};
+            unsigned long long int threads{1};
+#ifdef _OPENMP
+            thread = omp_get_thread_num();
+            threads = omp_get_num_threads();
+#endif
+            unsigned long long int chunk = (numSteps + threads - 1) / threads;
+            unsigned long long int begin = std::min(thread * chunk, numSteps);
+            unsigned long long int end = std::min(begin + chunk, numSteps);
+            if (begin < end)
+            {
+                // the time of every thread on the same gate shows how evenly the blocks are spread
+                QSIM_PROFILE_SCOPE("kernel thread");
+                kernel(begin * step, end * step);
+            }
+        }
+    }
+
+    // scalar kernels, used when no vector instruction set is available or the target stride is too small
+
+    template <typename T>
+    void matrixScalar(std::complex<T> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                      const std::complex<T> *m, const StateIndex &index)
+    {
+        unsigned long long int mask = 1ULL << target;
+        for (unsigned long long int k = kBegin; k < kEnd; k++)
+        {
+            unsigned long long int i = index(k);
+            std::complex<T> q0 = q[i];
+            std::complex<T> q1 = q[i | mask];
+            q[i] = m[0] * q0 + m[1] * q1;
+            q[i | mask] = m[2] * q0 + m[3] * q1;
+        }
+    }
+
+    template <typename T>
+    void diagonalScalar(std::complex<T> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                        std::complex<T> d0, std::complex<T> d1, const StateIndex &index)
+    {
+        unsigned long long int mask = 1ULL << target;
+        bool skipZero = d0 == std::complex<T>{1, 0};
+        for (unsigned long long int k = kBegin; k < kEnd; k++)
+        {
+            unsigned long long int i = index(k);
+            if (!skipZero)
+                q[i] *= d0;
+            q[i | mask] *= d1;
+        }
+    }
+
+    template <typename T>
+    void antiDiagonalScalar(std::complex<T> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                            std::complex<T> p0, std::complex<T> p1, const StateIndex &index)
+    {
+        unsigned long long int mask = 1ULL << target;
+        bool plainSwap = p0 == std::complex<T>{1, 0} && p1 == std::complex<T>{1, 0};
+        for (unsigned long long int k = kBegin; k < kEnd; k++)
+        {
+            unsigned long long int i = index(k);
+            if (plainSwap)
+                std::swap(q[i], q[i | mask]);
+            else
+            {
+                std::complex<T> q0 = q[i];
+                q[i] = p0 * q[i | mask];
+                q[i | mask] = p1 * q0;
+            }
+        }
+    }
+
+    template <typename T>
+    void realMatrixScalar(std::complex<T> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                          const T *m, const StateIndex &index)
+    {
+        unsigned long long int mask = 1ULL << target;
+        for (unsigned long long int k = kBegin; k < kEnd; k++)
+        {
+            unsigned long long int i = index(k);
+            std::complex<T> q0 = q[i];
+            std::complex<T> q1 = q[i | mask];
+            q[i] = m[0] * q0 + m[1] * q1;
+            q[i | mask] = m[2] * q0 + m[3] * q1;
+        }
+    }
+
+    // scalar kernels with the target known at compile time, for uncontrolled gates on the fixedTargetBits lowest
+    // bits: a block of 2^(Target+1) states holds 2^Target pairs at a constant stride, which the compiler unrolls,
+    // instead of the index of every pair being computed from a runtime target. kBegin and kEnd are multiples of 2^Target
+    template <int Target, typename T, typename PairOp>
+    void fixedPairs(std::complex<T> *q, unsigned long long int kBegin, unsigned long long int kEnd, PairOp op)
+    {
+        constexpr unsigned long long int stride = 1ULL << Target;
+        for (unsigned long long int k = kBegin; k < kEnd; k += stride)
+        {
+            std::complex<T> *block = q + 2 * k;
+            for (unsigned long long int j = 0; j < stride; j++)
+                op(block[j], block[j + stride]);
+        }
+    }
+
+    // calls kernel with the target as a std::integral_constant, one instantiation per bit below fixedTargetBits
+    template <typename Kernel>
+    void withFixedTarget(int target, Kernel kernel)
+    {
+        static_assert(fixedTargetBits == 8, "one case per fixed target");
+        switch (target)
+        {
+        case 0:
+            return kernel(std::integral_constant<int, 0>{});
+        case 1:
+            return kernel(std::integral_constant<int, 1>{});
+        case 2:
+            return kernel(std::integral_constant<int, 2>{});
+        case 3:
+            return kernel(std::integral_constant<int, 3>{});
+        case 4:
+            return kernel(std::integral_constant<int, 4>{});
+        case 5:
+            return kernel(std::integral_constant<int, 5>{});
+        case 6:
+            return kernel(std::integral_constant<int, 6>{});
+        case 7:
+            return kernel(std::integral_constant<int, 7>{});
+        default:
+            // the callers only pick the fixed kernels for targets below fixedTargetBits
+            std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+            std::cout << "Target of a fixed kernel:   " << target << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    template <typename T, typename PairOp>
+    void applyFixedPairs(std::complex<T> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target, PairOp op)
+    {
+        withFixedTarget(target, [&](auto fixedTarget)
+                        { fixedPairs<decltype(fixedTarget)::value>(q, kBegin, kEnd, op); });
+    }
+
+    // complex product without the NaN and infinity recovery of std::complex (a library call), so the loops unroll
+    template <typename T>
+    inline std::complex<T> product(std::complex<T> a, std::complex<T> b)
+    {
+        return {a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real()};
+    }
+
+    template <typename T>
+    void matrixFixed(std::complex<T> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target, const std::complex<T> *m)
+    {
+        const std::complex<T> m0 = m[0], m1 = m[1], m2 = m[2], m3 = m[3];
+        applyFixedPairs(q, kBegin, kEnd, target, [=](std::complex<T> &a0, std::complex<T> &a1) {
+            std::complex<T> q0 = a0;
+            a0 = product(m0, q0) + product(m1, a1);
+            a1 = product(m2, q0) + product(m3, a1);
+        });
+    }
+
+    template <typename T>
+    void diagonalFixed(std::complex<T> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                       std::complex<T> d0, std::complex<T> d1)
+    {
+        if (d0 == std::complex<T>{1, 0})
+            applyFixedPairs(q, kBegin, kEnd, target, [=](std::complex<T> &, std::complex<T> &a1)
+                            { a1 = product(a1, d1); });
+        else
+            applyFixedPairs(q, kBegin, kEnd, target, [=](std::complex<T> &a0, std::complex<T> &a1) {
+                a0 = product(a0, d0);
+                a1 = product(a1, d1);
+            });
+    }
+
+    template <typename T>
+    void antiDiagonalFixed(std::complex<T> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                           std::complex<T> p0, std::complex<T> p1)
+    {
+        if (p0 == std::complex<T>{1, 0} && p1 == std::complex<T>{1, 0})
+            applyFixedPairs(q, kBegin, kEnd, target, [](std::complex<T> &a0, std::complex<T> &a1)
+                            { std::swap(a0, a1); });
+        else
+            applyFixedPairs(q, kBegin, kEnd, target, [=](std::complex<T> &a0, std::complex<T> &a1) {
+                std::complex<T> q0 = a0;
+                a0 = product(p0, a1);
+                a1 = product(p1, q0);
+            });
+    }
+
+    template <typename T>
+    void realMatrixFixed(std::complex<T> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target, const T *m)
+    {
+        const T m0 = m[0], m1 = m[1], m2 = m[2], m3 = m[3];
+        applyFixedPairs(q, kBegin, kEnd, target, [=](std::complex<T> &a0, std::complex<T> &a1) {
+            std::complex<T> q0 = a0;
+            a0 = m0 * q0 + m1 * a1;
+            a1 = m2 * q0 + m3 * a1;
+        });
+    }
+
+    // k qubit kernels: each group is the 2^k amplitudes that share all non-target bits, found by inserting
+    // zeros at the target bits of the group number and adding the offset of each target bit pattern
+
+    template <typename T>
+    void diagonalGroups(std::complex<T> *q, unsigned long long int gBegin, unsigned long long int gEnd, const unsigned long long int *offsets, const std::complex<T> *diagonal,
+                        unsigned long long int dim, const StateIndex &index)
+    {
+        for (unsigned long long int g = gBegin; g < gEnd; g++)
+        {
+            unsigned long long int base = index(g);
+            for (unsigned long long int r = 0; r < dim; r++)
+                q[base + offsets[r]] *= diagonal[r];
+        }
+    }
+
+    template <typename T>
+    void permutationGroups(std::complex<T> *q, unsigned long long int gBegin, unsigned long long int gEnd, const unsigned long long int *offsets, const unsigned long long int *columns,
+                           const std::complex<T> *values, unsigned long long int dim, const StateIndex &index)
+    {
+        std::vector<std::complex<T>> in(dim);
+        for (unsigned long long int g = gBegin; g < gEnd; g++)
+        {
+            unsigned long long int base = index(g);
+            for (unsigned long long int c = 0; c < dim; c++)
+                in[c] = q[base + offsets[c]];
+            for (unsigned long long int r = 0; r < dim; r++)
+                q[base + offsets[r]] = values[r] * in[columns[r]];
+        }
+    }
+
+    // Dim is the matrix dimension when known at compile time (so the loops unroll) and 0 otherwise
+    template <unsigned long long int Dim, typename T, typename Coef>
+    void matrixGroups(std::complex<T> *q, unsigned long long int gBegin, unsigned long long int gEnd, const unsigned long long int *offsets, const Coef *m, unsigned long long int dim, const StateIndex &index)
+    {
+        if (Dim)
+            dim = Dim;
+        std::vector<std::complex<T>> in(dim);
+        for (unsigned long long int g = gBegin; g < gEnd; g++)
+        {
+            unsigned long long int base = index(g);
+            for (unsigned long long int c = 0; c < dim; c++)
+                in[c] = q[base + offsets[c]];
+            for (unsigned long long int r = 0; r < dim; r++)
+            {
+                std::complex<T> sum = constants<T>::zeroComplex;
+                for (unsigned long long int c = 0; c < dim; c++)
+                    sum += m[r * dim + c] * in[c];
+                q[base + offsets[r]] = sum;
+            }
+        }
+    }
+
+    // inversion about the mean of every group of groupSize amplitudes, member(m) being the offset of member m from
+    // the first state of its group
+    template <typename T, typename Member>
+    void diffusionGroups(std::complex<T> *q, const StateIndex &group, unsigned long long int numGroups, unsigned long long int groupSize,
+                         const Member &member, int numThreads)
+    {
+        // the sums are kept in double precision, as a single precision sum of 2^k amplitudes loses their mean
+        double scale = 2.0 / groupSize;
+        if (numGroups >= groupSize)
+        {
+            // many small groups, every thread sums and updates whole groups while they are in its cache
+            forEachRange(numGroups * groupSize, numGroups, 1, numThreads, [&](unsigned long long int gBegin, unsigned long long int gEnd) {
+                for (unsigned long long int g = gBegin; g < gEnd; g++)
+                {
+                    std::complex<T> *base = q + group(g);
+                    std::complex<double> sum{0, 0};
+                    for (unsigned long long int m = 0; m < groupSize; m++)
+                        sum += std::complex<double>(base[member(m)]);
+                    std::complex<T> twiceMean(sum * scale);
+                    for (unsigned long long int m = 0; m < groupSize; m++)
+                        base[member(m)] = twiceMean - base[member(m)];
+                }
+            });
+            return;
+        }
+        // few large groups (a single one when diffusing every qubit), the threads share the sum and the update of each
+        for (unsigned long long int g = 0; g < numGroups; g++)
+        {
+            std::complex<T> *base = q + group(g);
+            double sumRe{0};
+            double sumIm{0};
+#pragma omp parallel for num_threads(numThreads) schedule(static) reduction(+ : sumRe, sumIm) if (groupSize >= minParallelStates)
+            for (unsigned long long int m = 0; m < groupSize; m++)
+            {
+                sumRe += base[member(m)].real();
+                sumIm += base[member(m)].imag();
+            }
+            std::complex<T> twiceMean(std::complex<double>(sumRe, sumIm) * scale);
+#pragma omp parallel for num_threads(numThreads) schedule(static) if (groupSize >= minParallelStates)
+            for (unsigned long long int m = 0; m < groupSize; m++)
+                base[member(m)] = twiceMean - base[member(m)];
+        }
+    }
+
+    // byte of the state index all the qubits of a diagonal gate lie in, -1 if they span several bytes
+    template <typename T>
+    int byteOf(const kernels::DiagonalGate<T> &gate)
+    {
+        unsigned long long int qubitMask = gate.ctrlMask;
+        for (int target : gate.targets)
+            qubitMask |= 1ULL << target;
+        int lowByte = __builtin_ctzll(qubitMask) / 8;
+        return lowByte == (63 - __builtin_clzll(qubitMask)) / 8 ? lowByte : -1;
+    }
+
+    // combined phase of a list of diagonal gates as a function of the state index: gates whose qubits all lie in one byte
+    // of the index are multiplied into a table of phases by the value of that byte, the others are evaluated one by one
+    template <typename T>
+    class PhaseTables
+    {
+    public:
+        explicit PhaseTables(const std::vector<kernels::DiagonalGate<T>> &gates)
+        {
+            for (const kernels::DiagonalGate<T> &gate : gates)
+            {
+                int lowByte = byteOf(gate);
+                if (lowByte < 0)
+                {
+                    spanning_.push_back(&gate);
+                    continue;
+                }
+                auto table = std::find_if(tables_.begin(), tables_.end(), [&](const ByteTable &t) { return t.byte == lowByte; });
+                if (table == tables_.end())
+                    table = tables_.insert(tables_.end(), {lowByte, std::vector<std::complex<T>>(256, {1, 0})});
+                for (unsigned long long int value = 0; value < 256; value++)
+                    table->phases[value] *= phaseOf(gate, value << (8 * lowByte));
+            }
+        }
+        std::complex<T> operator()(unsigned long long int i) const
+        {
+            std::complex<T> phase{1, 0};
+            for (const ByteTable &table : tables_)
+                phase *= table.phases[(i >> (8 * table.byte)) & 0xFF];
+            for (const kernels::DiagonalGate<T> *gate : spanning_)
+                phase *= phaseOf(*gate, i);
+            return phase;
+        }
+
+    private:
+        static std::complex<T> phaseOf(const kernels::DiagonalGate<T> &gate, unsigned long long int i)
+        {
+            if ((i & gate.ctrlMask) != gate.ctrlMask)
+                return {1, 0};
+            unsigned long long int pattern{0};
+            for (unsigned long long int j = 0; j < gate.targets.size(); j++)
+                pattern |= ((i >> gate.targets[j]) & 1) << j;
+            return gate.diagonal[pattern];
+        }
+        struct ByteTable
+        {
+            int byte;
+            std::vector<std::complex<T>> phases;
+        };
+        std::vector<ByteTable> tables_;
+        std::vector<const kernels::DiagonalGate<T> *> spanning_;
+    };
+
+#ifdef QSIM_X86_SIMD
+    // AVX2 kernels: a register holds 2 amplitudes, so for target >= 1 the |0> and |1> amplitudes of
+    // 2 consecutive pairs are loaded from 2 contiguous blocks, and for target 0 a register holds one pair
+
+    // multiplies the complex numbers in a by the complex number with real part bRe and imaginary part bIm
+    AVX2_TARGET inline __m256d cmulAvx2(__m256d a, __m256d bRe, __m256d bIm)
+    {
+        return _mm256_fmaddsub_pd(a, bRe, _mm256_mul_pd(_mm256_permute_pd(a, 0x5), bIm));
+    }
+
+    AVX2_TARGET inline __m256d broadcastRe(std::complex<double> c) { return _mm256_set1_pd(c.real()); }
+    AVX2_TARGET inline __m256d broadcastIm(std::complex<double> c) { return _mm256_set1_pd(c.imag()); }
+    // packs c0 into the low lane and c1 into the high lane
+    AVX2_TARGET inline __m256d packRe(std::complex<double> c0, std::complex<double> c1) { return _mm256_setr_pd(c0.real(), c0.real(), c1.real(), c1.real()); }
+    AVX2_TARGET inline __m256d packIm(std::complex<double> c0, std::complex<double> c1) { return _mm256_setr_pd(c0.imag(), c0.imag(), c1.imag(), c1.imag()); }
+
+    AVX2_TARGET void matrixAvx2(std::complex<double> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                                const std::complex<double> *m, const StateIndex &index)
+    {
+        double *d = reinterpret_cast<double *>(q);
+        if (target == 0)
+        {
+            // [q0', q1'] = [m0, m2] * [q0, q0] + [m1, m3] * [q1, q1]
+            __m256d c0Re = packRe(m[0], m[2]), c0Im = packIm(m[0], m[2]);
+            __m256d c1Re = packRe(m[1], m[3]), c1Im = packIm(m[1], m[3]);
+            for (unsigned long long int k = kBegin; k < kEnd; k++)
+            {
+                double *p = d + 2 * index(k);
+                __m256d v = _mm256_loadu_pd(p);
+                __m256d v0 = _mm256_permute2f128_pd(v, v, 0x00);
+                __m256d v1 = _mm256_permute2f128_pd(v, v, 0x11);
+                _mm256_storeu_pd(p, _mm256_add_pd(cmulAvx2(v0, c0Re, c0Im), cmulAvx2(v1, c1Re, c1Im)));
+            }
+            return;
+        }
+        __m256d re[4], im[4];
+        for (int j = 0; j < 4; j++)
+        {
+            re[j] = broadcastRe(m[j]);
+            im[j] = broadcastIm(m[j]);
+        }
+        unsigned long long int mask = 1ULL << target;
+        for (unsigned long long int k = kBegin; k < kEnd; k += 2)
+        {
+            unsigned long long int i = index(k);
+            double *p0 = d + 2 * i;
+            double *p1 = d + 2 * (i | mask);
+            __m256d v0 = _mm256_loadu_pd(p0);
+            __m256d v1 = _mm256_loadu_pd(p1);
+            _mm256_storeu_pd(p0, _mm256_add_pd(cmulAvx2(v0, re[0], im[0]), cmulAvx2(v1, re[1], im[1])));
+            _mm256_storeu_pd(p1, _mm256_add_pd(cmulAvx2(v0, re[2], im[2]), cmulAvx2(v1, re[3], im[3])));
+        }
+    }
+
+    AVX2_TARGET void diagonalAvx2(std::complex<double> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                                  std::complex<double> d0, std::complex<double> d1, const StateIndex &index)
+    {
+        double *d = reinterpret_cast<double *>(q);
+        if (target == 0)
+        {
+            __m256d cRe = packRe(d0, d1), cIm = packIm(d0, d1);
+            for (unsigned long long int k = kBegin; k < kEnd; k++)
+            {
+                double *p = d + 2 * index(k);
+                _mm256_storeu_pd(p, cmulAvx2(_mm256_loadu_pd(p), cRe, cIm));
+            }
+            return;
+        }
+        bool skipZero = d0 == std::complex<double>{1, 0};
+        __m256d re0 = broadcastRe(d0), im0 = broadcastIm(d0);
+        __m256d re1 = broadcastRe(d1), im1 = broadcastIm(d1);
+        unsigned long long int mask = 1ULL << target;
+        for (unsigned long long int k = kBegin; k < kEnd; k += 2)
+        {
+            unsigned long long int i = index(k);
+            if (!skipZero)
+                _mm256_storeu_pd(d + 2 * i, cmulAvx2(_mm256_loadu_pd(d + 2 * i), re0, im0));
+            double *p1 = d + 2 * (i | mask);
+            _mm256_storeu_pd(p1, cmulAvx2(_mm256_loadu_pd(p1), re1, im1));
+        }
+    }
+
+    AVX2_TARGET void antiDiagonalAvx2(std::complex<double> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                                      std::complex<double> p0, std::complex<double> p1, const StateIndex &index)
+    {
+        double *d = reinterpret_cast<double *>(q);
+        bool plainSwap = p0 == std::complex<double>{1, 0} && p1 == std::complex<double>{1, 0};
+        if (target == 0)
+        {
+            __m256d cRe = packRe(p0, p1), cIm = packIm(p0, p1);
+            for (unsigned long long int k = kBegin; k < kEnd; k++)
+            {
+                double *p = d + 2 * index(k);
+                __m256d v = _mm256_loadu_pd(p);
+                v = _mm256_permute2f128_pd(v, v, 0x01);
+                _mm256_storeu_pd(p, plainSwap ? v : cmulAvx2(v, cRe, cIm));
+            }
+            return;
+        }
+        __m256d re0 = broadcastRe(p0), im0 = broadcastIm(p0);
+        __m256d re1 = broadcastRe(p1), im1 = broadcastIm(p1);
+        unsigned long long int mask = 1ULL << target;
+        for (unsigned long long int k = kBegin; k < kEnd; k += 2)
+        {
+            unsigned long long int i = index(k);
+            double *a0 = d + 2 * i;
+            double *a1 = d + 2 * (i | mask);
+            __m256d v0 = _mm256_loadu_pd(a0);
+            __m256d v1 = _mm256_loadu_pd(a1);
+            _mm256_storeu_pd(a0, plainSwap ? v1 : cmulAvx2(v1, re0, im0));
+            _mm256_storeu_pd(a1, plainSwap ? v0 : cmulAvx2(v0, re1, im1));
+        }
+    }
+
+    AVX2_TARGET void realMatrixAvx2(std::complex<double> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                                    const double *m, const StateIndex &index)
+    {
+        double *d = reinterpret_cast<double *>(q);
+        if (target == 0)
+        {
+            __m256d c0 = _mm256_setr_pd(m[0], m[0], m[2], m[2]);
+            __m256d c1 = _mm256_setr_pd(m[1], m[1], m[3], m[3]);
+            for (unsigned long long int k = kBegin; k < kEnd; k++)
+            {
+                double *p = d + 2 * index(k);
+                __m256d v = _mm256_loadu_pd(p);
+                __m256d v0 = _mm256_permute2f128_pd(v, v, 0x00);
+                __m256d v1 = _mm256_permute2f128_pd(v, v, 0x11);
+                _mm256_storeu_pd(p, _mm256_fmadd_pd(c0, v0, _mm256_mul_pd(c1, v1)));
+            }
+            return;
+        }
+        __m256d c[4];
+        for (int j = 0; j < 4; j++)
+            c[j] = _mm256_set1_pd(m[j]);
+        unsigned long long int mask = 1ULL << target;
+        for (unsigned long long int k = kBegin; k < kEnd; k += 2)
+        {
+            unsigned long long int i = index(k);
+            double *p0 = d + 2 * i;
+            double *p1 = d + 2 * (i | mask);
+            __m256d v0 = _mm256_loadu_pd(p0);
+            __m256d v1 = _mm256_loadu_pd(p1);
+            _mm256_storeu_pd(p0, _mm256_fmadd_pd(c[0], v0, _mm256_mul_pd(c[1], v1)));
+            _mm256_storeu_pd(p1, _mm256_fmadd_pd(c[2], v0, _mm256_mul_pd(c[3], v1)));
+        }
+    }
+
+    // single precision AVX2 kernels: a register holds 4 amplitudes, so the |0> and |1> amplitudes of
+    // 4 consecutive pairs are loaded from 2 contiguous blocks, which needs target >= 2
+
+    AVX2_TARGET inline __m256 cmulAvx2(__m256 a, __m256 bRe, __m256 bIm)
+    {
+        return _mm256_fmaddsub_ps(a, bRe, _mm256_mul_ps(_mm256_permute_ps(a, 0xB1), bIm));
+    }
+
+    AVX2_TARGET void matrixAvx2(std::complex<float> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                                const std::complex<float> *m, const StateIndex &index)
+    {
+        float *f = reinterpret_cast<float *>(q);
+        __m256 re[4], im[4];
+        for (int j = 0; j < 4; j++)
+        {
+            re[j] = _mm256_set1_ps(m[j].real());
+            im[j] = _mm256_set1_ps(m[j].imag());
+        }
+        unsigned long long int mask = 1ULL << target;
+        for (unsigned long long int k = kBegin; k < kEnd; k += 4)
+        {
+            unsigned long long int i = index(k);
+            float *p0 = f + 2 * i;
+            float *p1 = f + 2 * (i | mask);
+            __m256 v0 = _mm256_loadu_ps(p0);
+            __m256 v1 = _mm256_loadu_ps(p1);
+            _mm256_storeu_ps(p0, _mm256_add_ps(cmulAvx2(v0, re[0], im[0]), cmulAvx2(v1, re[1], im[1])));
+            _mm256_storeu_ps(p1, _mm256_add_ps(cmulAvx2(v0, re[2], im[2]), cmulAvx2(v1, re[3], im[3])));
+        }
+    }
+
+    AVX2_TARGET void diagonalAvx2(std::complex<float> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                                  std::complex<float> d0, std::complex<float> d1, const StateIndex &index)
+    {
+        float *f = reinterpret_cast<float *>(q);
+        bool skipZero = d0 == std::complex<float>{1, 0};
+        __m256 re0 = _mm256_set1_ps(d0.real()), im0 = _mm256_set1_ps(d0.imag());
+        __m256 re1 = _mm256_set1_ps(d1.real()), im1 = _mm256_set1_ps(d1.imag());
+        unsigned long long int mask = 1ULL << target;
+        for (unsigned long long int k = kBegin; k < kEnd; k += 4)
+        {
+            unsigned long long int i = index(k);
+            if (!skipZero)
+                _mm256_storeu_ps(f + 2 * i, cmulAvx2(_mm256_loadu_ps(f + 2 * i), re0, im0));
+            float *p1 = f + 2 * (i | mask);
+            _mm256_storeu_ps(p1, cmulAvx2(_mm256_loadu_ps(p1), re1, im1));
+        }
+    }
+
+    AVX2_TARGET void antiDiagonalAvx2(std::complex<float> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                                      std::complex<float> p0, std::complex<float> p1, const StateIndex &index)
+    {
+        float *f = reinterpret_cast<float *>(q);
+        bool plainSwap = p0 == std::complex<float>{1, 0} && p1 == std::complex<float>{1, 0};
+        __m256 re0 = _mm256_set1_ps(p0.real()), im0 = _mm256_set1_ps(p0.imag());
+        __m256 re1 = _mm256_set1_ps(p1.real()), im1 = _mm256_set1_ps(p1.imag());
+        unsigned long long int mask = 1ULL << target;
+        for (unsigned long long int k = kBegin; k < kEnd; k += 4)
+        {
+            unsigned long long int i = index(k);
+            float *a0 = f + 2 * i;
+            float *a1 = f + 2 * (i | mask);
+            __m256 v0 = _mm256_loadu_ps(a0);
+            __m256 v1 = _mm256_loadu_ps(a1);
+            _mm256_storeu_ps(a0, plainSwap ? v1 : cmulAvx2(v1, re0, im0));
+            _mm256_storeu_ps(a1, plainSwap ? v0 : cmulAvx2(v0, re1, im1));
+        }
+    }
+
+    AVX2_TARGET void realMatrixAvx2(std::complex<float> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                                    const float *m, const StateIndex &index)
+    {
+        float *f = reinterpret_cast<float *>(q);
+        __m256 c[4];
+        for (int j = 0; j < 4; j++)
+            c[j] = _mm256_set1_ps(m[j]);
+        unsigned long long int mask = 1ULL << target;
+        for (unsigned long long int k = kBegin; k < kEnd; k += 4)
+        {
+            unsigned long long int i = index(k);
+            float *p0 = f + 2 * i;
+            float *p1 = f + 2 * (i | mask);
+            __m256 v0 = _mm256_loadu_ps(p0);
+            __m256 v1 = _mm256_loadu_ps(p1);
+            _mm256_storeu_ps(p0, _mm256_fmadd_ps(c[0], v0, _mm256_mul_ps(c[1], v1)));
+            _mm256_storeu_ps(p1, _mm256_fmadd_ps(c[2], v0, _mm256_mul_ps(c[3], v1)));
+        }
+    }
+
+    // AVX-512 kernels: a register holds 4 amplitudes, so they are used for target >= 2
+
+    AVX512_TARGET inline __m512d cmulAvx512(__m512d a, __m512d bRe, __m512d bIm)
+    {
+        return _mm512_fmaddsub_pd(a, bRe, _mm512_mul_pd(_mm512_mask_permute_pd(a, 0xFF, a, 0x55), bIm));
+    }
+
+    AVX512_TARGET void matrixAvx512(std::complex<double> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                                    const std::complex<double> *m, const StateIndex &index)
+    {
+        double *d = reinterpret_cast<double *>(q);
+        __m512d re[4], im[4];
+        for (int j = 0; j < 4; j++)
+        {
+            re[j] = _mm512_set1_pd(m[j].real());
+            im[j] = _mm512_set1_pd(m[j].imag());
+        }
+        unsigned long long int mask = 1ULL << target;
+        for (unsigned long long int k = kBegin; k < kEnd; k += 4)
+        {
+            unsigned long long int i = index(k);
+            double *p0 = d + 2 * i;
+            double *p1 = d + 2 * (i | mask);
+            __m512d v0 = _mm512_loadu_pd(p0);
+            __m512d v1 = _mm512_loadu_pd(p1);
+            _mm512_storeu_pd(p0, _mm512_add_pd(cmulAvx512(v0, re[0], im[0]), cmulAvx512(v1, re[1], im[1])));
+            _mm512_storeu_pd(p1, _mm512_add_pd(cmulAvx512(v0, re[2], im[2]), cmulAvx512(v1, re[3], im[3])));
+        }
+    }
+
+    AVX512_TARGET void diagonalAvx512(std::complex<double> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                                      std::complex<double> d0, std::complex<double> d1, const StateIndex &index)
+    {
+        double *d = reinterpret_cast<double *>(q);
+        bool skipZero = d0 == std::complex<double>{1, 0};
+        __m512d re0 = _mm512_set1_pd(d0.real()), im0 = _mm512_set1_pd(d0.imag());
+        __m512d re1 = _mm512_set1_pd(d1.real()), im1 = _mm512_set1_pd(d1.imag());
+        unsigned long long int mask = 1ULL << target;
+        for (unsigned long long int k = kBegin; k < kEnd; k += 4)
+        {
+            unsigned long long int i = index(k);
+            if (!skipZero)
+                _mm512_storeu_pd(d + 2 * i, cmulAvx512(_mm512_loadu_pd(d + 2 * i), re0, im0));
+            double *p1 = d + 2 * (i | mask);
+            _mm512_storeu_pd(p1, cmulAvx512(_mm512_loadu_pd(p1), re1, im1));
+        }
+    }
+
+    AVX512_TARGET void antiDiagonalAvx512(std::complex<double> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                                          std::complex<double> p0, std::complex<double> p1, const StateIndex &index)
+    {
+        double *d = reinterpret_cast<double *>(q);
+        bool plainSwap = p0 == std::complex<double>{1, 0} && p1 == std::complex<double>{1, 0};
+        __m512d re0 = _mm512_set1_pd(p0.real()), im0 = _mm512_set1_pd(p0.imag());
+        __m512d re1 = _mm512_set1_pd(p1.real()), im1 = _mm512_set1_pd(p1.imag());
+        unsigned long long int mask = 1ULL << target;
+        for (unsigned long long int k = kBegin; k < kEnd; k += 4)
+        {
+            unsigned long long int i = index(k);
+            double *a0 = d + 2 * i;
+            double *a1 = d + 2 * (i | mask);
+            __m512d v0 = _mm512_loadu_pd(a0);
+            __m512d v1 = _mm512_loadu_pd(a1);
+            _mm512_storeu_pd(a0, plainSwap ? v1 : cmulAvx512(v1, re0, im0));
+            _mm512_storeu_pd(a1, plainSwap ? v0 : cmulAvx512(v0, re1, im1));
+        }
+    }
+
+    AVX512_TARGET void realMatrixAvx512(std::complex<double> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                                        const double *m, const StateIndex &index)
+    {
+        double *d = reinterpret_cast<double *>(q);
+        __m512d c[4];
+        for (int j = 0; j < 4; j++)
+            c[j] = _mm512_set1_pd(m[j]);
+        unsigned long long int mask = 1ULL << target;
+        for (unsigned long long int k = kBegin; k < kEnd; k += 4)
+        {
+            unsigned long long int i = index(k);
+            double *p0 = d + 2 * i;
+            double *p1 = d + 2 * (i | mask);
+            __m512d v0 = _mm512_loadu_pd(p0);
+            __m512d v1 = _mm512_loadu_pd(p1);
+            _mm512_storeu_pd(p0, _mm512_fmadd_pd(c[0], v0, _mm512_mul_pd(c[1], v1)));
+            _mm512_storeu_pd(p1, _mm512_fmadd_pd(c[2], v0, _mm512_mul_pd(c[3], v1)));
+        }
+    }
+
+    // single precision AVX-512 kernels: a register holds 8 amplitudes, so they are used for target >= 3
+
+    AVX512_TARGET inline __m512 cmulAvx512(__m512 a, __m512 bRe, __m512 bIm)
+    {
+        return _mm512_fmaddsub_ps(a, bRe, _mm512_mul_ps(_mm512_mask_permute_ps(a, 0xFFFF, a, 0xB1), bIm));
+    }
+
+    AVX512_TARGET void matrixAvx512(std::complex<float> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                                    const std::complex<float> *m, const StateIndex &index)
+    {
+        float *f = reinterpret_cast<float *>(q);
+        __m512 re[4], im[4];
+        for (int j = 0; j < 4; j++)
+        {
+            re[j] = _mm512_set1_ps(m[j].real());
+            im[j] = _mm512_set1_ps(m[j].imag());
+        }
+        unsigned long long int mask = 1ULL << target;
+        for (unsigned long long int k = kBegin; k < kEnd; k += 8)
+        {
+            unsigned long long int i = index(k);
+            float *p0 = f + 2 * i;
+            float *p1 = f + 2 * (i | mask);
+            __m512 v0 = _mm512_loadu_ps(p0);
+            __m512 v1 = _mm512_loadu_ps(p1);
+            _mm512_storeu_ps(p0, _mm512_add_ps(cmulAvx512(v0, re[0], im[0]), cmulAvx512(v1, re[1], im[1])));
+            _mm512_storeu_ps(p1, _mm512_add_ps(cmulAvx512(v0, re[2], im[2]), cmulAvx512(v1, re[3], im[3])));
+        }
+    }
+
+    AVX512_TARGET void diagonalAvx512(std::complex<float> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                                      std::complex<float> d0, std::complex<float> d1, const StateIndex &index)
+    {
+        float *f = reinterpret_cast<float *>(q);
+        bool skipZero = d0 == std::complex<float>{1, 0};
+        __m512 re0 = _mm512_set1_ps(d0.real()), im0 = _mm512_set1_ps(d0.imag());
+        __m512 re1 = _mm512_set1_ps(d1.real()), im1 = _mm512_set1_ps(d1.imag());
+        unsigned long long int mask = 1ULL << target;
+        for (unsigned long long int k = kBegin; k < kEnd; k += 8)
+        {
+            unsigned long long int i = index(k);
+            if (!skipZero)
+                _mm512_storeu_ps(f + 2 * i, cmulAvx512(_mm512_loadu_ps(f + 2 * i), re0, im0));
+            float *p1 = f + 2 * (i | mask);
+            _mm512_storeu_ps(p1, cmulAvx512(_mm512_loadu_ps(p1), re1, im1));
+        }
+    }
+
+    AVX512_TARGET void antiDiagonalAvx512(std::complex<float> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                                          std::complex<float> p0, std::complex<float> p1, const StateIndex &index)
+    {
+        float *f = reinterpret_cast<float *>(q);
+        bool plainSwap = p0 == std::complex<float>{1, 0} && p1 == std::complex<float>{1, 0};
+        __m512 re0 = _mm512_set1_ps(p0.real()), im0 = _mm512_set1_ps(p0.imag());
+        __m512 re1 = _mm512_set1_ps(p1.real()), im1 = _mm512_set1_ps(p1.imag());
+        unsigned long long int mask = 1ULL << target;
+        for (unsigned long long int k = kBegin; k < kEnd; k += 8)
+        {
+            unsigned long long int i = index(k);
+            float *a0 = f + 2 * i;
+            float *a1 = f + 2 * (i | mask);
+            __m512 v0 = _mm512_loadu_ps(a0);
+            __m512 v1 = _mm512_loadu_ps(a1);
+            _mm512_storeu_ps(a0, plainSwap ? v1 : cmulAvx512(v1, re0, im0));
+            _mm512_storeu_ps(a1, plainSwap ? v0 : cmulAvx512(v0, re1, im1));
+        }
+    }
+
+    AVX512_TARGET void realMatrixAvx512(std::complex<float> *q, unsigned long long int kBegin, unsigned long long int kEnd, int target,
+                                        const float *m, const StateIndex &index)
+    {
+        float *f = reinterpret_cast<float *>(q);
+        __m512 c[4];
+        for (int j = 0; j < 4; j++)
+            c[j] = _mm512_set1_ps(m[j]);
+        unsigned long long int mask = 1ULL << target;
+        for (unsigned long long int k = kBegin; k < kEnd; k += 8)
+        {
+            unsigned long long int i = index(k);
+            float *p0 = f + 2 * i;
+            float *p1 = f + 2 * (i | mask);
+            __m512 v0 = _mm512_loadu_ps(p0);
+            __m512 v1 = _mm512_loadu_ps(p1);
+            _mm512_storeu_ps(p0, _mm512_fmadd_ps(c[0], v0, _mm512_mul_ps(c[1], v1)));
+            _mm512_storeu_ps(p1, _mm512_fmadd_ps(c[2], v0, _mm512_mul_ps(c[3], v1)));
+        }
+    }
+#endif
+
+    // picks the widest instruction set usable for a target, as a register must hold amplitudes of consecutive
+    // pairs (or a whole pair for target 0 in double precision); returns the number of pairs handled per iteration
+    template <typename T>
+    SimdLevel selectSimdLevel(const StateIndex &index, int target, unsigned long long int &step)
+    {
+        // amplitudes per AVX2 register
+        constexpr unsigned long long int avx2Width = 32 / sizeof(std::complex<T>);
+        unsigned long long int contiguous = 1ULL << index.lowestBit();
+        step = 1;
+        if (simdLevel == SimdLevel::avx512 && contiguous >= 2 * avx2Width)
+        {
+            step = 2 * avx2Width;
+            return SimdLevel::avx512;
+        }
+        if (simdLevel >= SimdLevel::avx2)
+        {
+            if (target == 0 && avx2Width == 2)
+                return SimdLevel::avx2;
+            if (contiguous >= avx2Width)
+            {
+                step = avx2Width;
+                return SimdLevel::avx2;
+            }
+        }
+        return SimdLevel::scalar;
+    }
+
+    // uncontrolled gates on the fixedTargetBits lowest bits use the kernels specialised on their target, which take
+    // whole blocks of 2^target pairs, when no vector kernel applies. They also replace the vector kernels on the
+    // targets below fixedSimdTargets for the matrices without complex products between amplitudes (real, diagonal
+    // and anti-diagonal), as a register holds less than two pairs there and the unrolled loops were measured faster.
+    // Controlled gates keep the kernels that only visit the pairs their controls select
+    bool useFixedTarget(SimdLevel &level, unsigned long long int ctrlMask, int target, MatrixType type, unsigned long long int &step)
+    {
+        if (ctrlMask != 0 || target >= fixedTargetBits)
+            return false;
+        if (level != SimdLevel::scalar && (type == MatrixType::dense || target >= fixedSimdTargets))
+            return false;
+        level = SimdLevel::scalar;
+        step = 1ULL << target;
+        return true;
+    }
+}
+
+namespace kernels
+{
+    SimdLevel getSupportedSimdLevel() { return supportedSimdLevel; }
+
+    SimdLevel getSimdLevel() { return simdLevel; }
+
+    void setSimdLevel(SimdLevel level)
+    {
+        simdLevel = std::min(level, supportedSimdLevel);
+    }
+
+    template <typename T>
+    void applyMatrix(std::complex<T> *q, unsigned long long int numStates, int target, const std::complex<T> m[4],
+                     unsigned long long int ctrlMask, int numThreads)
+    {
+        StateIndex index(&target, 1, ctrlMask);
+        unsigned long long int numPairs = index.numItems(numStates);
+        unsigned long long int step;
+        SimdLevel level = selectSimdLevel<T>(index, target, step);
+        bool fixed = useFixedTarget(level, ctrlMask, target, MatrixType::dense, step);
+        QSIM_PROFILE_SCOPE(pairKernelNames[static_cast<int>(MatrixType::dense)][static_cast<int>(level)]);
+        QSIM_PROFILE_WORK(2 * numPairs, 4 * numPairs * sizeof(std::complex<T>));
+        forEachRange(2 * numPairs, numPairs, step, numThreads, [&](unsigned long long int kBegin, unsigned long long int kEnd) {
+#ifdef QSIM_X86_SIMD
+            if (level == SimdLevel::avx512)
+                return matrixAvx512(q, kBegin, kEnd, target, m, index);
+            if (level == SimdLevel::avx2)
+                return matrixAvx2(q, kBegin, kEnd, target, m, index);
+#endif
+            if (fixed)
+                return matrixFixed(q, kBegin, kEnd, target, m);
+            matrixScalar(q, kBegin, kEnd, target, m, index);
+        });
+    }
+
+    template <typename T>
+    void applyDiagonal(std::complex<T> *q, unsigned long long int numStates, int target, std::complex<T> d0, std::complex<T> d1,
+                       unsigned long long int ctrlMask, int numThreads)
+    {
+        StateIndex index(&target, 1, ctrlMask);
+        unsigned long long int numPairs = index.numItems(numStates);
+        unsigned long long int step;
+        SimdLevel level = selectSimdLevel<T>(index, target, step);
+        bool fixed = useFixedTarget(level, ctrlMask, target, MatrixType::diagonal, step);
+        QSIM_PROFILE_SCOPE(pairKernelNames[static_cast<int>(MatrixType::diagonal)][static_cast<int>(level)]);
+        QSIM_PROFILE_WORK(2 * numPairs, 4 * numPairs * sizeof(std::complex<T>));
+        forEachRange(2 * numPairs, numPairs, step, numThreads, [&](unsigned long long int kBegin, unsigned long long int kEnd) {
+#ifdef QSIM_X86_SIMD
+            if (level == SimdLevel::avx512)
+                return diagonalAvx512(q, kBegin, kEnd, target, d0, d1, index);
+            if (level == SimdLevel::avx2)
+                return diagonalAvx2(q, kBegin, kEnd, target, d0, d1, index);
+#endif
+            if (fixed)
+                return diagonalFixed(q, kBegin, kEnd, target, d0, d1);
+            diagonalScalar(q, kBegin, kEnd, target, d0, d1, index);
+        });
+    }
+
+    template <typename T>
+    void applyAntiDiagonal(std::complex<T> *q, unsigned long long int numStates, int target, std::complex<T> p0, std::complex<T> p1,
+                           unsigned long long int ctrlMask, int numThreads)
+    {
+        StateIndex index(&target, 1, ctrlMask);
+        unsigned long long int numPairs = index.numItems(numStates);
+        unsigned long long int step;
+        SimdLevel level = selectSimdLevel<T>(index, target, step);
+        bool fixed = useFixedTarget(level, ctrlMask, target, MatrixType::permutation, step);
+        QSIM_PROFILE_SCOPE(pairKernelNames[static_cast<int>(MatrixType::permutation)][static_cast<int>(level)]);
+        QSIM_PROFILE_WORK(2 * numPairs, 4 * numPairs * sizeof(std::complex<T>));
+        forEachRange(2 * numPairs, numPairs, step, numThreads, [&](unsigned long long int kBegin, unsigned long long int kEnd) {
+#ifdef QSIM_X86_SIMD
+            if (level == SimdLevel::avx512)
+                return antiDiagonalAvx512(q, kBegin, kEnd, target, p0, p1, index);
+            if (level == SimdLevel::avx2)
+                return antiDiagonalAvx2(q, kBegin, kEnd, target, p0, p1, index);
+#endif
+            if (fixed)
+                return antiDiagonalFixed(q, kBegin, kEnd, target, p0, p1);
+            antiDiagonalScalar(q, kBegin, kEnd, target, p0, p1, index);
+        });
+    }
+
+    template <typename T>
+    void applyRealMatrix(std::complex<T> *q, unsigned long long int numStates, int target, const T m[4],
+                         unsigned long long int ctrlMask, int numThreads)
+    {
+        StateIndex index(&target, 1, ctrlMask);
+        unsigned long long int numPairs = index.numItems(numStates);
+        unsigned long long int step;
+        SimdLevel level = selectSimdLevel<T>(index, target, step);
+        bool fixed = useFixedTarget(level, ctrlMask, target, MatrixType::real, step);
+        QSIM_PROFILE_SCOPE(pairKernelNames[static_cast<int>(MatrixType::real)][static_cast<int>(level)]);
+        QSIM_PROFILE_WORK(2 * numPairs, 4 * numPairs * sizeof(std::complex<T>));
+        forEachRange(2 * numPairs, numPairs, step, numThreads, [&](unsigned long long int kBegin, unsigned long long int kEnd) {
+#ifdef QSIM_X86_SIMD
+            if (level == SimdLevel::avx512)
+                return realMatrixAvx512(q, kBegin, kEnd, target, m, index);
+            if (level == SimdLevel::avx2)
+                return realMatrixAvx2(q, kBegin, kEnd, target, m, index);
+#endif
+            if (fixed)
+                return realMatrixFixed(q, kBegin, kEnd, target, m);
+            realMatrixScalar(q, kBegin, kEnd, target, m, index);
+        });
+    }
+
+    template <typename T>
+    MatrixType classifyMatrix(const std::complex<T> *matrix, unsigned long long int dim)
+    {
+        bool diagonal = true;
+        bool real = true;
+        // a permutation (with phases) has exactly one non-zero entry in every row and column
+        bool permutation = true;
+        std::vector<int> columnCount(dim, 0);
+        for (unsigned long long int r = 0; r < dim; r++)
+        {
+            int rowCount{0};
+            for (unsigned long long int c = 0; c < dim; c++)
+            {
+                std::complex<T> entry = matrix[r * dim + c];
+                if (entry.imag() != 0)
+                    real = false;
+                if (entry == constants<T>::zeroComplex)
+                    continue;
+                if (r != c)
+                    diagonal = false;
+                rowCount++;
+                columnCount[c]++;
+            }
+            if (rowCount != 1)
+                permutation = false;
+        }
+        for (unsigned long long int c = 0; c < dim; c++)
+            if (columnCount[c] != 1)
+                permutation = false;
+        if (diagonal)
+            return MatrixType::diagonal;
+        if (permutation)
+            return MatrixType::permutation;
+        return real ? MatrixType::real : MatrixType::dense;
+    }
+
+    template <typename T>
+    void applyUnitary(std::complex<T> *q, unsigned long long int numStates, const int *targets, int numTargets,
+                      const std::complex<T> *matrix, unsigned long long int ctrlMask, int numThreads)
+    {
+        unsigned long long int dim = 1ULL << numTargets;
+        MatrixType type = classifyMatrix(matrix, dim);
+        // single qubit matrices use the vectorised pair kernels
+        if (numTargets == 1)
+        {
+            int target = targets[0];
+            switch (type)
+            {
+            case MatrixType::diagonal:
+                return applyDiagonal(q, numStates, target, matrix[0], matrix[3], ctrlMask, numThreads);
+            case MatrixType::permutation:
+                return applyAntiDiagonal(q, numStates, target, matrix[1], matrix[2], ctrlMask, numThreads);
+            case MatrixType::real:
+            {
+                T m[4]{matrix[0].real(), matrix[1].real(), matrix[2].real(), matrix[3].real()};
+                return applyRealMatrix(q, numStates, target, m, ctrlMask, numThreads);
+            }
+            default:
+                return applyMatrix(q, numStates, target, matrix, ctrlMask, numThreads);
+            }
+        }
+        // offset of every target bit pattern from the start of a group, targets[j] being bit j of the pattern
+        std::vector<unsigned long long int> offsets(dim, 0);
+        for (unsigned long long int r = 0; r < dim; r++)
+            for (int j = 0; j < numTargets; j++)
+                if (r & (1ULL << j))
+                    offsets[r] |= 1ULL << targets[j];
+        StateIndex index(targets, numTargets, ctrlMask);
+        const unsigned long long int *offset = offsets.data();
+        unsigned long long int numGroups = index.numItems(numStates);
+        unsigned long long int numTouched = numGroups << numTargets;
+        QSIM_PROFILE_SCOPE(groupKernelNames[static_cast<int>(type)]);
+        QSIM_PROFILE_WORK(numTouched, 2 * numTouched * sizeof(std::complex<T>));
+        switch (type)
+        {
+        case MatrixType::diagonal:
+        {
+            std::vector<std::complex<T>> diagonal(dim);
+            for (unsigned long long int r = 0; r < dim; r++)
+                diagonal[r] = matrix[r * dim + r];
+            forEachRange(numTouched, numGroups, 1, numThreads, [&](unsigned long long int gBegin, unsigned long long int gEnd) {
+                diagonalGroups(q, gBegin, gEnd, offset, diagonal.data(), dim, index);
+            });
+            break;
+        }
+        case MatrixType::permutation:
+        {
+            std::vector<unsigned long long int> columns(dim);
+            std::vector<std::complex<T>> values(dim);
+            for (unsigned long long int r = 0; r < dim; r++)
+                for (unsigned long long int c = 0; c < dim; c++)
+                    if (matrix[r * dim + c] != constants<T>::zeroComplex)
+                    {
+                        columns[r] = c;
+                        values[r] = matrix[r * dim + c];
+                    }
+            forEachRange(numTouched, numGroups, 1, numThreads, [&](unsigned long long int gBegin, unsigned long long int gEnd) {
+                permutationGroups(q, gBegin, gEnd, offset, columns.data(), values.data(), dim, index);
+            });
+            break;
+        }
+        case MatrixType::real:
+        {
+            std::vector<T> m(dim * dim);
+            for (unsigned long long int j = 0; j < dim * dim; j++)
+                m[j] = matrix[j].real();
+            forEachRange(numTouched, numGroups, 1, numThreads, [&](unsigned long long int gBegin, unsigned long long int gEnd) {
+                if (dim == 4)
+                    return matrixGroups<4>(q, gBegin, gEnd, offset, m.data(), dim, index);
+                matrixGroups<0>(q, gBegin, gEnd, offset, m.data(), dim, index);
+            });
+            break;
+        }
+        default:
+            forEachRange(numTouched, numGroups, 1, numThreads, [&](unsigned long long int gBegin, unsigned long long int gEnd) {
+                if (dim == 4)
+                    return matrixGroups<4>(q, gBegin, gEnd, offset, matrix, dim, index);
+                matrixGroups<0>(q, gBegin, gEnd, offset, matrix, dim, index);
+            });
+        }
+    }
+
+    template <typename T>
+    void applyUnitarySparse(basicSparseLayer<T> &q, const int *targets, int numTargets, const std::complex<T> *matrix,
+                            unsigned long long int ctrlMask)
+    {
+        unsigned long long int dim = 1ULL << numTargets;
+        unsigned long long int targetMask{0};
+        std::vector<unsigned long long int> offsets(dim, 0);
+        for (int j = 0; j < numTargets; j++)
+            targetMask |= 1ULL << targets[j];
+        for (unsigned long long int r = 0; r < dim; r++)
+            for (int j = 0; j < numTargets; j++)
+                if (r & (1ULL << j))
+                    offsets[r] |= 1ULL << targets[j];
+        // only the groups holding a non-zero amplitude with the controls set can change
+        std::vector<unsigned long long int> bases;
+        bases.reserve(q.size());
+        for (const auto &amplitude : q)
+            if ((amplitude.first & ctrlMask) == ctrlMask)
+                bases.push_back(amplitude.first & ~targetMask);
+        std::sort(bases.begin(), bases.end());
+        bases.erase(std::unique(bases.begin(), bases.end()), bases.end());
+        QSIM_PROFILE_SCOPE("sparse groups");
+        QSIM_PROFILE_WORK(bases.size() * dim, 2 * bases.size() * dim * sizeof(std::complex<T>));
+        std::vector<std::complex<T>> in(dim);
+        for (unsigned long long int base : bases)
+        {
+            for (unsigned long long int c = 0; c < dim; c++)
+            {
+                auto amplitude = q.find(base | offsets[c]);
+                in[c] = amplitude == q.end() ? constants<T>::zeroComplex : amplitude->second;
+            }
+            for (unsigned long long int r = 0; r < dim; r++)
+            {
+                std::complex<T> out{0, 0};
+                for (unsigned long long int c = 0; c < dim; c++)
+                    if (in[c] != constants<T>::zeroComplex)
+                        out += matrix[r * dim + c] * in[c];
+                if (std::abs(out) > constants<T>::sparseZero)
+                    q[base | offsets[r]] = out;
+                else
+                    q.erase(base | offsets[r]);
+            }
+        }
+    }
+
+    template <typename T>
+    void applyDiagonals(std::complex<T> *q, unsigned long long int numStates, const std::vector<DiagonalGate<T>> &gates, int numThreads)
+    {
+        // a gate applied on its own only visits the states its controls select
+        auto applyAlone = [&](const DiagonalGate<T> &gate)
+        {
+            unsigned long long int dim = gate.diagonal.size();
+            std::vector<std::complex<T>> matrix(dim * dim, constants<T>::zeroComplex);
+            for (unsigned long long int r = 0; r < dim; r++)
+                matrix[r * dim + r] = gate.diagonal[r];
+            applyUnitary(q, numStates, gate.targets.data(), gate.targets.size(), matrix.data(), gate.ctrlMask, numThreads);
+        };
+        // a controlled gate whose qubits span bytes would be evaluated at every index of the pass, so it goes to the
+        // controlled kernel instead, which touches 2^-c of the states; the other gates share one pass
+        std::vector<DiagonalGate<T>> layer;
+        for (const DiagonalGate<T> &gate : gates)
+            if (gate.ctrlMask != 0 && byteOf(gate) < 0)
+                applyAlone(gate);
+            else
+                layer.push_back(gate);
+        if (layer.size() <= 1)
+        {
+            for (const DiagonalGate<T> &gate : layer)
+                applyAlone(gate);
+            return;
+        }
+        PhaseTables<T> phases(layer);
+        QSIM_PROFILE_SCOPE("diagonal layer");
+        QSIM_PROFILE_WORK(numStates, 2 * numStates * sizeof(std::complex<T>));
+        forEachRange(numStates, numStates, 1, numThreads, [&](unsigned long long int begin, unsigned long long int end) {
+            for (unsigned long long int i = begin; i < end; i++)
+                q[i] *= phases(i);
+        });
+    }
+
+    template <typename T>
+    void applyDiagonalsSparse(basicSparseLayer<T> &q, const std::vector<DiagonalGate<T>> &gates)
+    {
+        PhaseTables<T> phases(gates);
+        QSIM_PROFILE_SCOPE("sparse diagonal layer");
+        QSIM_PROFILE_WORK(q.size(), 2 * q.size() * sizeof(std::complex<T>));
+        for (auto amplitude = q.begin(); amplitude != q.end();)
+        {
+            amplitude->second *= phases(amplitude->first);
+            // a diagonal gate can only zero an amplitude if it is not unitary
+            if (std::abs(amplitude->second) > constants<T>::sparseZero)
+                amplitude++;
+            else
+                amplitude = q.erase(amplitude);
+        }
+    }
+
+    template <typename T>
+    void applyDiffusion(std::complex<T> *q, unsigned long long int numStates, const int *qubits, int numQubits, int numThreads)
+    {
+        // a group is numbered by the bits of the other qubits and its members by the bits of the diffused qubits
+        unsigned long long int qubitMask{0};
+        for (int j = 0; j < numQubits; j++)
+            qubitMask |= 1ULL << qubits[j];
+        std::vector<int> others;
+        for (int bit = 0; (1ULL << bit) < numStates; bit++)
+            if (!(qubitMask & (1ULL << bit)))
+                others.push_back(bit);
+        StateIndex group(qubits, numQubits, 0);
+        StateIndex member(others.data(), others.size(), 0);
+        unsigned long long int numGroups = group.numItems(numStates);
+        unsigned long long int groupSize = numStates / numGroups;
+        QSIM_PROFILE_SCOPE("diffusion");
+        QSIM_PROFILE_WORK(numStates, 3 * numStates * sizeof(std::complex<T>));
+        // the members of a group are contiguous when the lowest qubits are diffused, e.g. all of them
+        if (qubitMask == groupSize - 1)
+            return diffusionGroups(q, group, numGroups, groupSize, [](unsigned long long int m) { return m; }, numThreads);
+        diffusionGroups(q, group, numGroups, groupSize, member, numThreads);
+    }
+
+    template <typename T>
+    void applyDiffusionSparse(basicSparseLayer<T> &q, const int *qubits, int numQubits)
+    {
+        unsigned long long int qubitMask{0};
+        for (int j = 0; j < numQubits; j++)
+            qubitMask |= 1ULL << qubits[j];
+        unsigned long long int groupSize = 1ULL << numQubits;
+        std::unordered_map<unsigned long long int, std::complex<double>> sums;
+        for (const auto &amplitude : q)
+            sums[amplitude.first & ~qubitMask] += std::complex<double>(amplitude.second);
+        QSIM_PROFILE_SCOPE("sparse diffusion");
+        QSIM_PROFILE_WORK(q.size(), 3 * q.size() * sizeof(std::complex<T>));
+        // a group with a zero mean is only negated, any other one fills up with 2m minus its stored amplitudes
+        for (auto amplitude = q.begin(); amplitude != q.end(); amplitude++)
+            if (std::abs(sums[amplitude->first & ~qubitMask]) * 2 / groupSize <= constants<T>::sparseZero)
+                amplitude->second = -amplitude->second;
+        for (const auto &group : sums)
+        {
+            std::complex<T> twiceMean(group.second * (2.0 / groupSize));
+            if (std::abs(twiceMean) <= constants<T>::sparseZero)
+                continue;
+            for (unsigned long long int m = 0; m < groupSize; m++)
+            {
+                unsigned long long int i = group.first;
+                for (int j = 0; j < numQubits; j++)
+                    if (m & (1ULL << j))
+                        i |= 1ULL << qubits[j];
+                auto amplitude = q.find(i);
+                std::complex<T> out = twiceMean - (amplitude == q.end() ? constants<T>::zeroComplex : amplitude->second);
+                if (std::abs(out) > constants<T>::sparseZero)
+                    q[i] = out;
+                else if (amplitude != q.end())
+                    q.erase(amplitude);
+            }
+        }
+    }
+
+    // the kernels are only instantiated for single and double precision amplitudes
+    template MatrixType classifyMatrix(const std::complex<float> *, unsigned long long int);
+    template MatrixType classifyMatrix(const std::complex<double> *, unsigned long long int);
+    template void applyUnitary(std::complex<float> *, unsigned long long int, const int *, int, const std::complex<float> *,
+                               unsigned long long int, int);
+    template void applyUnitary(std::complex<double> *, unsigned long long int, const int *, int, const std::complex<double> *,
+                               unsigned long long int, int);
+    template void applyUnitarySparse(basicSparseLayer<float> &, const int *, int, const std::complex<float> *, unsigned long long int);
+    template void applyUnitarySparse(basicSparseLayer<double> &, const int *, int, const std::complex<double> *, unsigned long long int);
+    template void applyMatrix(std::complex<float> *, unsigned long long int, int, const std::complex<float>[4], unsigned long long int, int);
+    template void applyMatrix(std::complex<double> *, unsigned long long int, int, const std::complex<double>[4], unsigned long long int, int);
+    template void applyRealMatrix(std::complex<float> *, unsigned long long int, int, const float[4], unsigned long long int, int);
+    template void applyRealMatrix(std::complex<double> *, unsigned long long int, int, const double[4], unsigned long long int, int);
+    template void applyDiagonal(std::complex<float> *, unsigned long long int, int, std::complex<float>, std::complex<float>,
+                                unsigned long long int, int);
+    template void applyDiagonal(std::complex<double> *, unsigned long long int, int, std::complex<double>, std::complex<double>,
+                                unsigned long long int, int);
+    template void applyAntiDiagonal(std::complex<float> *, unsigned long long int, int, std::complex<float>, std::complex<float>,
+                                    unsigned long long int, int);
+    template void applyAntiDiagonal(std::complex<double> *, unsigned long long int, int, std::complex<double>, std::complex<double>,
+                                    unsigned long long int, int);
+    template void applyDiagonals(std::complex<float> *, unsigned long long int, const std::vector<DiagonalGate<float>> &, int);
+    template void applyDiagonals(std::complex<double> *, unsigned long long int, const std::vector<DiagonalGate<double>> &, int);
+    template void applyDiagonalsSparse(basicSparseLayer<float> &, const std::vector<DiagonalGate<float>> &);
+    template void applyDiagonalsSparse(basicSparseLayer<double> &, const std::vector<DiagonalGate<double>> &);
+    template void applyDiffusion(std::complex<float> *, unsigned long long int, const int *, int, int);
+    template void applyDiffusion(std::complex<double> *, unsigned long long int, const int *, int, int);
+    template void applyDiffusionSparse(basicSparseLayer<float> &, const int *, int);
+    template void applyDiffusionSparse(basicSparseLayer<double> &, const int *, int);
+}
@@ -0,0 +1,149 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+#include <vector>
+#include "definitions.hpp"
+
+// instruction sets the amplitude kernels can be vectorised with
+enum class SimdLevel
+{
+    scalar,
+    avx2,
+    avx512
+};
+
+// structure of a gate matrix, from the cheapest to the most expensive to apply
+enum class MatrixType
+{
+    diagonal,
+    permutation,
+    real,
+    dense
+};
+
+// the amplitude kernels are templates on the scalar type of the amplitudes, instantiated for float and double
+namespace kernels
+{
+    /**
+     * Diagonal gate waiting to be applied: the states whose index has all the bits of ctrlMask set are multiplied by
+     * diagonal[r], r being the pattern of their target bits (targets[j] being bit j of r).
+     */
+    template <typename T>
+    struct DiagonalGate
+    {
+        std::vector<int> targets;
+        unsigned long long int ctrlMask;
+        std::vector<std::complex<T>> diagonal;
+    };
+
+    /**
+     * Returns the best instruction set supported by the CPU (detected with CPUID).
+     */
+    SimdLevel getSupportedSimdLevel();
+    /**
+     * Returns the instruction set currently used by the kernels.
+     */
+    SimdLevel getSimdLevel();
+    /**
+     * Selects the instruction set used by the kernels, capped at the one supported by the CPU.
+     * @param level instruction set to use
+     */
+    void setSimdLevel(SimdLevel level);
+
+    /**
+     * Inserts a 0 at the target bit of a pair number to get the index of the |0> state of the pair.
+     */
+    inline unsigned long long int pairIndex(unsigned long long int pair, int target)
+    {
+        unsigned long long int lowMask = (1ULL << target) - 1;
+        return ((pair & ~lowMask) << 1) | (pair & lowMask);
+    }
+
+    /**
+     * Inserts a 0 at each of the bits (sorted in ascending order) of a number.
+     */
+    inline unsigned long long int insertZeroBits(unsigned long long int value, const int *sortedBits, int numBits)
+    {
+        for (int j = 0; j < numBits; j++)
+            value = pairIndex(value, sortedBits[j]);
+        return value;
+    }
+
+    /**
+     * Finds the cheapest structure a dim x dim row-major matrix has. Permutations may carry phases,
+     * i.e. every row and column has exactly one non-zero entry.
+     */
+    template <typename T>
+    MatrixType classifyMatrix(const std::complex<T> *matrix, unsigned long long int dim);
+
+    /**
+     * Applies a 2^k x 2^k row-major matrix to k target qubits, targets[j] being bit j of the row and column
+     * numbers, on the states whose index has all the bits of ctrlMask set. The matrix is classified first
+     * and applied with the cheapest kernel for its structure.
+     */
+    template <typename T>
+    void applyUnitary(std::complex<T> *q, unsigned long long int numStates, const int *targets, int numTargets,
+                      const std::complex<T> *matrix, unsigned long long int ctrlMask, int numThreads);
+
+    /**
+     * Same as applyUnitary for a sparse state, which only visits the groups of states holding a non-zero amplitude.
+     * Amplitudes that become smaller than constants<T>::sparseZero are removed.
+     */
+    template <typename T>
+    void applyUnitarySparse(basicSparseLayer<T> &q, const int *targets, int numTargets, const std::complex<T> *matrix,
+                            unsigned long long int ctrlMask);
+
+    /**
+     * Applies the 2x2 matrix {m[0], m[1]; m[2], m[3]} to every amplitude pair of the target qubit
+     * whose index has all the bits of ctrlMask set. Only those pairs are visited, so a gate with c controls
+     * touches 2^(n-c) amplitudes.
+     */
+    template <typename T>
+    void applyMatrix(std::complex<T> *q, unsigned long long int numStates, int target, const std::complex<T> m[4],
+                     unsigned long long int ctrlMask, int numThreads);
+    /**
+     * Same as applyMatrix for a matrix with real entries, which needs half the multiplications.
+     */
+    template <typename T>
+    void applyRealMatrix(std::complex<T> *q, unsigned long long int numStates, int target, const T m[4],
+                         unsigned long long int ctrlMask, int numThreads);
+    /**
+     * Multiplies the |0> amplitude of every pair by d0 and the |1> amplitude by d1.
+     */
+    template <typename T>
+    void applyDiagonal(std::complex<T> *q, unsigned long long int numStates, int target, std::complex<T> d0, std::complex<T> d1,
+                       unsigned long long int ctrlMask, int numThreads);
+    /**
+     * Swaps the amplitudes of every pair and multiplies the new |0> amplitude by p0 and the new |1> amplitude by p1.
+     */
+    template <typename T>
+    void applyAntiDiagonal(std::complex<T> *q, unsigned long long int numStates, int target, std::complex<T> p0, std::complex<T> p1,
+                           unsigned long long int ctrlMask, int numThreads);
+    /**
+     * Applies diagonal gates in a single pass, multiplying every amplitude by its combined phase. The gates whose qubits
+     * all lie in the same byte of the state index are folded into a table of 256 phases for that byte, so each
+     * amplitude costs one lookup per such byte plus one per uncontrolled gate spanning several bytes. Controlled gates
+     * spanning several bytes are applied on their own with the controlled kernel, which only visits the states their
+     * controls select.
+     */
+    template <typename T>
+    void applyDiagonals(std::complex<T> *q, unsigned long long int numStates, const std::vector<DiagonalGate<T>> &gates, int numThreads);
+    /**
+     * Same as applyDiagonals for a sparse state.
+     */
+    template <typename T>
+    void applyDiagonalsSparse(basicSparseLayer<T> &q, const std::vector<DiagonalGate<T>> &gates);
+    /**
+     * Applies the Grover diffusion operator 2|s><s| - I to some qubits, |s> being their uniform superposition, i.e.
+     * maps every amplitude a to 2m - a, m being the mean of the 2^k amplitudes that only differ in those qubits.
+     * Each group is summed in one read-only pass and updated in a second one.
+     */
+    template <typename T>
+    void applyDiffusion(std::complex<T> *q, unsigned long long int numStates, const int *qubits, int numQubits, int numThreads);
+    /**
+     * Same as applyDiffusion for a sparse state. Groups without any stored amplitude are left alone, as their mean is 0.
+     */
+    template <typename T>
+    void applyDiffusionSparse(basicSparseLayer<T> &q, const int *qubits, int numQubits);
+}
+
+#endif
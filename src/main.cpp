@@ -2,6 +2,7 @@
 #include <complex>
 #include <chrono>
 #include "QubitLayer.hpp"
+#include "profiler.hpp"
 #include "../examples/qAlgorithms.hpp"
 
 int main(int argc, char *argv[])
@@ -12,4 +13,8 @@ int main(int argc, char *argv[])
     auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
     std::cout << "Execution time: " << duration << " µs" << std::endl;
     q.printMeasurement();
+#ifdef QSIM_PROFILE
+    profiler::printSummary();
+    profiler::writeTrace("trace.json");
+#endif
 }
\ No newline at end of file
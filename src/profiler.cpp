@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "profiler.hpp"
+#include "definitions.hpp"
+
+namespace
+{
+    // a call of a scope on the timeline
+    struct Event
+    {
+        const char *name;
+        unsigned int thread;
+        unsigned long long int start;
+        unsigned long long int duration;
+        unsigned long long int amplitudes;
+        unsigned long long int bytes;
+    };
+
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    std::atomic<unsigned int> numThreadIds{0};
+    // every thread gets a small id the first time it opens a scope
+    thread_local unsigned int threadId = numThreadIds++;
+    // innermost scope open on this thread
+    thread_local profiler::Scope *innermost = nullptr;
+
+    // scopes end on every thread, so the counters and the timeline are shared under a lock, which is cheap next to
+    // the gates the scopes time
+    std::mutex lock;
+    std::map<std::pair<std::string, unsigned int>, profiler::Counters> counters; // by name and thread
+    std::vector<Event> events;
+
+    unsigned long long int now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    // names in a JSON string, escaping the characters JSON does not allow as they are
+    std::string jsonString(const std::string &text)
+    {
+        std::string escaped = "\"";
+        for (char c : text)
+            if (c == '"' || c == '\\')
+                escaped += std::string("\\") + c;
+            else if (static_cast<unsigned char>(c) >= 0x20)
+                escaped += c;
+        return escaped + "\"";
+    }
+}
+
+namespace profiler
+{
+    Scope::Scope(const char *name) : name(name), start(now()), parent(innermost)
+    {
+        innermost = this;
+    }
+
+    Scope::~Scope()
+    {
+        unsigned long long int duration = now() - start;
+        innermost = parent;
+        std::lock_guard<std::mutex> guard(lock);
+        Counters &total = counters[{name, threadId}];
+        total.calls++;
+        total.ns += duration;
+        total.amplitudes += amplitudes;
+        total.bytes += bytes;
+        if (events.size() < maxProfileEvents)
+            events.push_back({name, threadId, start, duration, amplitudes, bytes});
+    }
+
+    void addWork(unsigned long long int amplitudes, unsigned long long int bytes)
+    {
+        for (Scope *scope = innermost; scope != nullptr; scope = scope->parent)
+        {
+            scope->amplitudes += amplitudes;
+            scope->bytes += bytes;
+        }
+    }
+
+    Counters getCounters(const std::string &name)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Counters result{0, 0, 0, 0};
+        for (const auto &total : counters)
+            if (total.first.first == name)
+            {
+                result.calls += total.second.calls;
+                result.ns += total.second.ns;
+                result.amplitudes += total.second.amplitudes;
+                result.bytes += total.second.bytes;
+            }
+        return result;
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        counters.clear();
+        events.clear();
+    }
+
+    void printSummary()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        // totals of every name, and the time of its busiest thread
+        struct Summary
+        {
+            std::string name;
+            Counters total;
+            unsigned int numThreads;
+            unsigned long long int maxThreadNs;
+        };
+        std::vector<Summary> summaries;
+        for (const auto &total : counters)
+        {
+            if (summaries.empty() || summaries.back().name != total.first.first)
+                summaries.push_back({total.first.first, {0, 0, 0, 0}, 0, 0});
+            Summary &summary = summaries.back();
+            summary.total.calls += total.second.calls;
+            summary.total.ns += total.second.ns;
+            summary.total.amplitudes += total.second.amplitudes;
+            summary.total.bytes += total.second.bytes;
+            summary.numThreads++;
+            summary.maxThreadNs = std::max(summary.maxThreadNs, total.second.ns);
+        }
+        std::sort(summaries.begin(), summaries.end(), [](const Summary &a, const Summary &b)
+                  { return a.total.ns > b.total.ns; });
+        std::cout << "\033[34;34m-------------Profile-------------\033[m" << std::endl;
+        std::cout << std::left << std::setw(24) << "Name" << std::right << std::setw(10) << "Calls" << std::setw(12) << "Time (ms)"
+                  << std::setw(16) << "Amplitudes" << std::setw(10) << "GB/s" << std::setw(9) << "Threads" << std::setw(9)
+                  << "Balance" << std::endl;
+        for (const Summary &summary : summaries)
+        {
+            double meanThreadNs = static_cast<double>(summary.total.ns) / summary.numThreads;
+            std::cout << std::left << std::setw(24) << summary.name << std::right << std::setw(10) << summary.total.calls
+                      << std::fixed << std::setprecision(3) << std::setw(12) << summary.total.ns / 1e6 << std::setw(16)
+                      << summary.total.amplitudes << std::setprecision(2) << std::setw(10)
+                      << (summary.total.ns > 0 ? static_cast<double>(summary.total.bytes) / summary.total.ns : 0.0)
+                      << std::setw(9) << summary.numThreads << std::setw(9)
+                      << (meanThreadNs > 0 ? summary.maxThreadNs / meanThreadNs : 1.0) << std::defaultfloat << std::endl;
+        }
+        if (events.size() >= maxProfileEvents)
+            std::cout << "Timeline truncated to " << maxProfileEvents << " events" << std::endl;
+    }
+
+    void writeTrace(const std::string &path)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        std::ofstream trace(path);
+        if (!trace)
+        {
+            std::cout << "\033[31;31m[Error]\033[m" << std::endl;
+            std::cout << "Trace file:                 " << path << std::endl;
+            std::cout << "Reason:                     cannot be opened" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        // complete events, with times in µs
+        trace << "{\"traceEvents\":[";
+        for (unsigned long long int i = 0; i < events.size(); i++)
+        {
+            const Event &event = events[i];
+            trace << (i > 0 ? ",\n" : "\n") << "{\"name\":" << jsonString(event.name) << ",\"cat\":\"qsim\",\"ph\":\"X\",\"ts\":"
+                  << std::fixed << std::setprecision(3) << event.start / 1e3 << ",\"dur\":" << event.duration / 1e3
+                  << std::defaultfloat << ",\"pid\":1,\"tid\":" << event.thread << ",\"args\":{\"amplitudes\":"
+                  << event.amplitudes << ",\"bytes\":" << event.bytes << "}}";
+        }
+        trace << "\n],\"displayTimeUnit\":\"ns\"}\n";
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+#include <string>
+
+// the hot paths are only instrumented when compiled with -DQSIM_PROFILE (make PROFILE=1), otherwise the macros expand
+// to nothing, so the gates and kernels run exactly the same code as without the profiler
+#ifdef QSIM_PROFILE
+#define QSIM_PROFILE_SCOPE(name) profiler::Scope qsimProfileScope(name)
+#define QSIM_PROFILE_WORK(amplitudes, bytes) profiler::addWork(amplitudes, bytes)
+#else
+#define QSIM_PROFILE_SCOPE(name)
+#define QSIM_PROFILE_WORK(amplitudes, bytes)
+#endif
+
+namespace profiler
+{
+    /**
+     * Times the code from its construction to the end of its block as one call of name on the calling thread, and
+     * records it as an event of the timeline. Scopes nest within a thread.
+     */
+    class Scope
+    {
+    public:
+        /**
+         * @param name name the call is counted under, a string literal as it is kept until the scope ends
+         */
+        explicit Scope(const char *name);
+        ~Scope();
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        friend void addWork(unsigned long long int amplitudes, unsigned long long int bytes);
+        const char *name;
+        unsigned long long int start; // ns since the profiler started
+        unsigned long long int amplitudes = 0;
+        unsigned long long int bytes = 0;
+        Scope *parent;
+    };
+
+    // totals of the calls of a name
+    struct Counters
+    {
+        unsigned long long int calls;
+        unsigned long long int ns;
+        unsigned long long int amplitudes;
+        unsigned long long int bytes;
+    };
+
+    /**
+     * Adds amplitudes touched and bytes moved to every scope open on the calling thread.
+     */
+    void addWork(unsigned long long int amplitudes, unsigned long long int bytes);
+    /**
+     * Returns the totals of the calls of name over all the threads.
+     */
+    Counters getCounters(const std::string &name);
+    /**
+     * Discards the counters and the timeline recorded so far.
+     */
+    void reset();
+    /**
+     * Prints the calls, time, amplitudes and bandwidth of every name, and how evenly the names run by several threads
+     * were spread over them (the busiest thread's time over the mean time per thread).
+     */
+    void printSummary();
+    /**
+     * Writes the timeline in the Chrome trace event format, to be opened in chrome://tracing or Perfetto.
+     * @param path file to write
+     */
+    void writeTrace(const std::string &path);
+}
+
+#endif
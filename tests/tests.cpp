@@ -1,6 +1,14 @@
 #include <iostream>
 #include <cassert>
+#include <fstream>
 #include "../src/QubitLayer.hpp"
+#include "../src/kernels.hpp"
+#include "../src/Circuit.hpp"
+#include "../src/StabilizerLayer.hpp"
+#include "../src/JobRunner.hpp"
+#include "../src/StaticQubitLayer.hpp"
+#include "../src/gates.hpp"
+#include "../src/profiler.hpp"
 #include "tests.hpp"
 
 // list of quantum gates
@@ -86,11 +94,1205 @@ bool testGate(Gates gate)
     bool testResult = true;
     // iterate over the states to check if the gates work
     for (unsigned long long int i = 0; i < q.getNumStates(); i++)
-        testResult = *(q.getQubitLayerOdd() + i) == testerGate.outputState[i] && testResult;
+        testResult = *(q.getQubitLayer() + i) == testerGate.outputState[i] && testResult;
     std::cout << testerGate.gateName << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
     return testResult;
 }
 
+bool testParallel()
+{
+    // use enough qubits for the gates to be spread over threads
+    unsigned int numQubits = 15;
+    QubitLayer serial(numQubits);
+    QubitLayer parallel(numQubits);
+    serial.setNumThreads(1);
+    parallel.setNumThreads(4);
+    int ctrlQubits[3]{0, 7, 14};
+    for (QubitLayer *q : {&serial, &parallel})
+    {
+        for (unsigned int i = 0; i < numQubits; i++)
+            q->applyHadamard(i);
+        q->applyRx(3, pi / 3);
+        q->applyRy(14, pi / 5);
+        q->applyRz(0, pi / 7);
+        q->applyPauliY(9);
+        q->applyCnot(14, 2);
+        q->applyMcphase(ctrlQubits, 3, 5);
+    }
+    // the threads must produce exactly the same amplitudes as a single thread
+    bool testResult = serial.getMaxAmplitude().state == parallel.getMaxAmplitude().state;
+    for (unsigned long long int i = 0; i < serial.getNumStates(); i++)
+        testResult = serial.getQubitLayer()[i] == parallel.getQubitLayer()[i] && testResult;
+    std::cout << "Parallel" << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+// applies every gate on every target so all the kernel paths (low and high strides) are used
+template <typename T>
+void runSimdCircuit(BasicQubitLayer<T> &q)
+{
+    unsigned int numQubits = q.getNumQubits();
+    for (unsigned int i = 0; i < numQubits; i++)
+        q.applyHadamard(i);
+    for (unsigned int i = 0; i < numQubits; i++)
+    {
+        int ctrlQubits[2]{static_cast<int>((i + 1) % numQubits), static_cast<int>((i + 3) % numQubits)};
+        q.applyRx(i, pi / (i + 2));
+        q.applyRy(i, pi / (i + 3));
+        q.applyRz(i, pi / (i + 4));
+        q.applyPauliY(i);
+        q.applyCnot(ctrlQubits[0], i);
+        q.applyMcphase(ctrlQubits, 2, i);
+        q.applyHadamard(i);
+    }
+}
+
+bool testSimd()
+{
+    unsigned int numQubits = 6;
+    SimdLevel supported = kernels::getSupportedSimdLevel();
+    kernels::setSimdLevel(SimdLevel::scalar);
+    QubitLayer reference(numQubits);
+    runSimdCircuit(reference);
+    bool testResult = true;
+    for (SimdLevel level : {SimdLevel::avx2, SimdLevel::avx512})
+    {
+        if (level > supported)
+            continue;
+        kernels::setSimdLevel(level);
+        QubitLayer q(numQubits);
+        runSimdCircuit(q);
+        // the vector kernels use fused multiply-adds so only agree up to rounding
+        for (unsigned long long int i = 0; i < q.getNumStates(); i++)
+            testResult = std::abs(q.getQubitLayer()[i] - reference.getQubitLayer()[i]) < 1e-12 && testResult;
+    }
+    kernels::setSimdLevel(supported);
+    std::cout << "SIMD    " << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+// applies a matrix to a state by brute force, used as the reference for applyUnitary
+std::vector<qubitLayer> referenceUnitary(const std::vector<qubitLayer> &state, const std::vector<int> &targets,
+                                         const std::vector<qubitLayer> &matrix, const std::vector<int> &controls)
+{
+    std::vector<qubitLayer> output(state.size());
+    unsigned long long int dim = 1ULL << targets.size();
+    for (unsigned long long int i = 0; i < state.size(); i++)
+    {
+        bool controlsSet = true;
+        for (int control : controls)
+            controlsSet = controlsSet && (i >> control) & 1;
+        if (!controlsSet)
+        {
+            output[i] = state[i];
+            continue;
+        }
+        // row of the matrix given by the target bits of the state
+        unsigned long long int row{0};
+        for (unsigned long long int j = 0; j < targets.size(); j++)
+            row |= ((i >> targets[j]) & 1) << j;
+        for (unsigned long long int column = 0; column < dim; column++)
+        {
+            unsigned long long int input = i;
+            for (unsigned long long int j = 0; j < targets.size(); j++)
+                input = (input & ~(1ULL << targets[j])) | (((column >> j) & 1) << targets[j]);
+            output[i] += matrix[row * dim + column] * state[input];
+        }
+    }
+    return output;
+}
+
+bool testUnitary()
+{
+    unsigned int numQubits = 5;
+    struct UnitaryCase
+    {
+        std::vector<int> targets;
+        std::vector<int> controls;
+        MatrixType type;
+    };
+    std::vector<UnitaryCase> cases = {
+        {{3}, {}, MatrixType::dense},
+        {{0}, {2, 4}, MatrixType::real},
+        {{4, 1}, {0}, MatrixType::diagonal},
+        {{2, 0, 3}, {}, MatrixType::permutation},
+        {{1, 4, 2}, {3}, MatrixType::dense},
+        {{3, 0}, {}, MatrixType::real},
+        {{2}, {0, 1, 3, 4}, MatrixType::dense},
+        {{4}, {0}, MatrixType::permutation},
+        {{0}, {1, 3}, MatrixType::diagonal},
+        {{3, 4}, {0, 1, 2}, MatrixType::dense},
+    };
+    bool testResult = true;
+    for (const UnitaryCase &c : cases)
+    {
+        // fill the matrix with arbitrary entries of the required structure
+        unsigned long long int dim = 1ULL << c.targets.size();
+        std::vector<qubitLayer> matrix(dim * dim, zeroComplex);
+        for (unsigned long long int r = 0; r < dim; r++)
+            for (unsigned long long int col = 0; col < dim; col++)
+            {
+                qubitLayer entry{cos(1.3 * (r * dim + col) + 0.2), sin(0.7 * (r * dim + col) + 0.5)};
+                if (c.type == MatrixType::real)
+                    entry = entry.real();
+                if ((c.type == MatrixType::diagonal && r != col) || (c.type == MatrixType::permutation && col != (r * 3 + 1) % dim))
+                    entry = zeroComplex;
+                matrix[r * dim + col] = entry;
+            }
+        testResult = kernels::classifyMatrix(matrix.data(), dim) == c.type && testResult;
+        QubitLayer q(numQubits);
+        for (unsigned int i = 0; i < numQubits; i++)
+        {
+            q.applyHadamard(i);
+            q.applyRx(i, pi / (i + 2));
+        }
+        std::vector<qubitLayer> state(q.getQubitLayer(), q.getQubitLayer() + q.getNumStates());
+        std::vector<qubitLayer> expected = referenceUnitary(state, c.targets, matrix, c.controls);
+        q.applyUnitary(c.targets, matrix, c.controls);
+        for (unsigned long long int i = 0; i < q.getNumStates(); i++)
+            testResult = std::abs(q.getQubitLayer()[i] - expected[i]) < 1e-12 && testResult;
+    }
+    std::cout << "Unitary " << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+bool testCircuit()
+{
+    unsigned int numQubits = 6;
+    Circuit c(numQubits);
+    int ctrlQubits[2]{1, 4};
+    for (unsigned int i = 0; i < numQubits; i++)
+        c.applyHadamard(i);
+    c.applyPauliX(2);
+    c.applyPauliX(2);
+    c.applyCnot(0, 3);
+    c.applyCnot(0, 3);
+    c.applyRx(5, pi / 3);
+    c.applyRz(5, pi / 5);
+    c.applyRy(1, pi / 7);
+    c.applyToffoli(1, 4, 0);
+    c.applyHadamard(0);
+    c.applyPauliY(3);
+    c.applyMcphase(ctrlQubits, 2, 5);
+    c.applyCz(2, 3);
+    for (unsigned int i = 0; i < numQubits; i++)
+        c.applyHadamard(i);
+    unsigned long long int numGates = c.getNumGates();
+    QubitLayer expected(numQubits);
+    c.run(expected);
+    // the optimised circuit must have fewer gates and give the same state
+    c.optimize(3);
+    QubitLayer q(numQubits);
+    c.run(q);
+    bool testResult = c.getNumGates() < numGates;
+    for (unsigned long long int i = 0; i < q.getNumStates(); i++)
+        testResult = std::abs(q.getQubitLayer()[i] - expected.getQubitLayer()[i]) < 1e-12 && testResult;
+    // a pair of inverse gates must cancel completely
+    Circuit inverses(2);
+    inverses.applyHadamard(0);
+    inverses.applyCnot(0, 1);
+    inverses.applyCnot(0, 1);
+    inverses.applyHadamard(0);
+    inverses.optimize();
+    testResult = inverses.getNumGates() == 0 && testResult;
+    std::cout << "Circuit " << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+bool testFloat()
+{
+    // enough qubits for the single precision vector kernels, which need target >= 3, to be used
+    unsigned int numQubits = 8;
+    SimdLevel supported = kernels::getSupportedSimdLevel();
+    QubitLayer reference(numQubits);
+    runSimdCircuit(reference);
+    bool testResult = true;
+    for (SimdLevel level : {SimdLevel::scalar, SimdLevel::avx2, SimdLevel::avx512})
+    {
+        if (level > supported)
+            continue;
+        kernels::setSimdLevel(level);
+        QubitLayerF q(numQubits);
+        runSimdCircuit(q);
+        for (unsigned long long int i = 0; i < q.getNumStates(); i++)
+            testResult = std::abs(std::complex<double>(q.getQubitLayer()[i]) - reference.getQubitLayer()[i]) < 1e-5 && testResult;
+    }
+    kernels::setSimdLevel(supported);
+    std::cout << "Float   " << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+bool testMapped()
+{
+    unsigned int numQubits = 10;
+    std::string storageFile = "tests/mapped.state";
+    // two qubit unitary Rx (on the first target) times H (on the second target)
+    std::vector<qubitLayer> rx = gates::rx(pi / 3);
+    std::vector<qubitLayer> h = gates::hadamard();
+    std::vector<qubitLayer> rxh(16);
+    for (int r = 0; r < 4; r++)
+        for (int col = 0; col < 4; col++)
+            rxh[r * 4 + col] = h[(r >> 1) * 2 + (col >> 1)] * rx[(r & 1) * 2 + (col & 1)];
+    Circuit c(numQubits);
+    for (unsigned int i = 0; i < numQubits; i++)
+        c.applyHadamard(i);
+    for (unsigned int i = 0; i < numQubits; i++)
+    {
+        int ctrlQubits[2]{static_cast<int>((i + 1) % numQubits), static_cast<int>((i + 5) % numQubits)};
+        c.applyRx(i, pi / (i + 2));
+        c.applyCnot(ctrlQubits[0], i);
+        c.applyRz((i + 3) % numQubits, pi / (i + 4));
+        c.applyMcphase(ctrlQubits, 2, i);
+        c.applyUnitary({static_cast<int>(i), ctrlQubits[0]}, rxh);
+    }
+    QubitLayer expected(numQubits);
+    c.run(expected);
+    bool testResult = true;
+    {
+        // run in chunks of 16 states, so that the gates on the 4 lowest qubits are reordered and run per chunk
+        QubitLayer q(numQubits, nullptr, storageFile);
+        c.run(q, 4);
+        testResult = q.isMapped() && !q.isSparse();
+        for (unsigned long long int i = 0; i < q.getNumStates(); i++)
+            testResult = std::abs(q.getQubitLayer()[i] - expected.getQubitLayer()[i]) < 1e-12 && testResult;
+    }
+    // the storage file is removed with the state
+    testResult = !std::ifstream(storageFile).good() && testResult;
+    std::cout << "Mapped  " << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+bool testMeasure()
+{
+    std::mt19937_64 rng(2024);
+    // Bell pair on qubits 0 and 1, qubit 2 is 1 with probability sin^2(pi/6) = 1/4
+    QubitLayer q(3);
+    q.applyHadamard(0);
+    q.applyCnot(0, 1);
+    q.applyRy(2, pi / 3);
+    unsigned long long int shots = 100000;
+    std::map<unsigned long long int, unsigned long long int> counts = q.sample(shots, rng);
+    bool testResult = counts.size() == 4;
+    for (const auto &count : counts)
+    {
+        precision expected = ((count.first >> 2) ? 0.25 : 0.75) / 2;
+        testResult = ((count.first & 1) == ((count.first >> 1) & 1)) && std::abs(count.second / precision(shots) - expected) < 0.01 && testResult;
+    }
+    // measuring qubit 0 fixes qubit 1 to the same value and keeps the state normalised
+    unsigned long long int outcome = q.measure({0}, rng);
+    precision norm{0};
+    for (unsigned long long int i = 0; i < q.getNumStates(); i++)
+    {
+        norm += std::norm(q.getQubitLayer()[i]);
+        testResult = (std::norm(q.getQubitLayer()[i]) == 0 || ((i & 1) == outcome && ((i >> 1) & 1) == outcome)) && testResult;
+    }
+    testResult = std::abs(norm - 1) < 1e-12 && testResult;
+    // GHZ state on a sparse state with 40 qubits
+    QubitLayer ghz(40);
+    ghz.applyHadamard(0);
+    for (int i = 1; i < 40; i++)
+        ghz.applyCnot(0, i);
+    outcome = ghz.measure({39, 7}, rng);
+    qProb result = ghz.getMaxAmplitude();
+    testResult = (outcome == 0 || outcome == 3) && result.state.to_ullong() == (outcome ? (1ULL << 40) - 1 : 0) && std::abs(result.prob - 1) < 1e-12 && testResult;
+    // too many measured qubits to tabulate the outcomes
+    unsigned int numQubits = maxMarginalQubits + 2;
+    QubitLayer wide(numQubits);
+    std::vector<int> measured;
+    for (unsigned int i = 0; i < numQubits; i++)
+    {
+        wide.applyHadamard(i);
+        if (i != 5)
+            measured.push_back(i);
+    }
+    wide.measure(measured, rng);
+    // only the two states differing in the unmeasured qubit are left
+    std::vector<unsigned long long int> left;
+    for (unsigned long long int i = 0; i < wide.getNumStates(); i++)
+        if (std::norm(wide.getQubitLayer()[i]) > 1e-12)
+        {
+            left.push_back(i);
+            testResult = std::abs(std::norm(wide.getQubitLayer()[i]) - 0.5) < 1e-12 && testResult;
+        }
+    testResult = left.size() == 2 && (left[0] ^ left[1]) == (1ULL << 5) && testResult;
+    std::cout << "Measure " << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+bool testExpectation()
+{
+    unsigned int numQubits = 6;
+    QubitLayer q(numQubits);
+    runSimdCircuit(q);
+    std::vector<PauliString> terms = {pauliString("ZIIIII", 0.5), pauliString("XXIIII"), pauliString("YIZIIX", -2),
+                                      pauliString("IIYYII"), pauliString("ZZZZZZ"), pauliString("XIZIIX"), pauliString("IIIIII", 3)};
+    std::vector<precision> values = q.expectation(terms);
+    bool testResult = values.size() == terms.size();
+    std::vector<qubitLayer> state(q.getQubitLayer(), q.getQubitLayer() + q.getNumStates());
+    for (unsigned long long int t = 0; t < terms.size(); t++)
+    {
+        // apply the Pauli gates to a copy of the state and take the overlap with the original
+        QubitLayer copy(numQubits, state.data());
+        for (unsigned int j = 0; j < numQubits; j++)
+        {
+            bool x = (terms[t].xMask >> j) & 1;
+            bool z = (terms[t].zMask >> j) & 1;
+            if (x && z)
+                copy.applyPauliY(j);
+            else if (x)
+                copy.applyPauliX(j);
+            else if (z)
+                copy.applyPauliZ(j);
+        }
+        qubitLayer overlap{0, 0};
+        for (unsigned long long int i = 0; i < q.getNumStates(); i++)
+            overlap += std::conj(state[i]) * copy.getQubitLayer()[i];
+        testResult = std::abs(values[t] - terms[t].coefficient * overlap.real()) < 1e-12 && testResult;
+    }
+    // GHZ state on a sparse state with 40 qubits: <Z0 Z39> = <X...X> = 1 and <Z0> = 0
+    QubitLayer ghz(40);
+    ghz.applyHadamard(0);
+    for (int i = 1; i < 40; i++)
+        ghz.applyCnot(0, i);
+    values = ghz.expectation({{0, 1 | 1ULL << 39, 1}, {(1ULL << 40) - 1, 0, 1}, {0, 1, 1}});
+    testResult = std::abs(values[0] - 1) < 1e-12 && std::abs(values[1] - 1) < 1e-12 && std::abs(values[2]) < 1e-12 && testResult;
+    std::cout << "Expect  " << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+bool testSparse()
+{
+    // run the same gates on a QubitLayer and on a plain vector, which switches to dense and back to sparse
+    unsigned int numQubits = 8;
+    QubitLayer q(numQubits);
+    std::vector<qubitLayer> expected(1ULL << numQubits, zeroComplex);
+    expected[0] = {1, 0};
+    auto apply = [&](const std::vector<int> &targets, const std::vector<qubitLayer> &matrix, const std::vector<int> &controls)
+    {
+        q.applyUnitary(targets, matrix, controls);
+        expected = referenceUnitary(expected, targets, matrix, controls);
+    };
+    apply({0}, gates::pauliX(), {});
+    apply({3}, gates::pauliX(), {0});
+    apply({5}, gates::pauliX(), {0, 3});
+    apply({5}, gates::rz(pi / 3), {});
+    bool testResult = q.isSparse();
+    for (int i = 0; i < 6; i++)
+        apply({i}, gates::hadamard(), {});
+    testResult = !q.isSparse() && testResult;
+    for (int i = 5; i >= 0; i--)
+        apply({i}, gates::hadamard(), {});
+    for (int i = 0; i < 10; i++)
+        apply({7}, gates::hadamard(), {});
+    testResult = q.isSparse() && testResult;
+    for (unsigned long long int i = 0; i < q.getNumStates(); i++)
+        testResult = std::abs(q.getQubitLayer()[i] - expected[i]) < 1e-12 && testResult;
+    // a reversible circuit on more qubits than could ever be stored densely
+    QubitLayer wide(49);
+    unsigned long long int state{0};
+    for (int i = 0; i < 16; i += 3)
+    {
+        wide.applyPauliX(i);
+        state |= 1ULL << i;
+    }
+    for (int i = 0; i < 16; i++)
+    {
+        wide.applyCnot(i, 16 + i);
+        wide.applyToffoli(i, 16 + i, 32 + i);
+        if (state & (1ULL << i))
+            state |= (1ULL << (16 + i)) | (1ULL << (32 + i));
+    }
+    wide.applyHadamard(48);
+    qProb result = wide.getMaxAmplitude();
+    testResult = wide.isSparse() && result.state.to_ullong() == state && std::abs(result.prob - 0.5) < 1e-12 && testResult;
+    std::cout << "Sparse  " << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+bool testCheckpoint()
+{
+    unsigned int numQubits = 14;
+    std::string checkpointFile = "tests/checkpoint.qsim";
+    QubitLayer expected(numQubits);
+    runSimdCircuit(expected);
+    expected.save(checkpointFile);
+    bool testResult = true;
+    {
+        // the loaded state is the mapped file, gates on it must not change the checkpoint
+        QubitLayer q(1);
+        q.load(checkpointFile);
+        testResult = q.getNumQubits() == numQubits && !q.isSparse();
+        for (unsigned long long int i = 0; i < q.getNumStates(); i++)
+            testResult = q.getQubitLayer()[i] == expected.getQubitLayer()[i] && testResult;
+        q.applyHadamard(3);
+        QubitLayer reloaded(1);
+        reloaded.load(checkpointFile);
+        for (unsigned long long int i = 0; i < reloaded.getNumStates(); i++)
+            testResult = reloaded.getQubitLayer()[i] == expected.getQubitLayer()[i] && testResult;
+        // a double precision checkpoint is converted when loaded in single precision
+        QubitLayerF f(1);
+        f.load(checkpointFile);
+        for (unsigned long long int i = 0; i < f.getNumStates(); i++)
+            testResult = std::abs(std::complex<precision>(f.getQubitLayer()[i]) - expected.getQubitLayer()[i]) < 1e-6 && testResult;
+    }
+    {
+        // a compressed checkpoint of a sparse 40 qubit GHZ state only holds its 2 non-zero blocks
+        QubitLayer ghz(40);
+        ghz.applyHadamard(0);
+        for (int i = 1; i < 40; i++)
+            ghz.applyCnot(0, i);
+        ghz.save(checkpointFile, true);
+        std::ifstream file(checkpointFile, std::ios::binary | std::ios::ate);
+        testResult = file.tellg() == (1 << 16) + 2 * (8 + 16 * checkpointBlockStates) && testResult;
+        QubitLayer q(1);
+        q.load(checkpointFile);
+        std::vector<precision> values = q.expectation({pauliString(std::string(40, 'X')), pauliString("ZZ")});
+        testResult = q.getNumQubits() == 40 && q.isSparse() && std::abs(values[0] - 1) < 1e-12 && std::abs(values[1] - 1) < 1e-12 && testResult;
+        // the same state saved dense and compressed loads identically
+        expected.save(checkpointFile, true);
+        q.load(checkpointFile);
+        for (unsigned long long int i = 0; i < q.getNumStates(); i++)
+            testResult = q.getQubitLayer()[i] == expected.getQubitLayer()[i] && testResult;
+    }
+    std::remove(checkpointFile.c_str());
+    std::cout << "Checkpt " << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+bool testDistributed()
+{
+    unsigned int numQubits = 9;
+    std::vector<qubitLayer> rx = gates::rx(pi / 3);
+    std::vector<qubitLayer> h = gates::hadamard();
+    std::vector<qubitLayer> rxh(16);
+    for (int r = 0; r < 4; r++)
+        for (int col = 0; col < 4; col++)
+            rxh[r * 4 + col] = h[(r >> 1) * 2 + (col >> 1)] * rx[(r & 1) * 2 + (col & 1)];
+    Circuit c(numQubits);
+    for (unsigned int i = 0; i < numQubits; i++)
+        c.applyHadamard(i);
+    for (unsigned int i = 0; i < numQubits; i++)
+    {
+        int ctrlQubits[2]{static_cast<int>((i + 1) % numQubits), static_cast<int>((i + 5) % numQubits)};
+        c.applyRx(i, pi / (i + 2));
+        c.applyCnot(ctrlQubits[0], i);
+        c.applyRz((i + 3) % numQubits, pi / (i + 4));
+        c.applyMcphase(ctrlQubits, 2, i);
+        c.applyUnitary({static_cast<int>(i), ctrlQubits[0]}, rxh);
+    }
+    QubitLayer expected(numQubits);
+    c.run(expected);
+    // 4 workers of 2^7 amplitudes, qubits 7 and 8 start global
+    DistributedQubitLayer q(numQubits, 4);
+    c.run(q);
+    std::vector<qubitLayer> amplitudes = q.getAmplitudes();
+    bool testResult = q.getNumLocalQubits() == numQubits - 2 && q.getNumSwaps() > 0;
+    for (unsigned long long int i = 0; i < amplitudes.size(); i++)
+        testResult = std::abs(amplitudes[i] - expected.getQubitLayer()[i]) < 1e-12 && testResult;
+    // diagonal gates and controls on global qubits need no exchange
+    unsigned long long int numSwaps = q.getNumSwaps();
+    int globalQubit = 0, localQubit = 0;
+    while (q.getPhysicalQubit(globalQubit) < static_cast<int>(q.getNumLocalQubits()))
+        globalQubit++;
+    while (q.getPhysicalQubit(localQubit) >= static_cast<int>(q.getNumLocalQubits()))
+        localQubit++;
+    q.applyRz(globalQubit, pi / 5);
+    q.applyCnot(globalQubit, localQubit);
+    expected.applyRz(globalQubit, pi / 5);
+    expected.applyCnot(globalQubit, localQubit);
+    amplitudes = q.getAmplitudes();
+    testResult = q.getNumSwaps() == numSwaps && testResult;
+    for (unsigned long long int i = 0; i < amplitudes.size(); i++)
+        testResult = std::abs(amplitudes[i] - expected.getQubitLayer()[i]) < 1e-12 && testResult;
+    std::cout << "Distrib " << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+bool testBlocked()
+{
+    unsigned int numQubits = 16;
+    // layers of gates on every qubit, so that stages have many gates on qubits that start above the chunks
+    Circuit c(numQubits);
+    for (unsigned int i = 0; i < numQubits; i++)
+        c.applyHadamard(i);
+    // a deep block on the highest qubits, which is worth swapping below the chunks
+    for (int layer = 0; layer < 4; layer++)
+        for (unsigned int i = numQubits - 3; i < numQubits; i++)
+        {
+            c.applyRy(i, pi / (i + layer + 3));
+            c.applyCnot(i, numQubits - 4);
+        }
+    for (int layer = 0; layer < 4; layer++)
+        for (unsigned int i = 0; i < numQubits; i++)
+        {
+            c.applyRx(i, pi / (i + layer + 2));
+            c.applyCnot(i, (i + 1) % numQubits);
+            c.applyRz((i + 7) % numQubits, pi / (i + 3));
+        }
+    QubitLayer expected(numQubits);
+    for (const Gate &gate : c.getGates())
+        expected.applyUnitary(gate.targets, gate.matrix, gate.controls);
+    bool testResult = true;
+    for (unsigned int chunkQubits : {0U, 3U, 6U})
+        for (int numThreads : {1, 4})
+        {
+            QubitLayer q(numQubits);
+            q.setNumThreads(numThreads);
+            c.run(q, chunkQubits);
+            for (unsigned long long int i = 0; i < q.getNumStates(); i++)
+                testResult = std::abs(q.getQubitLayer()[i] - expected.getQubitLayer()[i]) < 1e-12 && testResult;
+        }
+    std::cout << "Blocked " << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+bool testBatch()
+{
+    unsigned int numQubits = 10;
+    // layers of parameterised rotations between CNOT chains, 2 parameters per qubit and layer
+    Circuit c(numQubits);
+    for (unsigned int layer = 0; layer < 3; layer++)
+    {
+        for (unsigned int i = 0; i < numQubits; i++)
+        {
+            c.applyRy(i, Parameter{2 * (layer * numQubits + i)});
+            c.applyRz(i, Parameter{2 * (layer * numQubits + i) + 1});
+            c.applyRx(i, pi / 7);
+        }
+        for (unsigned int i = 0; i + 1 < numQubits; i++)
+            c.applyCnot(i, i + 1);
+    }
+    c.optimize();
+    std::mt19937_64 rng(7);
+    std::uniform_real_distribution<precision> angle(-pi, pi);
+    std::vector<std::vector<precision>> parameters(24, std::vector<precision>(c.getNumParameters()));
+    for (std::vector<precision> &values : parameters)
+        for (precision &value : values)
+            value = angle(rng);
+    std::vector<PauliString> terms{pauliString("ZZ"), pauliString("XIIIIIIIIY", 0.5)};
+    std::vector<std::vector<precision>> values = c.expectationBatch(parameters, terms, 4);
+    bool testResult = c.getNumParameters() == 6 * numQubits;
+    std::vector<std::vector<std::complex<float>>> singleStates(parameters.size());
+    c.runBatch<float>(parameters, [&](unsigned long long int instance, QubitLayerF &q)
+                      { singleStates[instance].assign(q.getQubitLayer(), q.getQubitLayer() + q.getNumStates()); });
+    for (unsigned long long int instance = 0; instance < parameters.size(); instance++)
+    {
+        // every instance must match a fresh state run on its own, also after a reset
+        QubitLayer q(numQubits);
+        c.run(q, parameters[instance]);
+        std::vector<precision> expected = q.expectation(terms);
+        testResult = std::abs(values[instance][0] - expected[0]) < 1e-12 && std::abs(values[instance][1] - expected[1]) < 1e-12 && testResult;
+        for (unsigned long long int i = 0; i < q.getNumStates(); i++)
+            testResult = std::abs(std::complex<precision>(singleStates[instance][i]) - q.getQubitLayer()[i]) < 1e-5 && testResult;
+        q.reset();
+        testResult = q.getQubitLayer()[0] == qubitLayer(1, 0) && q.getMaxAmplitude().prob == 1 && testResult;
+    }
+    std::cout << "Batch   " << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+bool testProfile()
+{
+    // the scopes can be used directly whether or not the hot paths are instrumented
+    profiler::reset();
+    for (int call = 0; call < 3; call++)
+    {
+        profiler::Scope outer("test outer");
+        profiler::addWork(4, 64);
+        {
+            profiler::Scope inner("test inner");
+            profiler::addWork(2, 32);
+        }
+    }
+    profiler::Counters outer = profiler::getCounters("test outer");
+    profiler::Counters inner = profiler::getCounters("test inner");
+    bool testResult = outer.calls == 3 && outer.amplitudes == 18 && outer.bytes == 288 && inner.calls == 3 &&
+                      inner.amplitudes == 6 && inner.bytes == 96 && outer.ns >= inner.ns && profiler::getCounters("none").calls == 0;
+#ifdef QSIM_PROFILE
+    // every gate is counted once under its name, and its kernel reads and writes every amplitude it touches
+    QubitLayer q(16);
+    q.setNumThreads(2);
+    for (int i = 0; i < 16; i++)
+        q.applyHadamard(i);
+    profiler::Counters hadamard = profiler::getCounters("Hadamard");
+    testResult = hadamard.calls == 16 && hadamard.amplitudes >= q.getNumStates() &&
+                 hadamard.bytes == 2 * sizeof(qubitLayer) * hadamard.amplitudes && profiler::getCounters("kernel thread").calls > 0 && testResult;
+#endif
+    std::string path = "profile_test.json";
+    profiler::writeTrace(path);
+    std::ifstream trace(path);
+    std::string contents((std::istreambuf_iterator<char>(trace)), std::istreambuf_iterator<char>());
+    testResult = contents.rfind("{\"traceEvents\":[", 0) == 0 && contents.find("\"name\":\"test inner\"") != std::string::npos &&
+                 contents.find("\"amplitudes\":2,") != std::string::npos && testResult;
+    std::remove(path.c_str());
+    profiler::reset();
+    testResult = profiler::getCounters("test outer").calls == 0 && testResult;
+    std::cout << "Profile " << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+bool testGrover()
+{
+    // the native oracle and diffusion must match their gate decompositions, up to the global phase -1 of the diffusion
+    unsigned int numQubits = 15;
+    std::vector<qubitLayer> input(1ULL << numQubits);
+    std::mt19937_64 rng(3);
+    std::normal_distribution<precision> normal;
+    for (qubitLayer &amplitude : input)
+        amplitude = {normal(rng), normal(rng)};
+    bool testResult = true;
+    for (const std::vector<int> &qubits : {std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14}, std::vector<int>{1, 4, 5, 11}})
+        for (int numThreads : {1, 4})
+        {
+            QubitLayer q(numQubits, input.data());
+            QubitLayer expected(numQubits, input.data());
+            q.setNumThreads(numThreads);
+            unsigned long long int marked = 0x2b5b & ((1ULL << numQubits) - 1);
+            q.applyPhaseOracle({marked, marked});
+            q.applyPhaseOracle([](unsigned long long int i) { return i % 7 == 3; });
+            q.applyDiffusion(qubits);
+            for (unsigned long long int i = 0; i < expected.getNumStates(); i++)
+                if (i == marked || i % 7 == 3)
+                    expected.getQubitLayer()[i] = -expected.getQubitLayer()[i];
+            std::vector<int> controls(qubits.begin(), qubits.end() - 1);
+            for (int qubit : qubits)
+                expected.applyHadamard(qubit);
+            for (int qubit : qubits)
+                expected.applyPauliX(qubit);
+            expected.applyMcphase(controls.data(), controls.size(), qubits.back());
+            for (int qubit : qubits)
+                expected.applyPauliX(qubit);
+            for (int qubit : qubits)
+                expected.applyHadamard(qubit);
+            for (unsigned long long int i = 0; i < q.getNumStates(); i++)
+                testResult = std::abs(q.getQubitLayer()[i] + expected.getQubitLayer()[i]) < 1e-10 && testResult;
+        }
+    // a search on a sparse state that is too large to be dense stays sparse
+    QubitLayer wide(40);
+    wide.applyHadamard(0);
+    wide.applyHadamard(1);
+    wide.applyPhaseOracle({2});
+    wide.applyDiffusion({0, 1});
+    qProb found = wide.getMaxAmplitude();
+    testResult = wide.isSparse() && found.state.to_ullong() == 2 && std::abs(found.prob - 1) < 1e-12 && testResult;
+    // Grover search finds the marked state with high probability
+    QubitLayer search(12);
+    std::vector<int> allQubits;
+    for (int i = 0; i < 12; i++)
+    {
+        search.applyHadamard(i);
+        allQubits.push_back(i);
+    }
+    for (int rep = 0; rep < static_cast<int>(std::sqrt(search.getNumStates()) / 4 * pi); rep++)
+    {
+        search.applyPhaseOracle({1234});
+        search.applyDiffusion(allQubits);
+    }
+    found = search.getMaxAmplitude();
+    testResult = found.state.to_ullong() == 1234 && found.prob > 0.99 && testResult;
+    std::cout << "Grover  " << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+bool testStabilizer()
+{
+    // random Clifford circuits on a tableau and on a state vector must give the same measurement statistics
+    unsigned int numQubits = 6;
+    std::mt19937_64 rng(11);
+    std::uniform_int_distribution<int> pickGate(0, 5);
+    std::uniform_int_distribution<int> pickQubit(0, numQubits - 1);
+    std::vector<int> allQubits;
+    for (unsigned int i = 0; i < numQubits; i++)
+        allQubits.push_back(i);
+    bool testResult = true;
+    for (int circuit = 0; circuit < 100; circuit++)
+    {
+        Circuit c(numQubits);
+        for (int g = 0; g < 40; g++)
+        {
+            int a = pickQubit(rng);
+            int b = (a + 1 + pickQubit(rng) % (numQubits - 1)) % numQubits;
+            switch (pickGate(rng))
+            {
+            case 0:
+                c.applyPauliX(a);
+                break;
+            case 1:
+                c.applyPauliY(a);
+                break;
+            case 2:
+                c.applyPauliZ(a);
+                break;
+            case 3:
+                c.applyHadamard(a);
+                break;
+            case 4:
+                c.applyCnot(a, b);
+                break;
+            default:
+                c.applyCz(a, b);
+            }
+        }
+        testResult = c.isClifford() && testResult;
+        StabilizerLayer tableau(numQubits);
+        c.run(tableau);
+        QubitLayer q(numQubits);
+        c.run(q);
+        // a qubit is deterministic exactly when the state vector gives it a certain value, otherwise it is 50/50
+        for (int qubit : allQubits)
+        {
+            precision prob1{0};
+            for (unsigned long long int i = 0; i < q.getNumStates(); i++)
+                if (i & (1ULL << qubit))
+                    prob1 += std::norm(q.getQubitLayer()[i]);
+            StabilizerLayer copy(tableau);
+            bool deterministic = copy.isDeterministic(qubit);
+            bool outcome = copy.measure({qubit}, rng);
+            testResult = (deterministic ? std::abs(prob1 - outcome) < 1e-12 : std::abs(prob1 - 0.5) < 1e-12) && testResult;
+        }
+        // the outcomes drawn are exactly the states with a non-zero amplitude
+        std::map<unsigned long long int, unsigned long long int> counts = tableau.sample(allQubits, 1000, rng);
+        unsigned long long int support{0};
+        for (unsigned long long int i = 0; i < q.getNumStates(); i++)
+            if (std::norm(q.getQubitLayer()[i]) > 1e-12)
+            {
+                support++;
+                testResult = counts.count(i) == 1 && testResult;
+            }
+        testResult = counts.size() == support && testResult;
+    }
+    // a GHZ state on a thousand qubits only runs on the tableau
+    unsigned int wideQubits = 1000;
+    Circuit ghz(wideQubits);
+    ghz.applyHadamard(0);
+    for (unsigned int i = 1; i < wideQubits; i++)
+        ghz.applyCnot(i - 1, i);
+    std::map<unsigned long long int, unsigned long long int> counts = ghz.sample({0, 400, 999}, 200, rng);
+    testResult = counts.size() == 2 && counts[0] + counts[7] == 200 && counts[0] > 50 && counts[7] > 50 && testResult;
+    StabilizerLayer tableau(wideQubits);
+    ghz.run(tableau);
+    // a shot only draws the random outcomes, here one for 60 qubits, so it does not grow with the tableau
+    std::vector<int> measured;
+    for (unsigned int i = 0; i < 60; i++)
+        measured.push_back(i * 16);
+    counts = tableau.sample(measured, 100000, rng);
+    testResult = counts.size() == 2 && counts[0] + counts[(1ULL << 60) - 1] == 100000 && counts[0] > 45000 && counts[0] < 55000 && testResult;
+    // measuring one qubit of the GHZ state collapses all the others
+    unsigned long long int first = tableau.measure({500}, rng);
+    testResult = tableau.isDeterministic(3) && tableau.measure({3, 998}, rng) == 3 * first && testResult;
+    // circuits with other gates fall back to the state vector
+    Circuit rotation(2);
+    rotation.applyRx(0, pi);
+    rotation.applyCnot(0, 1);
+    counts = rotation.sample({0, 1}, 100, rng);
+    testResult = !rotation.isClifford() && counts.size() == 1 && counts[3] == 100 && testResult;
+    std::cout << "Clifford" << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+bool testDiagonal()
+{
+    // a QAOA-like layer of diagonal gates, within a byte of the state index and spanning bytes, between mixing layers
+    unsigned int numQubits = 12;
+    std::mt19937_64 rng(5);
+    std::uniform_real_distribution<precision> angle(-pi, pi);
+    Circuit c(numQubits);
+    for (int layer = 0; layer < 2; layer++)
+    {
+        for (unsigned int i = 0; i < numQubits; i++)
+            c.applyRx(i, angle(rng));
+        for (unsigned int i = 0; i < numQubits; i++)
+        {
+            int j = (i + 5) % numQubits;
+            precision theta = angle(rng);
+            c.applyUnitary({static_cast<int>(i), j}, {std::polar<precision>(1, -theta), 0, 0, 0, 0, std::polar<precision>(1, theta), 0, 0,
+                                                      0, 0, std::polar<precision>(1, theta), 0, 0, 0, 0, std::polar<precision>(1, -theta)});
+            c.applyRz(i, angle(rng));
+            c.applyCz(i, (i + 1) % numQubits);
+        }
+        int controls[3]{1, 6, 9};
+        c.applyMcphase(controls, 3, 11);
+        c.applyUnitary({3}, {{1, 0}, {0, 0}, {0, 0}, std::polar<precision>(1, angle(rng))}, {0, 10});
+    }
+    std::vector<qubitLayer> expected(1ULL << numQubits, zeroComplex);
+    expected[0] = {1, 0};
+    for (const Gate &gate : c.getGates())
+        expected = referenceUnitary(expected, gate.targets, gate.matrix, gate.controls);
+    bool testResult = true;
+    for (int numThreads : {1, 4})
+    {
+        // gates applied one by one collect the diagonal ones, and a circuit run applies them together
+        QubitLayer q(numQubits);
+        q.setNumThreads(numThreads);
+        for (const Gate &gate : c.getGates())
+            q.applyUnitary(gate.targets, gate.matrix, gate.controls);
+        QubitLayer r(numQubits);
+        r.setNumThreads(numThreads);
+        c.run(r);
+        for (unsigned long long int i = 0; i < q.getNumStates(); i++)
+            testResult = std::abs(q.getQubitLayer()[i] - expected[i]) < 1e-12 && std::abs(r.getQubitLayer()[i] - expected[i]) < 1e-12 && testResult;
+    }
+    // the collected gates are applied before a readout of a sparse state, and dropped by a reset
+    QubitLayer sparse(40);
+    sparse.applyHadamard(0);
+    sparse.applyHadamard(35);
+    sparse.applyRz(0, pi / 2);
+    sparse.applyCz(0, 35);
+    std::vector<precision> values = sparse.expectation({pauliString("Y" + std::string(34, 'I') + "Z"), pauliString(std::string(35, 'I') + "X")});
+    testResult = sparse.isSparse() && std::abs(values[0] - 1) < 1e-12 && std::abs(values[1]) < 1e-12 && testResult;
+    sparse.applyPauliZ(0);
+    sparse.reset();
+    testResult = sparse.getMaxAmplitude().state == 0 && std::abs(sparse.getMaxAmplitude().prob - 1) < 1e-12 && testResult;
+    std::cout << "Diagonal" << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+bool testJobs()
+{
+    // a stream of small parameterised circuits mixed with larger ones, only one of which fits in the budget at a time
+    auto makeCircuit = [](unsigned int numQubits)
+    {
+        Circuit c(numQubits);
+        for (unsigned int i = 0; i < numQubits; i++)
+            c.applyRy(i, Parameter{i});
+        for (unsigned int i = 0; i + 1 < numQubits; i++)
+            c.applyCnot(i, i + 1);
+        c.applyRz(numQubits - 1, pi / 5);
+        return c;
+    };
+    Circuit small = makeCircuit(8), large = makeCircuit(16);
+    std::vector<PauliString> terms{pauliString("ZZ"), pauliString("XIIIIIIY", 0.5)};
+    std::mt19937_64 rng(11);
+    std::uniform_real_distribution<precision> angle(-pi, pi);
+    std::vector<std::vector<precision>> parameters(34);
+    std::vector<std::vector<precision>> values(parameters.size());
+    unsigned long long int largeBytes = (1ULL << 16) * sizeof(qubitLayer);
+    bool testResult = true;
+    // a released state larger than the budget, which the runner must not leave in the pool
+    memory::getDefaultAllocator().deallocate(memory::getDefaultAllocator().allocate(4 * largeBytes), 4 * largeBytes);
+    {
+        JobRunner runner(largeBytes + largeBytes / 2, 3, 14);
+        for (unsigned long long int job = 0; job < parameters.size(); job++)
+        {
+            bool isLarge = job % 17 == 5;
+            parameters[job].resize(isLarge ? 16 : 8);
+            for (precision &value : parameters[job])
+                value = angle(rng);
+            unsigned long long int id = runner.submit(isLarge ? large : small, [&](unsigned long long int instance, QubitLayer &q)
+                                                      { values[instance] = q.expectation(terms); }, parameters[job]);
+            testResult = id == job && testResult;
+        }
+        runner.wait();
+        JobStats stats = runner.getStats();
+        testResult = stats.submitted == parameters.size() && stats.completed == parameters.size() && stats.wideJobs == 2 && testResult;
+        testResult = stats.reservedBytes == 0 && stats.peakBytes <= largeBytes + largeBytes / 2 && stats.peakBytes >= largeBytes && testResult;
+        testResult = stats.throughput > 0 && stats.maxQueueLatency >= stats.meanQueueLatency && stats.meanRunTime > 0 && testResult;
+        testResult = memory::getDefaultAllocator().getPooledBytes() <= largeBytes + largeBytes / 2 && testResult;
+    }
+    for (unsigned long long int job = 0; job < parameters.size(); job++)
+    {
+        QubitLayer q(parameters[job].size());
+        (job % 17 == 5 ? large : small).run(q, parameters[job]);
+        std::vector<precision> expected = q.expectation(terms);
+        testResult = values[job].size() == 2 && std::abs(values[job][0] - expected[0]) < 1e-12 && std::abs(values[job][1] - expected[1]) < 1e-12 && testResult;
+    }
+    std::cout << "Jobs    " << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+bool testGradient()
+{
+    // a hardware-efficient ansatz with a parameter shared by two gates, fixed gates and a fused block in between
+    unsigned int numQubits = 6;
+    Circuit c(numQubits);
+    for (unsigned int i = 0; i < numQubits; i++)
+        c.applyHadamard(i);
+    for (unsigned int layer = 0; layer < 2; layer++)
+    {
+        for (unsigned int i = 0; i < numQubits; i++)
+        {
+            c.applyRy(i, Parameter{3 * (layer * numQubits + i)});
+            c.applyRz(i, Parameter{3 * (layer * numQubits + i) + 1});
+            c.applyRx(i, Parameter{3 * (layer * numQubits + i) + 2});
+        }
+        for (unsigned int i = 0; i + 1 < numQubits; i++)
+            c.applyCnot(i, i + 1);
+        c.applyRx(2, pi / 3);
+        c.applyCz(5, 1);
+    }
+    c.applyRy(4, Parameter{0});
+    c.optimize();
+    std::mt19937_64 rng(5);
+    std::uniform_real_distribution<precision> angle(-pi, pi);
+    std::vector<precision> parameters(c.getNumParameters());
+    for (precision &value : parameters)
+        value = angle(rng);
+    std::vector<PauliString> terms{pauliString("ZZ"), pauliString("XIYIIZ", 0.5), pauliString("IIIXXI", -0.3)};
+    auto observable = [&](const std::vector<precision> &values)
+    {
+        QubitLayer q(numQubits);
+        c.run(q, values);
+        std::vector<precision> expectations = q.expectation(terms);
+        return expectations[0] + expectations[1] + expectations[2];
+    };
+    precision value;
+    std::vector<precision> gradients = c.gradient(parameters, terms, &value);
+    bool testResult = gradients.size() == 6 * numQubits && std::abs(value - observable(parameters)) < 1e-12;
+    // central differences, accurate to about 1e-10
+    precision step = 1e-5;
+    for (unsigned int p = 0; p < parameters.size(); p++)
+    {
+        std::vector<precision> shifted = parameters;
+        shifted[p] += step;
+        precision forward = observable(shifted);
+        shifted[p] -= 2 * step;
+        precision backward = observable(shifted);
+        testResult = std::abs(gradients[p] - (forward - backward) / (2 * step)) < 1e-8 && testResult;
+    }
+    std::cout << "Gradient" << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+// counts the buffers it hands out, taking them from the default pool
+class CountingAllocator : public memory::Allocator
+{
+public:
+    void *allocate(unsigned long long int numBytes) override
+    {
+        allocations++;
+        return memory::getDefaultAllocator().allocate(numBytes);
+    }
+    void deallocate(void *buffer, unsigned long long int numBytes) override
+    {
+        deallocations++;
+        memory::getDefaultAllocator().deallocate(buffer, numBytes);
+    }
+    int allocations = 0;
+    int deallocations = 0;
+};
+
+bool testMemory()
+{
+    // dense states are aligned, and a released buffer is handed out again to the next state of the same size
+    unsigned int numQubits = 18;
+    memory::getDefaultAllocator().trim();
+    std::complex<precision> *first;
+    {
+        QubitLayer q(numQubits);
+        first = q.getQubitLayer();
+    }
+    bool testResult = reinterpret_cast<std::uintptr_t>(first) % stateAlignment == 0;
+    testResult = memory::getDefaultAllocator().getPooledBytes() >= (1ULL << numQubits) * sizeof(qubitLayer) && testResult;
+    QubitLayer reused(numQubits);
+    for (unsigned int i = 0; i < numQubits; i++)
+        reused.applyHadamard(i);
+    testResult = reused.getQubitLayer() == first && !reused.isSparse() && testResult;
+    // moving hands the amplitudes over without copying or releasing them twice
+    QubitLayer moved(std::move(reused));
+    testResult = moved.getQubitLayer() == first && std::abs(moved.getQubitLayer()[12345] - qubitLayer(1.0 / 512, 0)) < 1e-12 && testResult;
+    QubitLayer assigned(3);
+    assigned = std::move(moved);
+    assigned.applyHadamard(0);
+    testResult = assigned.getNumQubits() == numQubits && std::abs(assigned.getQubitLayer()[0] - qubitLayer(std::sqrt(2.0) / 512, 0)) < 1e-12 && testResult;
+    // a custom allocator gets the new states, while older ones go back to the allocator they came from
+    CountingAllocator counting;
+    memory::setAllocator(&counting);
+    {
+        QubitLayerF q(10, nullptr);
+        q.getQubitLayer();
+        testResult = reinterpret_cast<std::uintptr_t>(q.getQubitLayer()) % stateAlignment == 0 && testResult;
+    }
+    memory::setAllocator(nullptr);
+    testResult = counting.allocations == 1 && counting.deallocations == 1 && testResult;
+    memory::getDefaultAllocator().trim();
+    testResult = memory::getDefaultAllocator().getPooledBytes() == 0 && testResult;
+    std::cout << "Memory  " << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+bool testSwap()
+{
+    // SWAPs and permutations only relabel the qubits, so every gate and readout after them must see them moved
+    unsigned int numQubits = 10;
+    QubitLayer q(numQubits), reference(numQubits);
+    auto both = [&](const std::function<void(QubitLayer &)> &gate)
+    {
+        gate(q);
+        gate(reference);
+    };
+    auto swap = [&](int a, int b)
+    {
+        q.applySwap(a, b);
+        reference.applyUnitary({a, b}, gates::swap<precision>());
+    };
+    for (unsigned int i = 0; i < numQubits; i++)
+        both([&](QubitLayer &s) { s.applyRy(i, 0.3 + 0.1 * i); });
+    swap(0, 9);
+    swap(3, 4);
+    both([](QubitLayer &s) { s.applyCnot(0, 4); });
+    both([](QubitLayer &s) { s.applyRz(9, 0.7); });
+    swap(9, 2);
+    both([](QubitLayer &s) { s.applyCz(2, 5); });
+    both([](QubitLayer &s) { s.applyUnitary({1, 9}, gates::swap<precision>(), {0}); });
+    std::vector<int> permutation{3, 0, 1, 2, 9, 8, 7, 6, 5, 4};
+    q.permuteQubits(permutation);
+    // qubit j goes to permutation[j]: the qubit swapped into j goes on along the cycle
+    for (int j = 0; j < static_cast<int>(numQubits); j++)
+        while (permutation[j] != j)
+        {
+            int next = permutation[j];
+            reference.applyUnitary({j, next}, gates::swap<precision>());
+            std::swap(permutation[j], permutation[next]);
+        }
+    both([](QubitLayer &s) { s.applyPhaseOracle(std::vector<unsigned long long int>{0x2f1}); });
+    both([](QubitLayer &s) { s.applyPhaseOracle([](unsigned long long int i) { return i % 5 == 2; }); });
+    both([](QubitLayer &s) { s.applyDiffusion({1, 2, 7, 8}); });
+    both([](QubitLayer &s) { s.applyHadamard(3); });
+    bool testResult = q.getLayout() != reference.getLayout();
+    std::vector<PauliString> terms{pauliString("ZIIIIIIIIZ"), pauliString("IXYIIIIZII", 0.5)};
+    std::vector<precision> values = q.expectation(terms), expected = reference.expectation(terms);
+    testResult = std::abs(values[0] - expected[0]) < 1e-12 && std::abs(values[1] - expected[1]) < 1e-12 && testResult;
+    std::mt19937_64 rngQ(3), rngReference(3);
+    testResult = q.measure({9, 4}, rngQ) == reference.measure({9, 4}, rngReference) && testResult;
+    for (unsigned long long int i = 0; i < q.getNumStates(); i++)
+        testResult = std::abs(q.getQubitLayer()[i] - reference.getQubitLayer()[i]) < 1e-12 && testResult;
+    // a circuit that reverses its qubits, run in one chunk and in chunks of 4 qubits that need relocated qubits
+    Circuit c(numQubits);
+    for (int target = numQubits - 1; target >= 0; target--)
+    {
+        c.applyHadamard(target);
+        for (int control = target - 1; control >= 0; control--)
+            c.applyUnitary({target}, {{1, 0}, {0, 0}, {0, 0}, std::polar<precision>(1, pi / (1ULL << (target - control)))}, {control});
+    }
+    for (unsigned int i = 0; i < numQubits / 2; i++)
+        c.applySwap(i, numQubits - 1 - i);
+    c.applyRx(0, 0.4);
+    c.applyCnot(0, 8);
+    for (unsigned int chunkQubits : {numQubits, 4U})
+    {
+        QubitLayer run(numQubits), expectedRun(numQubits);
+        run.applyPauliX(1);
+        expectedRun.applyPauliX(1);
+        c.run(run, chunkQubits);
+        for (const Gate &gate : c.getGates())
+            expectedRun.applyUnitary(gate.targets, gate.matrix, gate.controls);
+        // in one chunk the swaps only relabel the qubits, while chunks may move qubits back down
+        testResult = (chunkQubits < numQubits || run.getLayout()[0] == 9) && testResult;
+        for (unsigned long long int i = 0; i < run.getNumStates(); i++)
+            testResult = std::abs(run.getQubitLayer()[i] - expectedRun.getQubitLayer()[i]) < 1e-12 && testResult;
+    }
+    // a sparse state is relabelled too, and moving its amplitudes rebuilds the map
+    QubitLayer sparse(40);
+    sparse.applyPauliX(0);
+    sparse.applySwap(0, 39);
+    sparse.relocateQubit(5, 0);
+    testResult = sparse.isSparse() && sparse.getLayout()[5] == 0 && sparse.getLayout()[39] == 5 && testResult;
+    testResult = sparse.expectation({pauliString(std::string(39, 'I') + "Z")})[0] == -1 && sparse.getMaxAmplitude().state == (1ULL << 39) && testResult;
+    // and so is a stabilizer state
+    Circuit clifford(3);
+    clifford.applyHadamard(0);
+    clifford.applyCnot(0, 1);
+    clifford.applySwap(1, 2);
+    std::mt19937_64 rng(9);
+    std::map<unsigned long long int, unsigned long long int> counts = clifford.sample({0, 1, 2}, 200, rng);
+    testResult = clifford.isClifford() && counts.size() == 2 && counts.count(0) && counts.count(5) && testResult;
+    std::cout << "Swap    " << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
+// runs the same random gates on a StaticQubitLayer<N>, on a QubitLayer and, recorded in a circuit, on another StaticQubitLayer<N>
+template <unsigned int N>
+bool matchesStatic(std::mt19937_64 &rng)
+{
+    std::uniform_int_distribution<int> qubit(0, N - 1);
+    std::uniform_real_distribution<precision> angle(0, 2 * pi);
+    StaticQubitLayer<N> q;
+    QubitLayer reference(N);
+    Circuit c(N);
+    auto all = [&](auto gate)
+    {
+        gate(q);
+        gate(reference);
+        gate(c);
+    };
+    for (int g = 0; g < 60; g++)
+    {
+        int target = qubit(rng);
+        int control = (target + 1) % N;
+        int control2 = (target + 2) % N;
+        precision theta = angle(rng);
+        switch (g % 10)
+        {
+        case 0:
+            all([&](auto &s) { s.applyHadamard(target); });
+            break;
+        case 1:
+            all([&](auto &s) { s.applyRx(target, theta); });
+            break;
+        case 2:
+            all([&](auto &s) { s.applyRy(target, theta); });
+            break;
+        case 3:
+            all([&](auto &s) { s.applyRz(target, theta); });
+            break;
+        case 4:
+            all([&](auto &s) { s.applyPauliY(target); });
+            break;
+        case 5:
+            all([&](auto &s) { s.applyCnot(control, target); });
+            break;
+        case 6:
+            all([&](auto &s) { s.applyCz(control, target); });
+            break;
+        case 7:
+            all([&](auto &s) { s.applyToffoli(control, control2, target); });
+            break;
+        case 8:
+            all([&](auto &s) { s.applySwap(target, control2); });
+            break;
+        default:
+            all([&](auto &s) { s.applyUnitary({target, control}, gates::swap<precision>(), {control2}); });
+        }
+    }
+    q.applyRy(0, 0.7);
+    reference.applyRy(0, 0.7);
+    c.applyRy(0, Parameter{0});
+    StaticQubitLayer<N> run;
+    c.run(run, {0.7});
+    bool testResult = true;
+    for (unsigned long long int i = 0; i < q.getNumStates(); i++)
+        testResult = std::abs(q.getQubitLayer()[i] - reference.getQubitLayer()[i]) < 1e-12 &&
+                     std::abs(run.getQubitLayer()[i] - reference.getQubitLayer()[i]) < 1e-12 && testResult;
+    std::vector<PauliString> terms{pauliString("Z" + std::string(N - 2, 'I') + "Z"), pauliString("XY" + std::string(N - 2, 'I'), 0.5)};
+    std::vector<precision> values = q.expectation(terms), expected = reference.expectation(terms);
+    return std::abs(values[0] - expected[0]) < 1e-12 && std::abs(values[1] - expected[1]) < 1e-12 && testResult;
+}
+
+bool testStatic()
+{
+    std::mt19937_64 rng(25);
+    bool testResult = matchesStatic<4>(rng) && matchesStatic<7>(rng) && matchesStatic<12>(rng);
+    // the scalar kernels specialised on the target, for each matrix structure and every target they cover
+    unsigned int numQubits = 9;
+    SimdLevel supported = kernels::getSupportedSimdLevel();
+    kernels::setSimdLevel(SimdLevel::scalar);
+    QubitLayer q(numQubits);
+    for (unsigned int i = 0; i < numQubits; i++)
+        q.applyRx(i, 0.2 + 0.3 * i);
+    for (int target = 0; target < static_cast<int>(numQubits); target++)
+        for (const std::vector<qubitLayer> &matrix : {gates::rx(0.4), gates::ry(0.9), gates::pauliY(), gates::hadamard()})
+        {
+            std::vector<qubitLayer> state(q.getQubitLayer(), q.getQubitLayer() + q.getNumStates());
+            std::vector<qubitLayer> expected = referenceUnitary(state, {target}, matrix, {});
+            q.applyUnitary({target}, matrix);
+            for (unsigned long long int i = 0; i < q.getNumStates(); i++)
+                testResult = std::abs(q.getQubitLayer()[i] - expected[i]) < 1e-12 && testResult;
+        }
+    kernels::setSimdLevel(supported);
+    std::cout << "Static  " << (testResult ? " \033[32;32m[PASSED]\033[m" : " \033[31;31m[FAILED]\033[m") << std::endl;
+    return testResult;
+}
+
 int main(int argc, char *argv[])
 {
     // define variable to store result of the tests
@@ -98,5 +1300,27 @@ int main(int argc, char *argv[])
     std::cout << "\033[34;34m===========Test Results===========\033[m" << std::endl;
     for (int gate = X; gate <= mcphase; gate++)
         testResult = testGate(static_cast<Gates>(gate)) && testResult;
+    testResult = testParallel() && testResult;
+    testResult = testSimd() && testResult;
+    testResult = testUnitary() && testResult;
+    testResult = testCircuit() && testResult;
+    testResult = testSparse() && testResult;
+    testResult = testFloat() && testResult;
+    testResult = testMapped() && testResult;
+    testResult = testMeasure() && testResult;
+    testResult = testExpectation() && testResult;
+    testResult = testCheckpoint() && testResult;
+    testResult = testDistributed() && testResult;
+    testResult = testBlocked() && testResult;
+    testResult = testBatch() && testResult;
+    testResult = testProfile() && testResult;
+    testResult = testGrover() && testResult;
+    testResult = testStabilizer() && testResult;
+    testResult = testDiagonal() && testResult;
+    testResult = testJobs() && testResult;
+    testResult = testGradient() && testResult;
+    testResult = testMemory() && testResult;
+    testResult = testSwap() && testResult;
+    testResult = testStatic() && testResult;
     return testResult ? EXIT_SUCCESS : EXIT_FAILURE;
 }
\ No newline at end of file